@@ -0,0 +1,132 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+// BLOCK
+// Translated blocks: straight-line runs of predecoded instructions, so that
+// fetch, RVC expansion and decode happen once per block instead of once per
+// executed instruction.
+//
+// A block ends after the first branch, jump or SYSTEM-class instruction,
+// at the end of its page, or after BLOCK_MAX_INSNS. Only the first
+// instruction may cross into the next page, so a fetch fault during
+// translation is always the block's first instruction and stays precise.
+// Blocks live in a direct-mapped cache tagged like the ITLB, with the pc
+// and the fetch context, and are dropped on SFENCE.VMA.
+//
+// Self-modifying code: each cached block is also linked into a list for
+// the physical page it came from, and the page is marked in the DRAM code
+// bitmap. A store to a marked page drops the page's blocks whose code it
+// overlaps, and stops the running block after the storing instruction if
+// it is one of them; data stored next to code costs a walk of the page's
+// list and nothing more. Pages whose code keeps being rewritten (a JIT in
+// the guest) stop being cached after BLOCK_SMC_LIMIT such stores within
+// BLOCK_SMC_WINDOW instructions; their blocks are translated afresh each
+// time they run, which is plain interpretation, until a window has passed
+// since the first of those stores and the count starts over, so a loader
+// that reloads a page now and then is not penalized for good. Device DMA
+// is not tracked per store: FENCE.I drops blocks from pages devices had
+// access to.
+//
+// Blocks that are whole copy, fill or scan loops, and the entries of
+// memcpy, memset and strlen, are tagged with an idiom that runs them in
+// bulk (see idiom.h).
+//
+// Coverage is instrumented here too: each block carries its AFL location,
+// and entering it records the edge from the previous block.
+//
+// Blocks that keep running get a second translation into ops, made in the
+// background (see tier.h).
+//
+// With a debugger attached, an instruction with a breakpoint on it is
+// translated as the last op of its block, with an exec that stops into
+// the debugger instead of its own.
+#include <stdint.h>
+
+#include "dram.h"
+#include "idiom.h"
+
+#define BLOCK_MAX_INSNS 32
+
+#ifndef BLOCK_CACHE_BITS
+#define BLOCK_CACHE_BITS 12  // blocks in the cache = 1 << BLOCK_CACHE_BITS
+#endif
+#define BLOCK_CACHE_SIZE (1 << BLOCK_CACHE_BITS)
+#define BLOCK_INDEX(pc) (((pc) >> 1) & (BLOCK_CACHE_SIZE - 1))
+#define BLOCK_INVALID (~0ULL)  // an odd pc, which never matches
+#define BLOCK_SMC_LIMIT 16     // invalidations before a page is interpreted
+#define BLOCK_SMC_WINDOW (1ULL << 28)  // instructions the limit applies to
+
+struct cpu;
+struct TIER_OPS;
+
+typedef struct BLOCK_INSN {
+    void (*exec)(struct cpu *cpu, uint32_t inst);
+    uint32_t inst;  // expanded to 32 bits; the raw parcel if it is illegal
+    uint16_t id;    // isa_decode() id
+    uint8_t len;    // 2 or 4 bytes
+} BLOCK_INSN;
+
+typedef struct BLOCK {
+    uint64_t pc;
+    uint64_t ctx;  // mmu.ctx_fetch it was translated under
+    uint64_t paddr;  // physical address of pc
+    uint32_t bytes;  // of code in the block
+    int n;         // set to 0 to stop the block while it runs
+    int page;      // DRAM page it is listed under, -1 if none
+    uint16_t cov_loc;  // AFL location, cov_location(pc)
+    uint32_t gen;      // translations made in this slot
+    uint32_t heat;     // runs since it was translated
+    struct TIER_OPS *ops;  // tier 2 ops, published by the tier worker
+    IDIOM idiom;       // a copy, fill or scan loop, or a libc call
+    struct BLOCK *page_next;
+    struct BLOCK *page_prev;
+    BLOCK_INSN insn[BLOCK_MAX_INSNS];
+} BLOCK;
+
+typedef struct BLOCK_CACHE {
+    BLOCK *blocks;
+    BLOCK *running;  // the block the hart is in, NULL between blocks
+    BLOCK *page_blocks[DRAM_PAGES];  // cached blocks by physical page
+    uint32_t page_smc[DRAM_PAGES];   // stores that rewrote code, per page
+    uint64_t page_smc_start[DRAM_PAGES];  // instret at the first of them
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    IDIOM_FUNCS funcs;            // library calls run as idioms
+    uint64_t idiom_iterations;    // loop iterations run in bulk
+    uint64_t idiom_calls;         // library calls run in bulk
+    uint64_t tier_runs;           // blocks run as tier 2 ops
+} BLOCK_CACHE;
+
+void block_init(struct cpu *cpu);
+
+// the block at pc, translated first if it is not cached; a fetch fault
+// unwinds like any other exception
+BLOCK *block_lookup(struct cpu *cpu, uint64_t pc);
+
+// run a block; leaves pc at the next block's entry
+void block_execute(struct cpu *cpu, BLOCK *block);
+
+void block_flush(struct cpu *cpu);
+
+// run the one instruction at pc outside any block, for single-stepping;
+// breakpoints are not planted
+void block_step(struct cpu *cpu);
+
+// a store of len bytes at paddr hit a page in the DRAM code bitmap: drop
+// the page's blocks it overwrote
+void block_invalidate_code(struct cpu *cpu, uint64_t paddr, uint64_t len);
+
+// drop the cached blocks whose code covers the virtual address pc,
+// stopping the running one after the current instruction if it is one
+void block_invalidate_pc(struct cpu *cpu, uint64_t pc);
+
+// stop the running block after the current instruction and drop it from
+// the cache; a store outside any block is left alone
+void block_stop(struct cpu *cpu);
+
+// FENCE.I: drop blocks from pages that devices may have written
+void block_fence_i(struct cpu *cpu);
+
+void block_dump_stats(struct cpu *cpu);
+
+#endif
@@ -1,12 +1,25 @@
 #ifndef BUS_H
 #define BUS_H
 
+#include "clint.h"
 #include "dram.h"
+#include "plic.h"
+#include "virtio_blk.h"
+#include "virtio_net.h"
 
 typedef struct bus {
     struct DRAM dram;
+    struct CLINT clint;
+    struct PLIC plic;
+    struct VIRTIO_BLK virtio_blk;
+    struct VIRTIO_NET virtio_net;
 } BUS;
 
+void bus_init(BUS *bus);
+
+// whether addr is backed by a device register (RAM excluded)
+int bus_has_device(BUS *bus, uint64_t addr);
+
 uint64_t bus_load(BUS *bus, uint64_t addr, uint64_t size);
 
 void bus_store(BUS *bus, uint64_t addr, uint64_t size, uint64_t value);
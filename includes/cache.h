@@ -0,0 +1,88 @@
+#ifndef CACHE_H
+#define CACHE_H
+// CACHE
+// Optional model of the guest cache hierarchy: split L1 instruction and
+// data caches in front of a unified L2, each with its own size,
+// associativity, line size and replacement policy. It only counts hits
+// and misses. There is no timing, coherence or write-back traffic.
+//
+// The CPU does not simulate anything on its fast path. Each RAM access,
+// and each executed block's fetch span, is appended to a buffer of
+// physical references, and the buffer is run through the caches in bulk
+// once it fills. Misses are attributed to the guest pc that caused them,
+// and through the symbol table to functions.
+#include <stdint.h>
+
+#include "symbols.h"
+
+#define CACHE_BATCH 4096       // references buffered before simulating
+#define CACHE_PC_BITS 14       // pcs tracked for miss attribution = 1 << bits
+#define CACHE_REPORT_TOP 10    // pcs and symbols listed in the report
+
+enum { CACHE_FETCH, CACHE_LOAD, CACHE_STORE };
+enum { CACHE_L1I, CACHE_L1D, CACHE_L2, CACHE_LEVELS };
+
+typedef enum CACHE_POLICY {
+    CACHE_LRU,
+    CACHE_FIFO,
+    CACHE_RANDOM,
+} CACHE_POLICY;
+
+typedef struct CACHE_LEVEL {
+    uint32_t size;  // bytes
+    uint32_t ways;
+    uint32_t line;  // bytes, a power of two
+    CACHE_POLICY policy;
+
+    uint32_t sets;
+    int line_shift;
+    uint64_t *tags;   // sets * ways line addresses, ~0 when invalid
+    uint64_t *stamp;  // last use (LRU) or fill (FIFO) per way
+    uint64_t clock;
+
+    uint64_t hits;
+    uint64_t misses;
+} CACHE_LEVEL;
+
+typedef struct CACHE_REF {
+    uint64_t pc;    // guest pc (of the block, for fetches)
+    uint64_t addr;  // physical address
+    uint32_t size;  // bytes
+    uint32_t type;  // CACHE_FETCH, CACHE_LOAD or CACHE_STORE
+} CACHE_REF;
+
+typedef struct CACHE_PC {
+    uint64_t pc;  // 0 when the entry is free
+    uint64_t misses[CACHE_LEVELS];
+} CACHE_PC;
+
+typedef struct CACHE_SIM {
+    CACHE_LEVEL level[CACHE_LEVELS];
+    CACHE_REF buf[CACHE_BATCH];
+    int n;
+
+    CACHE_PC pcs[1 << CACHE_PC_BITS];
+    uint64_t untracked[CACHE_LEVELS];  // misses of pcs that found no entry
+    SYMBOLS *symbols;
+} CACHE_SIM;
+
+// Build the hierarchy from a spec such as "l1d=16k:4:64:fifo,l2=512k",
+// where each level takes size[:ways[:line[:lru|fifo|random]]] and the
+// levels not named keep 32k:8:64:lru (L1) and 256k:8:64:lru (L2).
+// "default" takes the defaults. Returns NULL on a malformed spec.
+CACHE_SIM *cache_create(const char *spec, SYMBOLS *symbols);
+
+// simulate the buffered references
+void cache_drain(CACHE_SIM *cache);
+
+static inline void cache_access(CACHE_SIM *cache, uint64_t pc,
+                                uint64_t addr, uint32_t size, int type)
+{
+    cache->buf[cache->n++] = (CACHE_REF){pc, addr, size, type};
+    if (cache->n == CACHE_BATCH)
+        cache_drain(cache);
+}
+
+void cache_dump_stats(CACHE_SIM *cache);
+
+#endif
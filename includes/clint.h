@@ -0,0 +1,39 @@
+#ifndef CLINT_H
+#define CLINT_H
+// CLINT
+// Core-local interruptor: provides the machine timer (mtime/mtimecmp) and the
+// machine software interrupt (msip) of the single hart.
+#include <stdint.h>
+#include <time.h>
+
+#define CLINT_BASE 0x2000000
+#define CLINT_SIZE 0x10000
+#define CLINT_MSIP 0x0
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME 0xbff8
+
+#define CLINT_FREQ 10000000  // mtime ticks per second (10 MHz)
+
+typedef struct CLINT {
+    uint32_t msip;
+    uint64_t mtimecmp;
+    uint64_t mtime_offset;  // host ticks at reset, so mtime starts from 0
+    struct REPLAY *replay;  // mtime reads are recorded or replayed, or NULL
+} CLINT;
+
+void clint_init(CLINT *clint);
+
+// the current value of mtime, derived from the host monotonic clock
+uint64_t clint_mtime(CLINT *clint);
+
+// mtime as the guest reads it, through the replay log if there is one
+uint64_t clint_read_mtime(CLINT *clint);
+
+// the host CLOCK_MONOTONIC time at which mtime reaches mtimecmp
+struct timespec clint_deadline(CLINT *clint);
+
+uint64_t clint_load(CLINT *clint, uint64_t addr, uint64_t size);
+
+void clint_store(CLINT *clint, uint64_t addr, uint64_t size, uint64_t value);
+
+#endif
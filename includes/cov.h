@@ -0,0 +1,70 @@
+#ifndef COV_H
+#define COV_H
+// COV
+// Edge coverage for fuzzing guest code with AFL++, and the persistent loop
+// that runs one test case after another in the same process.
+//
+// Blocks end at every branch and jump, so each transition from one block to
+// the next is a control-flow edge. Each block gets an AFL location when it
+// is translated, hashed from its pc the way QEMU mode does, and entering a
+// block bumps the hit count of (previous location >> 1) ^ location in a
+// 64 KiB map: the shared memory segment AFL names in __AFL_SHM_ID, or a
+// private map reported at exit when running without AFL.
+//
+// A test case is read from stdin into guest RAM at the input address, and
+// the guest starts with a0 = that address and a1 = its length. It ends when
+// the guest returns to pc 0, and crashes (SIGABRT) on a trap with no
+// handler. Under AFL the emulator is a persistent fork server: the machine
+// is loaded once, a child runs COV_RUNS test cases, stopping itself after
+// each one, and resets between them to a snapshot of the CPU, DRAM, CLINT
+// and PLIC taken before the first. Devices backed by the host (disk,
+// network) and the debugging options are not available with coverage.
+#include <stdint.h>
+
+#include "dram.h"
+
+#define COV_MAP_SIZE (1 << 16)
+#define COV_RUNS 1000  // test cases per child before a fresh fork
+
+struct cpu;
+
+typedef struct COV {
+    struct cpu *cpu;
+    uint8_t *map;    // COV_MAP_SIZE hit counts
+    uint16_t prev;   // location of the previous block, shifted right once
+    int afl;         // running under the AFL fork server
+    uint64_t input;  // guest physical address the test case is read to
+    int runs;        // test cases run by this process
+
+    // the machine as loaded, restored before each test case
+    struct cpu *snapshot;
+    uint8_t *snapshot_mem;
+} COV;
+
+// the AFL location of a block at pc
+static inline uint16_t cov_location(uint64_t pc)
+{
+    return ((pc >> 4) ^ (pc << 8)) & (COV_MAP_SIZE - 1);
+}
+
+// entering a block at loc; the count never wraps to 0, as in AFL++
+static inline void cov_edge(COV *cov, uint16_t loc)
+{
+    uint8_t *count = &cov->map[cov->prev ^ loc];
+
+    *count += 1;
+    *count += *count == 0;
+    cov->prev = loc >> 1;
+}
+
+// attach AFL's map, or a private one; returns NULL if input is not in RAM
+COV *cov_create(struct cpu *cpu, uint64_t input);
+
+// start the next test case: on the first call under AFL this is the fork
+// server, which never returns in the parent. Returns 0 once this process
+// has no more test cases to run.
+int cov_next(struct cpu *cpu);
+
+void cov_dump_stats(COV *cov);
+
+#endif
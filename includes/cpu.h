@@ -1,28 +1,117 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdint.h>
+#include "block.h"
 #include "bus.h"
+#include "cache.h"
+#include "cov.h"
+#include "csr.h"
+#include "gdb.h"
+#include "mmu.h"
+#include "replay.h"
+#include "semihost.h"
+#include "stats.h"
+#include "tier.h"
+#include "timing.h"
+#include "trap.h"
+#include "vector.h"
+#include "watch.h"
 
-#define ADDR_MISALIGNED(addr) (addr & 0x3)
+#define ADDR_MISALIGNED(addr) ((addr) & 0x1)  // IALIGN = 16 with RVC
+
+// privilege levels
+#define PRIV_U 0
+#define PRIV_S 1
+#define PRIV_M 3
+
+// instructions between checks for timer interrupts
+#define CPU_POLL_INTERVAL 1024
 
 typedef struct cpu {
-    uint64_t regs[32];  // 32 64-bit registers (x0-x31)
+    // Hot: touched by every instruction. The registers fill four cache
+    // lines; pc, the counters, privilege and the start of the MMU (the TLB
+    // contexts and hit counters) fill the fifth.
+    uint64_t regs[32] __attribute__((aligned(64)));  // x0-x31
     uint64_t pc;        // 64-bit program counter
-    uint64_t csr[4069];
-    BUS bus;  // CPU connected to BUS
+    uint64_t inst_pc;   // pc of the instruction being executed
+    uint64_t instret;   // instructions retired, also the cycle count
+    int poll_budget;    // instructions left until interrupts are checked
+    int priv;           // current privilege level
+    MMU mmu;
+    BLOCK_CACHE bcache;
+
+    // Cold: FP, vector and CSR state, devices and the trap/WFI plumbing
+    uint64_t fregs[32];  // f0-f31, singles NaN-boxed
+    VECTOR vec;          // v0-v31 and the vector CSRs
+    CSR_FILE csr;
+    int fp_rm;  // rounding mode the host FPU is currently set to
+    BUS *bus;   // CPU connected to BUS, allocated by cpu_init
+    CACHE_SIM *cache;  // cache model fed with RAM accesses, or NULL
+    TIMING *timing;    // pipeline model fed with executed ops, or NULL
+    GDB *gdb;          // attached debugger, or NULL
+    WATCH *watch;      // page-protection watchpoints, or NULL
+    REPLAY *replay;    // record/replay log of the guest's inputs, or NULL
+    COV *cov;          // edge coverage for fuzzing, or NULL
+    SEMIHOST *semihost;  // host file access for the guest, or NULL
+    STATS *stats;      // live statistics export, or NULL
+    TIER *tier;        // background translation of hot blocks, or NULL
+    HART_COUNTERS counters;  // on lines of their own, for the exporter
+    jmp_buf trap_env;  // set by the dispatcher, where exceptions unwind to
+
+    // WFI parks the host thread here until an interrupt becomes pending
+    pthread_mutex_t wfi_lock;
+    pthread_cond_t wfi_cond;
+    int poll_now;  // set by other threads: poll at the next block boundary
 } CPU;
 
 void cpu_init(CPU *cpu);
 
-uint32_t cpu_fetch(CPU *cpu);
+// fetch the instruction at addr, either a 32-bit instruction or a
+// compressed parcel in the low 16 bits
+uint32_t cpu_fetch(CPU *cpu, uint64_t addr);
 
 void cpu_store(CPU *cpu, uint64_t addr, uint64_t size, uint64_t value);
 
 uint64_t cpu_load(CPU *cpu, uint64_t addr, uint64_t size);
 
+// host pointer to len bytes of guest RAM at addr for a load or store, or
+// NULL if the range crosses a page or is not RAM; faults like an access
+void *cpu_ram_ptr(CPU *cpu, uint64_t addr, uint64_t len, int access);
+
+// the same if the DTLB already maps the page for the access, else NULL:
+// it never walks the page table and never faults
+void *cpu_ram_peek(CPU *cpu, uint64_t addr, uint64_t len, int access);
+
+// instruction semantics, indexed by isa_decode() id
+extern void (*const isa_exec[])(CPU *cpu, uint32_t inst);
+
+// decode and run one 32-bit (or expanded) instruction
 int cpu_execute(CPU *cpu, uint32_t inst);
 
+// set (level = 1) or clear (level = 0) the given bits of mip, waking the hart
+// if it is waiting in WFI. Safe to call from device threads.
+void cpu_set_irq(CPU *cpu, uint64_t mask, int level);
+
+// have the hart poll at its next block boundary; safe from any thread and
+// from signal handlers, unlike writing poll_budget, which only the hart may
+void cpu_request_poll(CPU *cpu);
+
+// mip with the CLINT timer and software interrupt lines folded in
+uint64_t cpu_mip(CPU *cpu);
+
+// the same with the asynchronous bits as they are on the host right now,
+// not as last latched for record/replay
+uint64_t cpu_mip_live(CPU *cpu);
+
+// whether any interrupt enabled in mie is pending in mip
+int cpu_interrupt_pending(CPU *cpu);
+
+// sleep until cpu_interrupt_pending() or the next timer deadline
+void cpu_wfi(CPU *cpu);
+
 void dump_registers(CPU *cpu);
 
 #endif
\ No newline at end of file
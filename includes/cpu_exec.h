@@ -1,18 +1,11 @@
+#include <math.h>
+
+#include "block.h"
 #include "cpu.h"
 #include "csr.h"
 #include "dram.h"
+#include "fpu.h"
 #include "isa_decode.h"
-#include "opcode.h"
-
-#define ANSI_YELLOW "\x1b[33m"
-#define ANSI_BLUE "\x1b[31m"
-#define ANSI_RESET "\x1b[0m"
-
-// print operation for DEBUG
-void print_op(char *s)
-{
-    printf("%s%s%s", ANSI_BLUE, s, ANSI_RESET);
-}
 
 // ADD Operation
 void exec_ADD(CPU *cpu, uint32_t inst)
@@ -20,72 +13,154 @@ void exec_ADD(CPU *cpu, uint32_t inst)
     //cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] + cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] =
         (uint64_t) ((int64_t)cpu->regs[rs1(inst)] + (int64_t)cpu->regs[rs2(inst)]);
-    print_op("add\n");
 }
 
 void exec_ADDI(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] + (int64_t) imm;
-    print_op("addi\n");
 }
 
 void exec_ADDW(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = (int64_t) (int32_t) (cpu->regs[rs1(inst)] +
                                                (int64_t) cpu->regs[rs2(inst)]);
-    print_op("addw\n");
 }
 
 void exec_ADDIW(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] + (int64_t) imm;
-    print_op("addiw\n");
 }
 
 // SUB Operation
+void exec_SUB(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] - cpu->regs[rs2(inst)];
+}
+
 void exec_SUBW(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = (int64_t) (int32_t) (cpu->regs[rs1(inst)] -
                                                (int64_t) cpu->regs[rs2(inst)]);
-    print_op("subw\n");
 }
 
-// MUL Operation
+// M extension
+// Divide-by-zero and signed overflow never trap: the divisor is nudged to
+// a safe value with masks and the architectural result is blended back in,
+// so the host divide runs unconditionally without a data-dependent branch.
+void exec_MUL(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] * cpu->regs[rs2(inst)];
+}
+
+void exec_MULH(CPU *cpu, uint32_t inst)
+{
+    __int128 a = (int64_t) cpu->regs[rs1(inst)];
+    __int128 b = (int64_t) cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = (uint64_t) ((a * b) >> 64);
+}
+
+void exec_MULHSU(CPU *cpu, uint32_t inst)
+{
+    __int128 a = (int64_t) cpu->regs[rs1(inst)];
+    __int128 b = (uint64_t) cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = (uint64_t) ((a * b) >> 64);
+}
+
+void exec_MULHU(CPU *cpu, uint32_t inst)
+{
+    unsigned __int128 a = cpu->regs[rs1(inst)];
+    unsigned __int128 b = cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = (uint64_t) ((a * b) >> 64);
+}
+
 void exec_MULW(CPU *cpu, uint32_t inst)
 {
-    cpu->regs[rd(inst)] = (int64_t) (int32_t) (cpu->regs[rs1(inst)] *
-                                               (int64_t) cpu->regs[rs2(inst)]);
-    print_op("mulw\n");
+    cpu->regs[rd(inst)] =
+        (int64_t) (int32_t) (cpu->regs[rs1(inst)] * cpu->regs[rs2(inst)]);
 }
 
 // DIV Operation
+void exec_DIV(CPU *cpu, uint32_t inst)
+{
+    int64_t a = cpu->regs[rs1(inst)];
+    int64_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    // INT64_MIN / -1 becomes INT64_MIN / 1, which is the spec result
+    int64_t ovf = (a == INT64_MIN) & (b == -1);
+    int64_t q = a / (b + (int64_t) (zero & 1) + 2 * ovf);
+    cpu->regs[rd(inst)] = (uint64_t) q | zero;
+}
+
+void exec_DIVU(CPU *cpu, uint32_t inst)
+{
+    uint64_t a = cpu->regs[rs1(inst)];
+    uint64_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    cpu->regs[rd(inst)] = (a / (b | (zero & 1))) | zero;
+}
+
 void exec_DIVW(CPU *cpu, uint32_t inst)
 {
-    cpu->regs[rd(inst)] = (int64_t) (int32_t) (cpu->regs[rs1(inst)] /
-                                               (int64_t) cpu->regs[rs2(inst)]);
-    print_op("divw\n");
+    int32_t a = cpu->regs[rs1(inst)];
+    int32_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    int32_t ovf = (a == INT32_MIN) & (b == -1);
+    int32_t q = a / (b + (int32_t) (zero & 1) + 2 * ovf);
+    cpu->regs[rd(inst)] = (uint64_t) (int64_t) q | zero;
 }
 
 void exec_DIVUW(CPU *cpu, uint32_t inst)
 {
-    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] / (int64_t) cpu->regs[rs2(inst)];
-    print_op("divuw\n");
+    uint32_t a = cpu->regs[rs1(inst)];
+    uint32_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    uint32_t q = a / (b | (uint32_t) (zero & 1));
+    cpu->regs[rd(inst)] = (uint64_t) (int64_t) (int32_t) q | zero;
 }
 
 // Remainder Operation
+void exec_REM(CPU *cpu, uint32_t inst)
+{
+    int64_t a = cpu->regs[rs1(inst)];
+    int64_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    // INT64_MIN % -1 becomes INT64_MIN % 1, which yields the spec's 0
+    int64_t ovf = (a == INT64_MIN) & (b == -1);
+    int64_t r = a % (b + (int64_t) (zero & 1) + 2 * ovf);
+    cpu->regs[rd(inst)] = ((uint64_t) r & ~zero) | ((uint64_t) a & zero);
+}
+
+void exec_REMU(CPU *cpu, uint32_t inst)
+{
+    uint64_t a = cpu->regs[rs1(inst)];
+    uint64_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    uint64_t r = a % (b | (zero & 1));
+    cpu->regs[rd(inst)] = (r & ~zero) | (a & zero);
+}
+
 void exec_REMW(CPU *cpu, uint32_t inst)
 {
-    cpu->regs[rd(inst)] = (int64_t) (int32_t) (cpu->regs[rs1(inst)] %
-                                               (int64_t) cpu->regs[rs2(inst)]);
-    print_op("remw\n");
+    int32_t a = cpu->regs[rs1(inst)];
+    int32_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    int32_t ovf = (a == INT32_MIN) & (b == -1);
+    int32_t r = a % (b + (int32_t) (zero & 1) + 2 * ovf);
+    cpu->regs[rd(inst)] =
+        ((uint64_t) (int64_t) r & ~zero) | ((uint64_t) (int64_t) a & zero);
 }
 
 void exec_REMUW(CPU *cpu, uint32_t inst)
 {
-    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] % (int64_t) cpu->regs[rs2(inst)];
-    print_op("remuw\n");
+    uint32_t a = cpu->regs[rs1(inst)];
+    uint32_t b = cpu->regs[rs2(inst)];
+    uint64_t zero = -(uint64_t) (b == 0);
+    uint32_t r = a % (b | (uint32_t) (zero & 1));
+    uint64_t sa = (int64_t) (int32_t) a;
+    cpu->regs[rd(inst)] = ((uint64_t) (int64_t) (int32_t) r & ~zero) |
+                          (sa & zero);
 }
 
 // SLT Operation
@@ -93,28 +168,24 @@ void exec_SLT(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] =
         (cpu->regs[rs1(inst)] < (int64_t) cpu->regs[rs2(inst)]) ? 1 : 0;
-    print_op("slt\n");
 }
 
 void exec_SLTI(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] < (int64_t) imm) ? 1 : 0;
-    print_op("slti\n");
 }
 
 // SLT in unsigned
 void exec_SLTU(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] < cpu->regs[rs2(inst)]) ? 1 : 0;
-    print_op("sltu\n");
 }
 
 void exec_SLTIU(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] < imm) ? 1 : 0;
-    print_op("sltiu\n");
 }
 
 // SRA Operation
@@ -122,14 +193,11 @@ void exec_SRA(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] =
         (int32_t) cpu->regs[rs1(inst)] >> (int64_t) cpu->regs[rs2(inst)];
-    print_op("sra\n");
 }
 
 void exec_SRAI(CPU *cpu, uint32_t inst)
 {
-    uint64_t imm = imm_I(inst);
-    cpu->regs[rd(inst)] = (int32_t) cpu->regs[rs1(inst)] >> imm;
-    print_op("srai\n");
+    cpu->regs[rd(inst)] = (int64_t) cpu->regs[rs1(inst)] >> shamt(inst);
 }
 
 void exec_SRAW(CPU *cpu, uint32_t inst)
@@ -137,7 +205,6 @@ void exec_SRAW(CPU *cpu, uint32_t inst)
     cpu->regs[rd(inst)] = (int64_t) (int32_t) (cpu->regs[rs1(inst)] >>
                                                (uint64_t) (int64_t) (int32_t)
                                                    cpu->regs[rs2(inst)]);
-    print_op("sraw\n");
 }
 
 void exec_SRAIW(CPU *cpu, uint32_t inst)
@@ -146,49 +213,42 @@ void exec_SRAIW(CPU *cpu, uint32_t inst)
     cpu->regs[rd(inst)] =
         (int64_t) (int32_t) (cpu->regs[rs1(inst)] >>
                              (uint64_t) (int64_t) (int32_t) imm);
-    print_op("sraiw\n");
 }
 
 // OR Operation
 void exec_OR(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] | cpu->regs[rs2(inst)];
-    print_op("or\n");
 }
 
 void exec_ORI(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] | imm;
-    print_op("ori\n");
 }
 
 // AND Operation
 void exec_AND(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] & cpu->regs[rs2(inst)];
-    print_op("and\n");
 }
 
 void exec_ANDI(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] & imm;
-    print_op("andi\n");
 }
 
 // XOR Operation
 void exec_XOR(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] ^ cpu->regs[rs2(inst)];
-    print_op("xor\n");
 }
 
 void exec_XORI(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] ^ imm;
-    print_op("xori\n");
 }
 
 // Shift Left Logical Operation
@@ -196,54 +256,46 @@ void exec_SLL(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)]
                           << (int64_t) cpu->regs[rs2(inst)];
-    print_op("sll\n");
 }
 
 void exec_SLLI(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] << shamt(inst);
-    print_op("slli\n");
 }
 
 void exec_SLLW(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] =
         (int64_t) (int32_t) (cpu->regs[rs1(inst)] << cpu->regs[rs2(inst)]);
-    print_op("sllw\n");
 }
 
 void exec_SLLIW(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] =
         (int64_t) (int32_t) (cpu->regs[rs1(inst)] << shamt(inst));
-    print_op("slliw\n");
 }
 
 // Shift Right Logical Operation
 void exec_SRL(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] >> cpu->regs[rs2(inst)];
-    print_op("srl\n");
 }
 
 void exec_SRLI(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] >> shamt(inst);
-    print_op("srli\n");
 }
 
 void exec_SRLW(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] =
         (int64_t) (int32_t) (cpu->regs[rs1(inst)] >> cpu->regs[rs2(inst)]);
-    print_op("srlw\n");
 }
 
 void exec_SRLIW(CPU *cpu, uint32_t inst)
 {
     cpu->regs[rd(inst)] =
         (int64_t) (int32_t) cpu->regs[rs1(inst)] >> shamt(inst);
-    print_op("srli\n");
 }
 
 // Store Operation: Store Byte
@@ -258,7 +310,6 @@ void exec_SB(CPU *cpu, uint32_t inst)
               cpu->regs[rs2(inst)]);  // Store the value from rs2 into the
                                       // address. Using 8 bits because the
                                       // function is size of data is a byte
-    print_op("sb\n");
 }
 
 // Store Operation: Store Halfword
@@ -268,7 +319,6 @@ void exec_SH(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_S(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu_store(cpu, addr, 16, cpu->regs[rs2(inst)]);
-    print_op("sh\n");
 }
 
 // Store Operation: Store Word
@@ -278,7 +328,6 @@ void exec_SW(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_S(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu_store(cpu, addr, 32, cpu->regs[rs2(inst)]);
-    print_op("sw\n");
 }
 
 // Store Operation: Store Doubleword
@@ -288,7 +337,6 @@ void exec_SD(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_S(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu_store(cpu, addr, 64, cpu->regs[rs2(inst)]);
-    print_op("sd\n");
 }
 
 // Load Operation
@@ -297,7 +345,6 @@ void exec_LB(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_I(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu->regs[rd(inst)] = (int64_t) (int8_t) cpu_load(cpu, addr, 8);
-    print_op("lb\n");
 }
 
 void exec_LH(CPU *cpu, uint32_t inst)
@@ -305,7 +352,6 @@ void exec_LH(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_I(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu->regs[rd(inst)] = (int64_t) (int16_t) cpu_load(cpu, addr, 16);
-    print_op("lh\n");
 }
 
 void exec_LW(CPU *cpu, uint32_t inst)
@@ -315,7 +361,6 @@ void exec_LW(CPU *cpu, uint32_t inst)
     cpu->regs[rd(inst)] = (int64_t)(int32_t) cpu_load(cpu, addr, 32);
     //uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     //cpu->regs[rs1(inst)] = (int64_t) (int32_t) cpu_load(cpu, addr, 32);
-    print_op("lw\n");
 }
 
 void exec_LD(CPU *cpu, uint32_t inst)
@@ -323,7 +368,6 @@ void exec_LD(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_I(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu->regs[rd(inst)] = (int64_t) cpu_load(cpu, addr, 64);
-    print_op("ld\n");
 }
 
 // unsigned LB
@@ -332,7 +376,6 @@ void exec_LBU(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_I(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu->regs[rd(inst)] = cpu_load(cpu, addr, 8);
-    print_op("lb\n");
 }
 
 // unsigned LH
@@ -341,7 +384,6 @@ void exec_LHU(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_I(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu->regs[rd(inst)] = cpu_load(cpu, addr, 16);
-    print_op("lh\n");
 }
 
 void exec_LWU(CPU *cpu, uint32_t inst)
@@ -349,7 +391,6 @@ void exec_LWU(CPU *cpu, uint32_t inst)
     uint64_t imm = imm_I(inst);
     uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm;
     cpu->regs[rd(inst)] = cpu_load(cpu, addr, 32);
-    print_op("lw\n");
 }
 
 // B-Type Operation
@@ -358,50 +399,44 @@ void exec_BEQ(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_B(inst);
     if ((int64_t) cpu->regs[rs1(inst)] == (int64_t) cpu->regs[rs2(inst)])
-        cpu->pc = cpu->pc + (int64_t) imm - 4;
-    print_op("beq\n");
+        cpu->pc = cpu->inst_pc + (int64_t) imm;
 }
 
 void exec_BNE(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_B(inst);
     if ((int64_t) cpu->regs[rs1(inst)] != (int64_t) cpu->regs[rs2(inst)])
-        cpu->pc = (cpu->pc + (int64_t) imm - 4);
+        cpu->pc = cpu->inst_pc + (int64_t) imm;
     //if ((int64_t) cpu->regs[rs1(inst)] != (int64_t) cpu->regs[rs2(inst)])
     //    cpu->pc = cpu->pc + (int64_t) imm - 4;
-    print_op("bne\n");
 }
 
 void exec_BLT(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_B(inst);
     if ((int64_t) cpu->regs[rs1(inst)] < (int64_t) cpu->regs[rs2(inst)])
-        cpu->pc = cpu->pc + (int64_t) imm - 4;
-    print_op("blt\n");
+        cpu->pc = cpu->inst_pc + (int64_t) imm;
 }
 
 void exec_BGE(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_B(inst);
     if ((int64_t) cpu->regs[rs1(inst)] >= (int64_t) cpu->regs[rs2(inst)])
-        cpu->pc = cpu->pc + (int64_t) imm - 4;
-    print_op("bge\n");
+        cpu->pc = cpu->inst_pc + (int64_t) imm;
 }
 
 void exec_BLTU(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_B(inst);
     if (cpu->regs[rs1(inst)] < cpu->regs[rs2(inst)])
-        cpu->pc = cpu->pc + (int64_t) imm - 4;
-    print_op("bltu\n");
+        cpu->pc = cpu->inst_pc + (int64_t) imm;
 }
 
 void exec_BGEU(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_B(inst);
     if (cpu->regs[rs1(inst)] >= cpu->regs[rs2(inst)])
-        cpu->pc = (int64_t) cpu->pc + (int64_t) imm - 4;
-    print_op("bge\n");
+        cpu->pc = cpu->inst_pc + (int64_t) imm;
 }
 
 uint64_t csr(uint32_t inst)
@@ -419,7 +454,6 @@ void exec_LUI(CPU *cpu, uint32_t inst)
 {
     // LUI places upper 20 bits of U-immediate value to rd
     cpu->regs[rd(inst)] = (uint64_t) (int64_t) (int32_t) (inst & 0xfffff000);
-    print_op("lui\n");
 }
 
 void exec_AUIPC(CPU *cpu, uint32_t inst)
@@ -427,85 +461,147 @@ void exec_AUIPC(CPU *cpu, uint32_t inst)
     // AUIPC forms a 32-bit offset from the 20 upper bits
     // of the U-immediate
     uint64_t imm = imm_U(inst);
-    cpu->regs[rd(inst)] = ((int64_t) cpu->pc + (int64_t) imm) - 4;
-    print_op("auipc\n");
+    cpu->regs[rd(inst)] = cpu->inst_pc + (int64_t) imm;
 }
 
 void exec_JAL(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_J(inst);
+    uint64_t target = cpu->inst_pc + (int64_t) imm;
+    if (ADDR_MISALIGNED(target))
+        cpu_exception(cpu, EXC_INST_MISALIGNED, target);
     cpu->regs[rd(inst)] = cpu->pc;
-    /*print_op("JAL-> rd:%ld, pc:%lx\n", rd(inst), cpu->pc);*/
-    cpu->pc = cpu->pc + (int64_t) imm - 4;
-    print_op("jal\n");
-    if (ADDR_MISALIGNED(cpu->pc)) {
-        fprintf(stderr, "JAL pc address misalligned");
-        exit(0);
-    }
+    cpu->pc = target;
 }
 
 void exec_JALR(CPU *cpu, uint32_t inst)
 {
     uint64_t imm = imm_I(inst);
-    uint64_t tmp = cpu->pc;
-    cpu->pc = (cpu->regs[rs1(inst)] + (int64_t) imm) & 0xfffffffe;
-    cpu->regs[rd(inst)] = tmp;
-    /*print_op("NEXT -> %#lx, imm:%#lx\n", cpu->pc, imm);*/
-    print_op("jalr\n");
-    if (ADDR_MISALIGNED(cpu->pc)) {
-        fprintf(stderr, "JAL pc address misalligned");
-        exit(0);
-    }
+    uint64_t target = (cpu->regs[rs1(inst)] + (int64_t) imm) & ~1ULL;
+    if (ADDR_MISALIGNED(target))
+        cpu_exception(cpu, EXC_INST_MISALIGNED, target);
+    cpu->regs[rd(inst)] = cpu->pc;
+    cpu->pc = target;
 }
 
-void exec_ECALL(CPU *cpu, uint32_t inst) {}
-void exec_EBREAK(CPU *cpu, uint32_t inst) {}
+void exec_ILLEGAL(CPU *cpu, uint32_t inst)
+{
+    cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+}
 
-void exec_ECALLBREAK(CPU *cpu, uint32_t inst)
+void exec_ECALL(CPU *cpu, uint32_t inst)
 {
-    if (imm_I(inst) == 0x0)
-        exec_ECALL(cpu, inst);
-    if (imm_I(inst) == 0x1)
-        exec_EBREAK(cpu, inst);
-    print_op("ecallbreak\n");
+    static const uint64_t cause[] = {
+        [PRIV_U] = EXC_ECALL_U,
+        [PRIV_S] = EXC_ECALL_S,
+        [PRIV_M] = EXC_ECALL_M,
+    };
+    cpu_exception(cpu, cause[cpu->priv], 0);
+}
+
+void exec_EBREAK(CPU *cpu, uint32_t inst)
+{
+    if (cpu->semihost && semihost_call(cpu))
+        return;
+    cpu_exception(cpu, EXC_BREAKPOINT, cpu->inst_pc);
+}
+
+// Trap returns
+void exec_MRET(CPU *cpu, uint32_t inst)
+{
+    if (cpu->priv < PRIV_M)
+        exec_ILLEGAL(cpu, inst);
+    cpu_mret(cpu);
+}
+
+void exec_SRET(CPU *cpu, uint32_t inst)
+{
+    if (cpu->priv < PRIV_S ||
+        (cpu->priv == PRIV_S && (cpu->csr.mstatus & MSTATUS_TSR)))
+        exec_ILLEGAL(cpu, inst);
+    cpu_sret(cpu);
+}
+
+// Wait For Interrupt: the hart idles until an enabled interrupt is pending
+void exec_WFI(CPU *cpu, uint32_t inst)
+{
+    if (cpu->priv == PRIV_U ||
+        (cpu->priv == PRIV_S && (cpu->csr.mstatus & MSTATUS_TW)))
+        exec_ILLEGAL(cpu, inst);
+    cpu_wfi(cpu);
+}
+
+// Supervisor memory-management fence: rs1 selects a page, rs2 an ASID
+void exec_SFENCE_VMA(CPU *cpu, uint32_t inst)
+{
+    if (cpu->priv == PRIV_U ||
+        (cpu->priv == PRIV_S && (cpu->csr.mstatus & MSTATUS_TVM)))
+        exec_ILLEGAL(cpu, inst);
+    mmu_flush(cpu, rs1(inst) != 0, cpu->regs[rs1(inst)], rs2(inst) != 0,
+              cpu->regs[rs2(inst)]);
+    block_flush(cpu);  // blocks are tagged with virtual addresses
+}
+
+// CSR instructions; csr_table decides which accesses are legal
+void csr_check(CPU *cpu, uint32_t inst, int write)
+{
+    if (!csr_accessible(cpu, csr(inst), write))
+        exec_ILLEGAL(cpu, inst);
 }
 
-// CSR instructions
 void exec_CSRRW(CPU *cpu, uint32_t inst)
 {
-    cpu->regs[rd(inst)] = csr_read(cpu, csr(inst));
-    csr_write(cpu, csr(inst), cpu->regs[rs1(inst)]);
-    print_op("csrrw\n");
+    uint64_t value = cpu->regs[rs1(inst)];  // read before rd is written
+    csr_check(cpu, inst, 1);
+    if (rd(inst) != 0)
+        cpu->regs[rd(inst)] = csr_read(cpu, csr(inst));
+    csr_write(cpu, csr(inst), value);
 }
 
 void exec_CSRRS(CPU *cpu, uint32_t inst)
 {
-    csr_write(cpu, csr(inst), cpu->csr[csr(inst)] | cpu->regs[rs1(inst)]);
-    print_op("csrrs\n");
+    uint64_t mask = cpu->regs[rs1(inst)];
+    csr_check(cpu, inst, rs1(inst) != 0);
+    uint64_t old = csr_read(cpu, csr(inst));
+    if (rs1(inst) != 0)
+        csr_write(cpu, csr(inst), old | mask);
+    cpu->regs[rd(inst)] = old;
 }
 
 void exec_CSRRC(CPU *cpu, uint32_t inst)
 {
-    csr_write(cpu, csr(inst), cpu->csr[csr(inst)] & !(cpu->regs[rs1(inst)]));
-    print_op("csrrc\n");
+    uint64_t mask = cpu->regs[rs1(inst)];
+    csr_check(cpu, inst, rs1(inst) != 0);
+    uint64_t old = csr_read(cpu, csr(inst));
+    if (rs1(inst) != 0)
+        csr_write(cpu, csr(inst), old & ~mask);
+    cpu->regs[rd(inst)] = old;
 }
 
 void exec_CSRRWI(CPU *cpu, uint32_t inst)
 {
+    csr_check(cpu, inst, 1);
+    if (rd(inst) != 0)
+        cpu->regs[rd(inst)] = csr_read(cpu, csr(inst));
     csr_write(cpu, csr(inst), rs1(inst));
-    print_op("csrrwi\n");
 }
 
 void exec_CSRRSI(CPU *cpu, uint32_t inst)
 {
-    csr_write(cpu, csr(inst), cpu->csr[csr(inst)] | rs1(inst));
-    print_op("csrrsi\n");
+    csr_check(cpu, inst, rs1(inst) != 0);
+    uint64_t old = csr_read(cpu, csr(inst));
+    if (rs1(inst) != 0)
+        csr_write(cpu, csr(inst), old | rs1(inst));
+    cpu->regs[rd(inst)] = old;
 }
 
 void exec_CSRRCI(CPU *cpu, uint32_t inst)
 {
-    csr_write(cpu, csr(inst), cpu->csr[csr(inst)] & !rs1(inst));
-    print_op("csrrci\n");
+    csr_check(cpu, inst, rs1(inst) != 0);
+    uint64_t old = csr_read(cpu, csr(inst));
+    if (rs1(inst) != 0)
+        csr_write(cpu, csr(inst), old & ~rs1(inst));
+    cpu->regs[rd(inst)] = old;
 }
 
 // AMO_W
@@ -519,7 +615,6 @@ void exec_AMOADD_W(CPU *cpu, uint32_t inst)
     uint32_t res = tmp + (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoadd.w\n");
 }
 
 void exec_AMOXOR_W(CPU *cpu, uint32_t inst)
@@ -528,7 +623,6 @@ void exec_AMOXOR_W(CPU *cpu, uint32_t inst)
     uint32_t res = tmp ^ (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoxor.w\n");
 }
 
 void exec_AMOAND_W(CPU *cpu, uint32_t inst)
@@ -537,7 +631,6 @@ void exec_AMOAND_W(CPU *cpu, uint32_t inst)
     uint32_t res = tmp & (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoand.w\n");
 }
 
 void exec_AMOOR_W(CPU *cpu, uint32_t inst)
@@ -546,7 +639,6 @@ void exec_AMOOR_W(CPU *cpu, uint32_t inst)
     uint32_t res = tmp | (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoor.w\n");
 }
 
 void exec_AMOMIN_W(CPU *cpu, uint32_t inst) {}
@@ -565,7 +657,6 @@ void exec_AMOADD_D(CPU *cpu, uint32_t inst)
     uint32_t res = tmp + (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoadd.w\n");
 }
 
 void exec_AMOXOR_D(CPU *cpu, uint32_t inst)
@@ -574,7 +665,6 @@ void exec_AMOXOR_D(CPU *cpu, uint32_t inst)
     uint32_t res = tmp ^ (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoxor.w\n");
 }
 
 void exec_AMOAND_D(CPU *cpu, uint32_t inst)
@@ -583,7 +673,6 @@ void exec_AMOAND_D(CPU *cpu, uint32_t inst)
     uint32_t res = tmp & (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoand.w\n");
 }
 
 void exec_AMOOR_D(CPU *cpu, uint32_t inst)
@@ -592,7 +681,6 @@ void exec_AMOOR_D(CPU *cpu, uint32_t inst)
     uint32_t res = tmp | (uint32_t) cpu->regs[rs2(inst)];
     cpu->regs[rd(inst)] = tmp;
     cpu_store(cpu, cpu->regs[rs1(inst)], 32, res);
-    print_op("amoor.w\n");
 }
 
 void exec_AMOMIN_D(CPU *cpu, uint32_t inst) {}
@@ -602,5 +690,755 @@ void exec_AMOMAXU_D(CPU *cpu, uint32_t inst) {}
 
 void exec_FENCE(CPU *cpu, uint32_t inst)
 {
-    print_op("fence\n");
-}
\ No newline at end of file
+}
+
+// Stores become visible to instruction fetch only after a FENCE.I, so this
+// is where previously translated blocks are dropped
+void exec_FENCE_I(CPU *cpu, uint32_t inst)
+{
+    // stores from this hart have already dropped their blocks
+    block_fence_i(cpu);
+}
+//=====================================================================================
+//   F / D Extension
+//=====================================================================================
+
+// FP instructions are illegal while mstatus.FS is Off; any of them may
+// change FP state, so the state is marked Dirty up front
+void fp_check(CPU *cpu, uint32_t inst)
+{
+    if (!(cpu->csr.mstatus & MSTATUS_FS))
+        exec_ILLEGAL(cpu, inst);
+    cpu->csr.mstatus |= MSTATUS_FS;
+}
+
+// program the host rounding mode from the rm field, for an op that rounds
+// exactly or by itself in every mode
+int fp_round_any(CPU *cpu, uint32_t inst)
+{
+    int rm = fpu_set_rm(cpu, (inst >> 12) & 0x7);
+    if (rm < 0)
+        exec_ILLEGAL(cpu, inst);
+    return rm;
+}
+
+// the same for an op the host rounds, which it cannot do to RMM
+int fp_round(CPU *cpu, uint32_t inst)
+{
+    int rm = fp_round_any(cpu, inst);
+    if (rm == RM_RMM)
+        exec_ILLEGAL(cpu, inst);
+    return rm;
+}
+
+float freg_s(CPU *cpu, uint64_t r)
+{
+    return f32_from(fpu_unbox(cpu->fregs[r]));
+}
+
+double freg_d(CPU *cpu, uint64_t r)
+{
+    return f64_from(cpu->fregs[r]);
+}
+
+void exec_FLW(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm_I(inst);
+    cpu->fregs[rd(inst)] = F32_BOX | cpu_load(cpu, addr, 32);
+}
+
+void exec_FLD(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm_I(inst);
+    cpu->fregs[rd(inst)] = cpu_load(cpu, addr, 64);
+}
+
+void exec_FSW(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm_S(inst);
+    cpu_store(cpu, addr, 32, cpu->fregs[rs2(inst)]);
+}
+
+void exec_FSD(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t addr = cpu->regs[rs1(inst)] + (int64_t) imm_S(inst);
+    cpu_store(cpu, addr, 64, cpu->fregs[rs2(inst)]);
+}
+
+// Fused multiply-add: the negations only flip signs, so they are exact
+void exec_FMADD_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(fmaf(freg_s(cpu, rs1(inst)), freg_s(cpu, rs2(inst)),
+                       freg_s(cpu, rs3(inst))));
+}
+
+void exec_FMSUB_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(fmaf(freg_s(cpu, rs1(inst)), freg_s(cpu, rs2(inst)),
+                       -freg_s(cpu, rs3(inst))));
+}
+
+void exec_FNMSUB_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(fmaf(-freg_s(cpu, rs1(inst)), freg_s(cpu, rs2(inst)),
+                       freg_s(cpu, rs3(inst))));
+}
+
+void exec_FNMADD_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(fmaf(-freg_s(cpu, rs1(inst)), freg_s(cpu, rs2(inst)),
+                       -freg_s(cpu, rs3(inst))));
+}
+
+void exec_FMADD_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(fma(freg_d(cpu, rs1(inst)), freg_d(cpu, rs2(inst)),
+                      freg_d(cpu, rs3(inst))));
+}
+
+void exec_FMSUB_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(fma(freg_d(cpu, rs1(inst)), freg_d(cpu, rs2(inst)),
+                      -freg_d(cpu, rs3(inst))));
+}
+
+void exec_FNMSUB_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(fma(-freg_d(cpu, rs1(inst)), freg_d(cpu, rs2(inst)),
+                      freg_d(cpu, rs3(inst))));
+}
+
+void exec_FNMADD_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(fma(-freg_d(cpu, rs1(inst)), freg_d(cpu, rs2(inst)),
+                      -freg_d(cpu, rs3(inst))));
+}
+
+void exec_FADD_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(freg_s(cpu, rs1(inst)) + freg_s(cpu, rs2(inst)));
+}
+
+void exec_FSUB_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(freg_s(cpu, rs1(inst)) - freg_s(cpu, rs2(inst)));
+}
+
+void exec_FMUL_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(freg_s(cpu, rs1(inst)) * freg_s(cpu, rs2(inst)));
+}
+
+void exec_FDIV_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_s(freg_s(cpu, rs1(inst)) / freg_s(cpu, rs2(inst)));
+}
+
+void exec_FSQRT_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] = fpu_box_s(sqrtf(freg_s(cpu, rs1(inst))));
+}
+
+void exec_FADD_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(freg_d(cpu, rs1(inst)) + freg_d(cpu, rs2(inst)));
+}
+
+void exec_FSUB_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(freg_d(cpu, rs1(inst)) - freg_d(cpu, rs2(inst)));
+}
+
+void exec_FMUL_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(freg_d(cpu, rs1(inst)) * freg_d(cpu, rs2(inst)));
+}
+
+void exec_FDIV_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        fpu_box_d(freg_d(cpu, rs1(inst)) / freg_d(cpu, rs2(inst)));
+}
+
+void exec_FSQRT_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] = fpu_box_d(sqrt(freg_d(cpu, rs1(inst))));
+}
+
+// Sign injection works on raw bits and never canonicalizes
+void exec_FSGNJ_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint32_t a = fpu_unbox(cpu->fregs[rs1(inst)]);
+    uint32_t b = fpu_unbox(cpu->fregs[rs2(inst)]);
+    uint32_t sign = 1U << 31;
+    switch ((inst >> 12) & 0x7) {
+    case 0:  // fsgnj
+        a = (a & ~sign) | (b & sign);
+        break;
+    case 1:  // fsgnjn
+        a = (a & ~sign) | (~b & sign);
+        break;
+    case 2:  // fsgnjx
+        a ^= b & sign;
+        break;
+    default:
+        exec_ILLEGAL(cpu, inst);
+    }
+    cpu->fregs[rd(inst)] = F32_BOX | a;
+}
+
+void exec_FSGNJ_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t a = cpu->fregs[rs1(inst)];
+    uint64_t b = cpu->fregs[rs2(inst)];
+    uint64_t sign = 1ULL << 63;
+    switch ((inst >> 12) & 0x7) {
+    case 0:
+        a = (a & ~sign) | (b & sign);
+        break;
+    case 1:
+        a = (a & ~sign) | (~b & sign);
+        break;
+    case 2:
+        a ^= b & sign;
+        break;
+    default:
+        exec_ILLEGAL(cpu, inst);
+    }
+    cpu->fregs[rd(inst)] = a;
+}
+
+void exec_FMINMAX_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    int funct3 = (inst >> 12) & 0x7;
+    if (funct3 > 1)
+        exec_ILLEGAL(cpu, inst);
+    cpu->fregs[rd(inst)] =
+        F32_BOX | fpu_minmax_s(cpu, fpu_unbox(cpu->fregs[rs1(inst)]),
+                               fpu_unbox(cpu->fregs[rs2(inst)]), funct3);
+}
+
+void exec_FMINMAX_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    int funct3 = (inst >> 12) & 0x7;
+    if (funct3 > 1)
+        exec_ILLEGAL(cpu, inst);
+    cpu->fregs[rd(inst)] = fpu_minmax_d(cpu, cpu->fregs[rs1(inst)],
+                                        cpu->fregs[rs2(inst)], funct3);
+}
+
+void exec_FCVT_S_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round(cpu, inst);
+    cpu->fregs[rd(inst)] = fpu_box_s((float) freg_d(cpu, rs1(inst)));
+}
+
+void exec_FCVT_D_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    fp_round_any(cpu, inst);
+    cpu->fregs[rd(inst)] = fpu_box_d((double) freg_s(cpu, rs1(inst)));
+}
+
+// feq, flt, fle
+void exec_FCMP_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint32_t a = fpu_unbox(cpu->fregs[rs1(inst)]);
+    uint32_t b = fpu_unbox(cpu->fregs[rs2(inst)]);
+    int funct3 = (inst >> 12) & 0x7;
+    if (funct3 > 2)
+        exec_ILLEGAL(cpu, inst);
+    cpu->regs[rd(inst)] =
+        fpu_compare(cpu, f32_isnan(a) ? 0 : f32_from(a),
+                    f32_isnan(b) ? 0 : f32_from(b), f32_isnan(a), f32_isnan(b),
+                    f32_issnan(a), f32_issnan(b), funct3);
+}
+
+void exec_FCMP_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t a = cpu->fregs[rs1(inst)];
+    uint64_t b = cpu->fregs[rs2(inst)];
+    int funct3 = (inst >> 12) & 0x7;
+    if (funct3 > 2)
+        exec_ILLEGAL(cpu, inst);
+    cpu->regs[rd(inst)] =
+        fpu_compare(cpu, f64_isnan(a) ? 0 : f64_from(a),
+                    f64_isnan(b) ? 0 : f64_from(b), f64_isnan(a), f64_isnan(b),
+                    f64_issnan(a), f64_issnan(b), funct3);
+}
+
+// fcvt.{w,wu,l,lu}.fmt, selected by rs2; every source widens exactly to
+// double, so both formats share the saturating conversion
+uint64_t fp_to_integer(CPU *cpu, uint32_t inst, double x, int nan)
+{
+    int rm = fp_round_any(cpu, inst);
+    switch (rs2(inst)) {
+    case 0:  // w
+        return (int32_t) fpu_to_int(cpu, x, nan, rm, -0x1p31, 0x1p31);
+    case 1:  // wu, sign-extended like every 32-bit result
+        return (int32_t) fpu_to_uint(cpu, x, nan, rm, 0x1p32);
+    case 2:  // l
+        return fpu_to_int(cpu, x, nan, rm, -0x1p63, 0x1p63);
+    case 3:  // lu
+        return fpu_to_uint(cpu, x, nan, rm, 0x1p64);
+    default:
+        exec_ILLEGAL(cpu, inst);
+        return 0;
+    }
+}
+
+void exec_FCVT_INT_S(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint32_t a = fpu_unbox(cpu->fregs[rs1(inst)]);
+    int nan = f32_isnan(a);
+    cpu->regs[rd(inst)] = fp_to_integer(cpu, inst, nan ? 0 : f32_from(a), nan);
+}
+
+void exec_FCVT_INT_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t a = cpu->fregs[rs1(inst)];
+    int nan = f64_isnan(a);
+    cpu->regs[rd(inst)] = fp_to_integer(cpu, inst, nan ? 0 : f64_from(a), nan);
+}
+
+// fcvt.fmt.{w,wu,l,lu}: the host conversion rounds in the current mode
+void exec_FCVT_S_INT(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t x = cpu->regs[rs1(inst)];
+    float f = 0;
+    fp_round(cpu, inst);
+    switch (rs2(inst)) {
+    case 0:
+        f = (float) (int32_t) x;
+        break;
+    case 1:
+        f = (float) (uint32_t) x;
+        break;
+    case 2:
+        f = (float) (int64_t) x;
+        break;
+    case 3:
+        f = (float) x;
+        break;
+    default:
+        exec_ILLEGAL(cpu, inst);
+    }
+    cpu->fregs[rd(inst)] = fpu_box_s(f);
+}
+
+void exec_FCVT_D_INT(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    uint64_t x = cpu->regs[rs1(inst)];
+    double d = 0;
+    fp_round(cpu, inst);
+    switch (rs2(inst)) {
+    case 0:
+        d = (double) (int32_t) x;
+        break;
+    case 1:
+        d = (double) (uint32_t) x;
+        break;
+    case 2:
+        d = (double) (int64_t) x;
+        break;
+    case 3:
+        d = (double) x;
+        break;
+    default:
+        exec_ILLEGAL(cpu, inst);
+    }
+    cpu->fregs[rd(inst)] = fpu_box_d(d);
+}
+
+// fmv.x.w (funct3 0) and fclass.s (funct3 1)
+void exec_FMV_X_W(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    switch ((inst >> 12) & 0x7) {
+    case 0:
+        cpu->regs[rd(inst)] = (int64_t) (int32_t) cpu->fregs[rs1(inst)];
+        break;
+    case 1:
+        cpu->regs[rd(inst)] = fpu_class_s(fpu_unbox(cpu->fregs[rs1(inst)]));
+        break;
+    default:
+        exec_ILLEGAL(cpu, inst);
+    }
+}
+
+void exec_FMV_X_D(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    switch ((inst >> 12) & 0x7) {
+    case 0:
+        cpu->regs[rd(inst)] = cpu->fregs[rs1(inst)];
+        break;
+    case 1:
+        cpu->regs[rd(inst)] = fpu_class_d(cpu->fregs[rs1(inst)]);
+        break;
+    default:
+        exec_ILLEGAL(cpu, inst);
+    }
+}
+
+void exec_FMV_W_X(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    cpu->fregs[rd(inst)] = F32_BOX | (uint32_t) cpu->regs[rs1(inst)];
+}
+
+void exec_FMV_D_X(CPU *cpu, uint32_t inst)
+{
+    fp_check(cpu, inst);
+    cpu->fregs[rd(inst)] = cpu->regs[rs1(inst)];
+}
+
+//=====================================================================================
+//   V Extension
+//=====================================================================================
+
+// like fp_check, for mstatus.VS
+void v_check(CPU *cpu, uint32_t inst)
+{
+    if (!(cpu->csr.mstatus & MSTATUS_VS))
+        exec_ILLEGAL(cpu, inst);
+    cpu->csr.mstatus |= MSTATUS_VS;
+}
+
+void exec_VSETVL(CPU *cpu, uint32_t inst)
+{
+    v_check(cpu, inst);
+    vector_setvl(cpu, inst);
+}
+
+void exec_VLOAD(CPU *cpu, uint32_t inst)
+{
+    v_check(cpu, inst);
+    vector_load_store(cpu, inst, 0);
+}
+
+void exec_VSTORE(CPU *cpu, uint32_t inst)
+{
+    v_check(cpu, inst);
+    vector_load_store(cpu, inst, 1);
+}
+
+void exec_VOP(CPU *cpu, uint32_t inst)
+{
+    v_check(cpu, inst);
+    vector_op(cpu, inst);
+}
+
+//=====================================================================================
+//   Zba / Zbb / Zbs Extensions
+//=====================================================================================
+// Each maps onto one GCC builtin or idiom that compiles to the host's
+// lzcnt/tzcnt/popcnt/bswap/rol/ror (bsr/bsf without -mlzcnt/-mbmi).
+
+// Address generation
+void exec_SH1ADD(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] << 1) + cpu->regs[rs2(inst)];
+}
+
+void exec_SH2ADD(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] << 2) + cpu->regs[rs2(inst)];
+}
+
+void exec_SH3ADD(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] << 3) + cpu->regs[rs2(inst)];
+}
+
+void exec_SH1ADD_UW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        ((uint64_t) (uint32_t) cpu->regs[rs1(inst)] << 1) + cpu->regs[rs2(inst)];
+}
+
+void exec_SH2ADD_UW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        ((uint64_t) (uint32_t) cpu->regs[rs1(inst)] << 2) + cpu->regs[rs2(inst)];
+}
+
+void exec_SH3ADD_UW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        ((uint64_t) (uint32_t) cpu->regs[rs1(inst)] << 3) + cpu->regs[rs2(inst)];
+}
+
+void exec_ADD_UW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        (uint64_t) (uint32_t) cpu->regs[rs1(inst)] + cpu->regs[rs2(inst)];
+}
+
+void exec_SLLI_UW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (uint64_t) (uint32_t) cpu->regs[rs1(inst)]
+                          << shamt(inst);
+}
+
+// Logical with negate
+void exec_ANDN(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] & ~cpu->regs[rs2(inst)];
+}
+
+void exec_ORN(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] | ~cpu->regs[rs2(inst)];
+}
+
+void exec_XNOR(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = ~(cpu->regs[rs1(inst)] ^ cpu->regs[rs2(inst)]);
+}
+
+// Count leading/trailing zeros and population count
+void exec_CLZ(CPU *cpu, uint32_t inst)
+{
+    uint64_t x = cpu->regs[rs1(inst)];
+    cpu->regs[rd(inst)] = x ? __builtin_clzll(x) : 64;
+}
+
+void exec_CTZ(CPU *cpu, uint32_t inst)
+{
+    uint64_t x = cpu->regs[rs1(inst)];
+    cpu->regs[rd(inst)] = x ? __builtin_ctzll(x) : 64;
+}
+
+void exec_CPOP(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = __builtin_popcountll(cpu->regs[rs1(inst)]);
+}
+
+void exec_CLZW(CPU *cpu, uint32_t inst)
+{
+    uint32_t x = cpu->regs[rs1(inst)];
+    cpu->regs[rd(inst)] = x ? __builtin_clz(x) : 32;
+}
+
+void exec_CTZW(CPU *cpu, uint32_t inst)
+{
+    uint32_t x = cpu->regs[rs1(inst)];
+    cpu->regs[rd(inst)] = x ? __builtin_ctz(x) : 32;
+}
+
+void exec_CPOPW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = __builtin_popcount((uint32_t) cpu->regs[rs1(inst)]);
+}
+
+// Integer minimum/maximum
+void exec_MIN(CPU *cpu, uint32_t inst)
+{
+    int64_t a = cpu->regs[rs1(inst)], b = cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = a < b ? a : b;
+}
+
+void exec_MINU(CPU *cpu, uint32_t inst)
+{
+    uint64_t a = cpu->regs[rs1(inst)], b = cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = a < b ? a : b;
+}
+
+void exec_MAX(CPU *cpu, uint32_t inst)
+{
+    int64_t a = cpu->regs[rs1(inst)], b = cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = a > b ? a : b;
+}
+
+void exec_MAXU(CPU *cpu, uint32_t inst)
+{
+    uint64_t a = cpu->regs[rs1(inst)], b = cpu->regs[rs2(inst)];
+    cpu->regs[rd(inst)] = a > b ? a : b;
+}
+
+// Sign and zero extension
+void exec_SEXT_B(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (int64_t) (int8_t) cpu->regs[rs1(inst)];
+}
+
+void exec_SEXT_H(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (int64_t) (int16_t) cpu->regs[rs1(inst)];
+}
+
+void exec_ZEXT_H(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (uint16_t) cpu->regs[rs1(inst)];
+}
+
+// Bitwise rotation
+uint64_t rotl64(uint64_t x, unsigned s)
+{
+    return (x << (s & 63)) | (x >> (-s & 63));
+}
+
+uint32_t rotl32(uint32_t x, unsigned s)
+{
+    return (x << (s & 31)) | (x >> (-s & 31));
+}
+
+void exec_ROL(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = rotl64(cpu->regs[rs1(inst)], cpu->regs[rs2(inst)]);
+}
+
+void exec_ROR(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = rotl64(cpu->regs[rs1(inst)], -cpu->regs[rs2(inst)]);
+}
+
+void exec_RORI(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = rotl64(cpu->regs[rs1(inst)], -shamt(inst));
+}
+
+void exec_ROLW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        (int64_t) (int32_t) rotl32(cpu->regs[rs1(inst)], cpu->regs[rs2(inst)]);
+}
+
+void exec_RORW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        (int64_t) (int32_t) rotl32(cpu->regs[rs1(inst)], -cpu->regs[rs2(inst)]);
+}
+
+void exec_RORIW(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        (int64_t) (int32_t) rotl32(cpu->regs[rs1(inst)], -shamt(inst));
+}
+
+// OR-combine and byte-reverse
+void exec_ORC_B(CPU *cpu, uint32_t inst)
+{
+    uint64_t x = cpu->regs[rs1(inst)];
+    uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    // the top bit of each byte is set iff the byte is non-zero
+    uint64_t t = (((x & low7) + low7) | x) & ~low7;
+    cpu->regs[rd(inst)] = (t >> 7) * 0xff;
+}
+
+void exec_REV8(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = __builtin_bswap64(cpu->regs[rs1(inst)]);
+}
+
+// Single-bit operations
+void exec_BCLR(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        cpu->regs[rs1(inst)] & ~(1ULL << (cpu->regs[rs2(inst)] & 63));
+}
+
+void exec_BCLRI(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] & ~(1ULL << shamt(inst));
+}
+
+void exec_BEXT(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        (cpu->regs[rs1(inst)] >> (cpu->regs[rs2(inst)] & 63)) & 1;
+}
+
+void exec_BEXTI(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = (cpu->regs[rs1(inst)] >> shamt(inst)) & 1;
+}
+
+void exec_BINV(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        cpu->regs[rs1(inst)] ^ (1ULL << (cpu->regs[rs2(inst)] & 63));
+}
+
+void exec_BINVI(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] ^ (1ULL << shamt(inst));
+}
+
+void exec_BSET(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] =
+        cpu->regs[rs1(inst)] | (1ULL << (cpu->regs[rs2(inst)] & 63));
+}
+
+void exec_BSETI(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[rd(inst)] = cpu->regs[rs1(inst)] | (1ULL << shamt(inst));
+}
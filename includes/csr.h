@@ -2,7 +2,6 @@
 #define CSR_H
 
 #include <stdint.h>
-#include "cpu.h"
 
 //      Name        Number   Priv       Description
 //------------------------------------------------------------------------------------
@@ -25,6 +24,15 @@
 #define FCSR \
     0x003  // URW Floating-Point Control and Status Register (frm + fflags)
 
+// User Vector CSRs
+#define VSTART 0x008  // URW Vector start position.
+#define VXSAT 0x009   // URW Fixed-point saturate flag.
+#define VXRM 0x00A    // URW Fixed-point rounding mode.
+#define VCSR 0x00F    // URW Vector control and status register.
+#define VL 0xC20      // URO Vector length.
+#define VTYPE 0xC21   // URO Vector data type register.
+#define VLENB_CSR 0xC22  // URO VLEN/8 (vector register length in bytes).
+
 // User Counter/Timers
 #define CYCLE 0xC00  // URO Cycle counter for RDCYCLE instruction.
 #define TIME 0xC01   // URO Timer for RDTIME instruction.
@@ -129,9 +137,95 @@
 #define DSCRATCH1 0x7B3  // DRW Debug scratch register 1.
 
 
+// mstatus bits
+#define MSTATUS_SIE (1ULL << 1)
+#define MSTATUS_MIE (1ULL << 3)
+#define MSTATUS_SPIE (1ULL << 5)
+#define MSTATUS_MPIE (1ULL << 7)
+#define MSTATUS_SPP (1ULL << 8)
+#define MSTATUS_MPP (3ULL << 11)
+#define MSTATUS_VS (3ULL << 9)
+#define MSTATUS_FS (3ULL << 13)
+#define MSTATUS_MPRV (1ULL << 17)
+#define MSTATUS_SUM (1ULL << 18)
+#define MSTATUS_MXR (1ULL << 19)
+#define MSTATUS_TVM (1ULL << 20)
+#define MSTATUS_TW (1ULL << 21)
+#define MSTATUS_TSR (1ULL << 22)
+#define MSTATUS_UXL (3ULL << 32)
+#define MSTATUS_SXL (3ULL << 34)
+#define MSTATUS_SD (1ULL << 63)
+#define MSTATUS_MPP_SHIFT 11
+
+// misa
+#define MISA_XLEN_64 (2ULL << 62)
+#define MISA_EXT(c) (1ULL << ((c) - 'A'))
+
+// mip/mie bits
+#define MIP_SSIP (1ULL << 1)  // Supervisor software interrupt
+#define MIP_MSIP (1ULL << 3)  // Machine software interrupt
+#define MIP_STIP (1ULL << 5)  // Supervisor timer interrupt
+#define MIP_MTIP (1ULL << 7)  // Machine timer interrupt
+#define MIP_SEIP (1ULL << 9)  // Supervisor external interrupt
+#define MIP_MEIP (1ULL << 11)  // Machine external interrupt
+
+
+// The implemented CSRs that are plain storage. The rest are views of these
+// (sstatus, sie, sip), live elsewhere (the vector and counter CSRs) or read
+// as zero (the HPM counters). csr_table maps each CSR number to its slot.
+typedef struct CSR_FILE {
+    uint64_t mstatus;
+    uint64_t misa;
+    uint64_t medeleg;
+    uint64_t mideleg;
+    uint64_t mie;
+    uint64_t mip;  // software-visible bits; devices set theirs atomically
+    uint64_t mtvec;
+    uint64_t mcounteren;
+    uint64_t mscratch;
+    uint64_t mepc;
+    uint64_t mcause;
+    uint64_t mtval;
+    uint64_t stvec;
+    uint64_t scounteren;
+    uint64_t sscratch;
+    uint64_t sepc;
+    uint64_t scause;
+    uint64_t stval;
+    uint64_t satp;
+    uint64_t fflags;
+    uint64_t frm;
+    uint64_t pmpcfg[2];  // pmpcfg0 and pmpcfg2; RV64 has no odd ones
+    uint64_t pmpaddr[16];
+} CSR_FILE;
+
+// csr_table flags
+#define CSR_VALID (1 << 0)     // implemented
+#define CSR_READONLY (1 << 1)  // csr[11:10] == 3
+#define CSR_FP (1 << 2)        // needs mstatus.FS
+#define CSR_VEC (1 << 3)       // needs mstatus.VS
+#define CSR_TVM (1 << 4)       // M-only from S while mstatus.TVM is set
+#define CSR_ZERO (1 << 5)      // reads as zero, ignores writes
+
+#define CSR_NO_SLOT 0xff  // computed in csr_read/csr_write
+
+typedef struct CSR_INFO {
+    uint8_t slot;   // index into CSR_FILE as an array of uint64_t
+    uint8_t flags;
+    uint8_t priv;   // lowest privilege allowed, csr[9:8]
+} CSR_INFO;
+
+extern const CSR_INFO csr_table[4096];
+
+struct cpu;
+
 // functions
 
-uint64_t csr_read(CPU *cpu, uint64_t csr);
-void csr_write(CPU *cpu, uint64_t csr, uint64_t value);
+// whether the current privilege and mstatus allow the access; csr_read
+// and csr_write assume they do
+int csr_accessible(struct cpu *cpu, uint64_t csr, int write);
+
+uint64_t csr_read(struct cpu *cpu, uint64_t csr);
+void csr_write(struct cpu *cpu, uint64_t csr, uint64_t value);
 
 #endif
\ No newline at end of file
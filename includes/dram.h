@@ -6,11 +6,86 @@
 
 #define DRAM_SIZE 1024 * 1024 * 1  // 1 MiB DRAM
 #define DRAM_BASE 0x80000000
+#define DRAM_PAGE_SHIFT 12
+#define DRAM_PAGES ((DRAM_SIZE) >> DRAM_PAGE_SHIFT)
+#define DRAM_PAGE(addr) (((addr) - DRAM_BASE) >> DRAM_PAGE_SHIFT)
+
+// Guest RAM is the start of a host reservation covering DRAM_WINDOW bytes
+// of physical address space from DRAM_BASE, with DRAM_GUARD bytes more on
+// either side. Everything but the RAM is PROT_NONE, so dram_load and
+// dram_store index it with a mask instead of a bounds check, and an access
+// past the end of RAM faults on the host; the CPU turns that fault into a
+// guest access fault.
+#define DRAM_WINDOW (1ULL << 32)
+#define DRAM_GUARD (1 << 16)
 
 typedef struct DRAM {
-    uint8_t mem[DRAM_SIZE];  // Dram memory of DRAM_SIZE
+    uint8_t *mem;  // Dram memory of DRAM_SIZE, page aligned for mprotect
+
+    // Pages whose stores need more than the store itself: pages that
+    // translated blocks were made from (code_map) and pages under a debugger
+    // watchpoint (watch_map). Every store checks its page in write_map, the
+    // union of the two, and on a hit calls tracked_write; stores to other
+    // pages cost only the bit test.
+    uint64_t write_map[DRAM_PAGES / 64];
+    uint64_t code_map[DRAM_PAGES / 64];
+    uint64_t watch_map[DRAM_PAGES / 64];
+    // pages handed to devices for DMA since the last FENCE.I
+    uint64_t dma_map[DRAM_PAGES / 64];
+    // pages the hart stored to since the stats exporter last counted them
+    uint64_t dirty_map[DRAM_PAGES / 64];
+    void (*tracked_write)(void *opaque, uint64_t addr, uint64_t len);
+    void *opaque;
 } DRAM;
 
+// the host byte behind a physical address in the window; callers check
+// the window's end, which the mask would wrap around
+static inline uint8_t *dram_host(DRAM *dram, uint64_t addr)
+{
+    return dram->mem + ((addr - DRAM_BASE) & (DRAM_WINDOW - 1));
+}
+
+// whether a host address is in the reservation around guest RAM
+static inline int dram_reserved(DRAM *dram, const void *host)
+{
+    const uint8_t *p = host;
+    return p >= dram->mem - DRAM_GUARD &&
+           p < dram->mem + DRAM_WINDOW + DRAM_GUARD;
+}
+
+static inline int dram_page_bit(const uint64_t *map, uint64_t addr)
+{
+    uint64_t page = DRAM_PAGE(addr);
+    return (map[page / 64] >> (page % 64)) & 1;
+}
+
+static inline int dram_write_tracked(DRAM *dram, uint64_t addr)
+{
+    return dram_page_bit(dram->write_map, addr);
+}
+
+static inline int dram_is_code(DRAM *dram, uint64_t addr)
+{
+    return dram_page_bit(dram->code_map, addr);
+}
+
+static inline int dram_is_watched(DRAM *dram, uint64_t addr)
+{
+    return dram_page_bit(dram->watch_map, addr);
+}
+
+// set or clear a page in code_map or watch_map, keeping write_map in step
+static inline void dram_mark_page(DRAM *dram, uint64_t *map, uint64_t page,
+                                  int on)
+{
+    uint64_t i = page / 64, bit = 1ULL << (page % 64);
+
+    map[i] = on ? map[i] | bit : map[i] & ~bit;
+    dram->write_map[i] = dram->code_map[i] | dram->watch_map[i];
+}
+
+void dram_init(DRAM *dram);
+
 // load the dram data with the address and the data size, it will return the
 // storage value
 uint64_t dram_load(DRAM *dram, uint64_t addr, uint64_t size);
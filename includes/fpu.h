@@ -0,0 +1,140 @@
+#ifndef FPU_H
+#define FPU_H
+// FPU
+// F and D extensions executed on the host's scalar SSE/AVX unit.
+//
+// The host FPU is only reprogrammed when the effective rounding mode of an
+// instruction differs from the one currently loaded, which in practice is
+// once per frm change. Exception flags accumulate in the host status word
+// and are folded into fflags only when the guest reads or writes it.
+//
+// The host has no mode that rounds ties to max magnitude: an op the host
+// rounds raises an illegal instruction exception under RMM, while the
+// conversions to integers, which round by themselves, honour it.
+#include <stdint.h>
+#include <string.h>
+
+// fflags
+#define FFLAGS_NX (1 << 0)  // inexact
+#define FFLAGS_UF (1 << 1)  // underflow
+#define FFLAGS_OF (1 << 2)  // overflow
+#define FFLAGS_DZ (1 << 3)  // divide by zero
+#define FFLAGS_NV (1 << 4)  // invalid operation
+
+// rounding modes
+#define RM_RNE 0  // to nearest, ties to even
+#define RM_RTZ 1  // towards zero
+#define RM_RDN 2  // down
+#define RM_RUP 3  // up
+#define RM_RMM 4  // to nearest, ties to max magnitude
+#define RM_DYN 7  // use frm
+
+#define F32_CANONICAL_NAN 0x7fc00000U
+#define F64_CANONICAL_NAN 0x7ff8000000000000ULL
+#define F32_BOX 0xffffffff00000000ULL  // upper half of a NaN-boxed single
+
+struct cpu;
+
+void fpu_init(struct cpu *cpu);
+
+// load the host FPU with the rounding mode of inst's rm field; returns the
+// effective mode, or -1 if the instruction or frm holds a reserved mode
+int fpu_set_rm(struct cpu *cpu, int rm);
+
+// fold the flags raised by host operations into fflags
+void fpu_sync_flags(struct cpu *cpu);
+
+// replace fflags, discarding what the host has accumulated
+void fpu_write_flags(struct cpu *cpu, uint64_t flags);
+
+// raise flags that the host operation does not raise by itself
+void fpu_raise(struct cpu *cpu, int flags);
+
+// raw bit views
+static inline uint32_t f32_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float f32_from(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint64_t f64_bits(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static inline double f64_from(uint64_t u)
+{
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+// NaN tests on raw bits, which never raise host exceptions
+static inline int f32_isnan(uint32_t u)
+{
+    return (u & 0x7fffffff) > 0x7f800000;
+}
+
+static inline int f32_issnan(uint32_t u)
+{
+    return f32_isnan(u) && !(u & 0x00400000);
+}
+
+static inline int f64_isnan(uint64_t u)
+{
+    return (u & ~(1ULL << 63)) > 0x7ff0000000000000ULL;
+}
+
+static inline int f64_issnan(uint64_t u)
+{
+    return f64_isnan(u) && !(u & 0x0008000000000000ULL);
+}
+
+// a single-precision operand; anything not properly NaN-boxed reads as the
+// canonical NaN
+static inline uint32_t fpu_unbox(uint64_t reg)
+{
+    return (reg & F32_BOX) == F32_BOX ? (uint32_t) reg : F32_CANONICAL_NAN;
+}
+
+// box an arithmetic result, replacing any NaN by the canonical NaN
+static inline uint64_t fpu_box_s(float f)
+{
+    uint32_t u = f32_bits(f);
+    return F32_BOX | (f32_isnan(u) ? F32_CANONICAL_NAN : u);
+}
+
+static inline uint64_t fpu_box_d(double d)
+{
+    uint64_t u = f64_bits(d);
+    return f64_isnan(u) ? F64_CANONICAL_NAN : u;
+}
+
+uint64_t fpu_class_s(uint32_t u);
+uint64_t fpu_class_d(uint64_t u);
+
+// fmin/fmax: a NaN operand loses to a number, -0 orders before +0
+uint32_t fpu_minmax_s(struct cpu *cpu, uint32_t a, uint32_t b, int max);
+uint64_t fpu_minmax_d(struct cpu *cpu, uint64_t a, uint64_t b, int max);
+
+// feq (quiet) and flt/fle (signaling) on single or double operands
+int fpu_compare(struct cpu *cpu, double a, double b, int a_nan, int b_nan,
+                int a_snan, int b_snan, int funct3);
+
+// float to integer conversions: round with rm, then saturate out-of-range
+// values and NaN to the bounds of [lo, hi) with NV as the spec requires
+int64_t fpu_to_int(struct cpu *cpu, double x, int nan, int rm, double lo,
+                   double hi);
+uint64_t fpu_to_uint(struct cpu *cpu, double x, int nan, int rm, double hi);
+
+#endif
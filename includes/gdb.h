@@ -0,0 +1,76 @@
+#ifndef GDB_H
+#define GDB_H
+// GDB
+// A GDB remote serial protocol stub on a local TCP port or UNIX socket, so
+// that `target remote` can drive the guest: registers, memory (physical,
+// straight from DRAM), continue, single-step, software breakpoints and
+// write watchpoints.
+//
+// Nothing is checked per instruction while the guest runs. A breakpoint is
+// compiled into the translated code: the translator ends the block at the
+// breakpoint and gives that instruction an exec that stops into the stub,
+// and setting or clearing a breakpoint drops only the blocks that cover its
+// address. A watchpoint marks its page in the DRAM write map, the bit that
+// every store already tests for self-modifying code, so only stores to a
+// watched page get as far as comparing addresses; a hit ends the running
+// block after the storing instruction and stops at the next instruction.
+// A break from gdb (Ctrl-C) raises SIGIO and is taken at the next
+// interrupt poll.
+#include <signal.h>
+#include <stdint.h>
+
+#define GDB_MAX_BREAKPOINTS 64
+#define GDB_MAX_WATCHPOINTS 16
+#define GDB_PACKET_SIZE 4096
+
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+
+struct cpu;
+
+typedef struct GDB_WATCH {
+    uint64_t addr;  // physical
+    uint64_t len;
+} GDB_WATCH;
+
+typedef struct GDB {
+    int fd;  // the connection to gdb
+    uint64_t breakpoints[GDB_MAX_BREAKPOINTS];
+    int nbreakpoints;
+    GDB_WATCH watches[GDB_MAX_WATCHPOINTS];
+    int nwatches;
+
+    volatile sig_atomic_t io;  // SIGIO: gdb may have sent a break
+    int watch_hit;             // a watchpoint fired in the running block
+    uint64_t watch_addr;
+    int running;      // resumed by gdb, which is owed a stop reply
+    char reply[32];   // the last stop reply, repeated for '?'
+
+    char packet[GDB_PACKET_SIZE];
+    uint8_t rx[256];  // bytes received but not yet parsed
+    int rx_pos, rx_len;
+} GDB;
+
+// listen on "<port>" (127.0.0.1) or "unix:<path>" and wait for gdb to
+// attach; returns NULL on failure
+GDB *gdb_create(struct cpu *cpu, const char *where);
+
+// hand the stopped guest to gdb until it continues
+void gdb_stop(struct cpu *cpu, int signal);
+
+// whether the translator should plant a breakpoint at pc
+int gdb_breakpoint_at(GDB *gdb, uint64_t pc);
+
+// the exec of an instruction with a breakpoint on it
+void gdb_exec_breakpoint(struct cpu *cpu, uint32_t inst);
+
+// a store of len bytes at paddr hit a watched page
+void gdb_watch_store(struct cpu *cpu, uint64_t paddr, uint64_t len);
+
+// the interrupt poll: stop if a watchpoint fired or gdb sent a break
+void gdb_poll(struct cpu *cpu);
+
+// the guest has finished: report the exit and close the connection
+void gdb_exit(struct cpu *cpu, int code);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef IDIOM_H
+#define IDIOM_H
+// IDIOM
+// Bulk execution of the copy, fill and scan loops that rv64i code without
+// a libc is full of, as one host memmove, memset or memchr over guest RAM.
+//
+// Loops are recognized when a block is translated: a block that branches
+// back to its own start, whose body is one load and/or one store of the
+// same width through pointers stepped by that width with ADDI, and whose
+// branch either counts an induction register up or down to a bound (BNE,
+// BLT, BLTU) or stops on a zero element (BNE data, x0). That covers
+// byte and word memcpy, memset, strcpy and strlen loops however the
+// compiler ordered the body. Running the block, the fast path does all but
+// the last of the iterations left in the current page in one go and
+// updates the induction registers and instret as if they had run one by
+// one; the last iteration then runs normally, so the exit branch and the
+// loaded register come out of the instructions themselves. The fast path
+// goes through the DTLB only when it already maps both pages, and falls
+// back to the instructions otherwise, so page faults, MMIO and access
+// faults are taken exactly where the loop would take them.
+//
+// With a symbol table (-y), calls to memcpy, memset and strlen are also
+// replaced as a whole: a0 and pc come back as from the function, which
+// counts as one retired instruction. A fault there is reported at the
+// function's entry with nothing but memory changed, so the handler's
+// return reruns the call.
+//
+// Idioms are off with the cache or timing model, whose reports need every
+// access, and with a debugger attached.
+#include <stdint.h>
+
+#include "symbols.h"
+
+#define IDIOM_STEPS 4  // induction registers a loop may step
+
+enum {
+    IDIOM_NONE,
+    IDIOM_LOOP,
+    IDIOM_MEMCPY,
+    IDIOM_MEMSET,
+    IDIOM_STRLEN,
+};
+
+// loop exits
+enum {
+    IDIOM_UNTIL_EQ,    // BNE cond, bound
+    IDIOM_WHILE_LT,    // BLT cond, bound
+    IDIOM_WHILE_LTU,   // BLTU cond, bound
+    IDIOM_UNTIL_ZERO,  // BNE data, x0
+};
+
+struct cpu;
+struct BLOCK;
+
+typedef struct IDIOM_ACCESS {
+    uint8_t base;    // pointer register, 0 if there is no such access
+    int32_t offset;  // from the base's value at the start of an iteration
+} IDIOM_ACCESS;
+
+typedef struct IDIOM {
+    uint8_t kind;
+    uint8_t width;  // element bytes
+    uint8_t exit;
+    uint8_t data;    // register loaded, 0 if none
+    uint8_t sign;    // the load sign-extends
+    uint8_t copy;    // the store writes the loaded register
+    uint8_t fill;    // else the register it writes
+    uint8_t cond;    // register the exit tests
+    uint8_t bound;   // what it is tested against
+    IDIOM_ACCESS load;
+    IDIOM_ACCESS store;
+    uint8_t nsteps;
+    uint8_t step_reg[IDIOM_STEPS];
+    int64_t step[IDIOM_STEPS];  // added to the register per iteration
+} IDIOM;
+
+// the entry points of the C library functions replaced as a whole
+typedef struct IDIOM_FUNCS {
+    uint64_t memcpy_pc;
+    uint64_t memset_pc;
+    uint64_t strlen_pc;
+} IDIOM_FUNCS;
+
+// take the functions to replace from the image's symbols
+void idiom_set_symbols(struct cpu *cpu, const SYMBOLS *symbols);
+
+// called by the translator on a complete block at pc
+void idiom_match(struct cpu *cpu, struct BLOCK *block, uint64_t pc);
+
+// run the idiom of the block about to execute at cpu->pc; returns 1 if it
+// ran the whole block, 0 if the block's instructions still have to run
+int idiom_run(struct cpu *cpu, struct BLOCK *block);
+
+#endif
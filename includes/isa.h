@@ -0,0 +1,83 @@
+#ifndef ISA_H
+#define ISA_H
+// ISA
+// Instruction ids, classes and the decoder, all derived from isa.def.
+//
+// Decoding is a lookup in a flat table indexed by opcode[6:2], funct3 and
+// funct7. Most keys name the instruction outright; the few whose encodings
+// also depend on other fields (rs2 selectors, the SYSTEM immediates) point
+// into a short candidate list that is scanned in isa.def order. Both tables
+// are generated at build time by tools/isa_gen.c into gen/isa_decode.c.
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+#define INSN(id, name, mask, match, args, exec, cls) ISA_##id,
+#include "isa.def"
+#undef INSN
+    ISA_COUNT
+};
+
+typedef enum ISA_CLASS {
+    CLASS_ALU,
+    CLASS_MUL,
+    CLASS_DIV,
+    CLASS_LOAD,
+    CLASS_STORE,
+    CLASS_AMO,
+    CLASS_FP,
+    CLASS_FDIV,
+    CLASS_VEC,
+    // the classes from here on end a translated block
+    CLASS_BRANCH,
+    CLASS_JAL,
+    CLASS_JALR,
+    CLASS_SYSTEM,  // may change privilege, translation, pc or the code
+} ISA_CLASS;
+
+typedef struct ISA_INFO {
+    const char *name;
+    uint32_t mask;
+    uint32_t match;
+    const char *args;
+    ISA_CLASS cls;
+} ISA_INFO;
+
+extern const ISA_INFO isa_info[ISA_COUNT];
+
+// decode lookup, indexed by ISA_KEY(inst)
+#define ISA_KEY_BITS 15
+#define ISA_KEY(inst) \
+    ((((inst) >> 2) & 0x1f) | (((inst) >> 7) & 0xe0) | (((inst) >> 17) & 0x7f00))
+#define ISA_KEY_MASK 0xfe00707f  // the bits ISA_KEY looks at, plus 1..0
+#define ISA_LIST 0x8000  // key entries >= ISA_LIST index isa_decode_list
+
+typedef struct ISA_CANDIDATE {
+    uint32_t mask;
+    uint32_t match;
+    uint16_t id;
+} ISA_CANDIDATE;
+
+extern const uint16_t isa_decode_key[1 << ISA_KEY_BITS];
+extern const ISA_CANDIDATE isa_decode_list[];
+
+// instruction id of a 32-bit (or expanded compressed) instruction
+static inline int isa_decode(uint32_t inst)
+{
+    uint16_t e = isa_decode_key[ISA_KEY(inst)];
+
+    if ((inst & 0x3) != 0x3)
+        return ISA_ILLEGAL;
+    if (e < ISA_LIST)
+        return e;
+    // every list ends with ISA_ILLEGAL, which matches anything
+    const ISA_CANDIDATE *c = &isa_decode_list[e - ISA_LIST];
+    while ((inst & c->mask) != c->match)
+        c++;
+    return c->id;
+}
+
+// disassemble inst, located at pc, into buf; returns the id
+int isa_disasm(char *buf, size_t size, uint64_t pc, uint32_t inst);
+
+#endif
@@ -1,32 +1,43 @@
+#ifndef ISA_DECODE_H
+#define ISA_DECODE_H
 // ---------- Instruction Decode ----------
+// Field extractors, shared by the interpreter and the disassembler
+#include <stdint.h>
+
 // the address of destination register
-uint64_t rd(uint32_t inst)
+static inline uint64_t rd(uint32_t inst)
 {
     return (inst >> 7) & 0x1f;  // rd in bits 11..7
 }
 
 // the address of source register 1
-uint64_t rs1(uint32_t inst)
+static inline uint64_t rs1(uint32_t inst)
 {
     return (inst >> 15) & 0x1f;  // rs1 in bits 19..15
 }
 
 // the address of source register 2
-uint64_t rs2(uint32_t inst)
+static inline uint64_t rs2(uint32_t inst)
 {
     return (inst >> 20) & 0x1f;  // rs2 in bits 24..20
 }
 
+// the address of source register 3 (fused multiply-add)
+static inline uint64_t rs3(uint32_t inst)
+{
+    return (inst >> 27) & 0x1f;  // rs3 in bits 31..27
+}
+
 // A value which gives the address of destination register
 // I-Type: Immediate type instructions
-uint64_t imm_I(uint32_t inst)
+static inline uint64_t imm_I(uint32_t inst)
 {
     // imm[11:0] = inst[31:20]
     return ((int64_t) (int32_t) (inst & 0xfff00000)) >> 20;
 }
 
 // S-Type: Store type instructions
-uint64_t imm_S(uint32_t inst)
+static inline uint64_t imm_S(uint32_t inst)
 {
     // imm[11:5] = inst[31:25], imm[4:0] = inst[11:7]
     return ((int64_t) (int32_t) (inst & 0xfe000000) >> 20) |
@@ -34,7 +45,7 @@ uint64_t imm_S(uint32_t inst)
 }
 
 // B-Type: Break type instructions
-uint64_t imm_B(uint32_t inst)
+static inline uint64_t imm_B(uint32_t inst)
 {
     // imm[12|10:5|4:1|11] = inst[31|30:25|11:8|7]
     return ((int64_t) (int32_t) (inst & 0x80000000) >> 19) |
@@ -44,14 +55,14 @@ uint64_t imm_B(uint32_t inst)
 }
 
 // U-Type: Register type instructions
-uint64_t imm_U(uint32_t inst)
+static inline uint64_t imm_U(uint32_t inst)
 {
     // imm[31:12] = inst[31:12]
-    return (int64_t) (int32_t) (inst & 0xfffff999);
+    return (int64_t) (int32_t) (inst & 0xfffff000);
 }
 
 // J-Type: Jump type instructions
-uint64_t imm_J(uint32_t inst)
+static inline uint64_t imm_J(uint32_t inst)
 {
     // imm[20|10:1|11|19:12] = inst[31|30:21|20|19:12]
     return (uint64_t) ((int64_t) (int32_t) (inst & 0x80000000) >> 11) |
@@ -61,9 +72,11 @@ uint64_t imm_J(uint32_t inst)
 }
 
 // the shift amount
-uint32_t shamt(uint32_t inst)
+static inline uint32_t shamt(uint32_t inst)
 {
     // shamt(shift amount) only required for immediate shift instructions
-    // shamt[4:5] = imm[5:0]
-    return (uint32_t) (imm_I(inst) & 0x1f);  // TODO: 0x1f / 0x3f ?
-}
\ No newline at end of file
+    // shamt[5:0] = imm[5:0], RV64 shifts take six bits
+    return (uint32_t) (imm_I(inst) & 0x3f);
+}
+
+#endif
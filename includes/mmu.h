@@ -0,0 +1,93 @@
+#ifndef MMU_H
+#define MMU_H
+// MMU
+// Sv39/Sv48 address translation with split instruction and data TLBs.
+//
+// Both TLBs are direct-mapped and tagged with the virtual page number plus a
+// 12-bit context: the ASID, whether the access is made from U-mode, the SUM
+// bit, and a flag for untranslated (bare or M-mode) accesses. The context is
+// recomputed whenever the privilege level, satp or mstatus change, so a hit
+// needs neither a permission check nor a flush on address-space switches:
+// it is one tag compare, and for RAM pages one add to get the host pointer.
+#include <stdint.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1ULL << PAGE_SHIFT)
+#define PAGE_OFFSET(addr) ((addr) & (PAGE_SIZE - 1))
+
+#ifndef TLB_BITS
+#define TLB_BITS 8  // entries per TLB = 1 << TLB_BITS
+#endif
+#define TLB_SIZE (1 << TLB_BITS)
+#define TLB_INDEX(addr) (((addr) >> PAGE_SHIFT) & (TLB_SIZE - 1))
+#define TLB_TAG(addr, ctx) (((addr) >> PAGE_SHIFT) | (ctx))
+#define TLB_INVALID (~0ULL)
+
+// satp
+#define SATP_MODE_BARE 0ULL
+#define SATP_MODE_SV39 8ULL
+#define SATP_MODE_SV48 9ULL
+#define SATP_ASID_BITS 9  // implemented ASIDLEN, the rest reads as zero
+
+// TLB tag context, above the 52-bit virtual page number
+#define TLB_CTX_USER (1ULL << (52 + SATP_ASID_BITS))
+#define TLB_CTX_SUM (1ULL << (53 + SATP_ASID_BITS))
+#define TLB_CTX_BARE (1ULL << (54 + SATP_ASID_BITS))
+
+// page table entry bits
+#define PTE_V (1 << 0)
+#define PTE_R (1 << 1)
+#define PTE_W (1 << 2)
+#define PTE_X (1 << 3)
+#define PTE_U (1 << 4)
+#define PTE_G (1 << 5)
+#define PTE_A (1 << 6)
+#define PTE_D (1 << 7)
+
+enum { ACCESS_LOAD, ACCESS_STORE, ACCESS_FETCH };
+
+typedef struct TLB_ENTRY {
+    uint64_t tag;        // TLB_TAG of a readable (ITLB: executable) page
+    uint64_t tag_write;  // TLB_TAG if stores may use the entry, else invalid
+    uintptr_t addend;    // host address = vaddr + addend; 0 for MMIO pages
+    uint64_t paddr;      // physical address of the page
+    uint16_t asid;
+    uint8_t global;
+} TLB_ENTRY;
+
+typedef struct MMU {
+    uint64_t ctx_fetch;  // tag context of instruction fetches
+    uint64_t ctx_data;   // ... of loads and stores (differs under MPRV)
+    uint64_t itlb_hits;  // the hit counters sit with the hot CPU state
+    uint64_t dtlb_hits;
+    TLB_ENTRY itlb[TLB_SIZE];
+    TLB_ENTRY dtlb[TLB_SIZE];
+
+    uint64_t itlb_misses;
+    uint64_t dtlb_misses;
+} MMU;
+
+struct cpu;
+
+void mmu_init(struct cpu *cpu);
+
+// recompute the tag contexts after a change of privilege, satp or mstatus
+void mmu_update_ctx(struct cpu *cpu);
+
+// walk the page tables for vaddr and fill the matching TLB entry; raises a
+// page fault instead of returning if the access is not permitted
+TLB_ENTRY *mmu_fill(struct cpu *cpu, uint64_t vaddr, int access);
+
+// SFENCE.VMA: drop entries of one page and/or one address space
+void mmu_flush(struct cpu *cpu, int by_vaddr, uint64_t vaddr, int by_asid,
+               uint64_t asid);
+
+void mmu_flush_all(struct cpu *cpu);
+
+// take store permission from every DTLB entry, so that the next store to
+// each page refills it
+void mmu_flush_writes(struct cpu *cpu);
+
+void mmu_dump_stats(struct cpu *cpu);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef PLIC_H
+#define PLIC_H
+// PLIC
+// Platform-level interrupt controller: routes device interrupt lines to the
+// machine (context 0) and supervisor (context 1) external interrupt of the
+// hart.
+#include <pthread.h>
+#include <stdint.h>
+
+#define PLIC_BASE 0xc000000
+#define PLIC_SIZE 0x4000000
+#define PLIC_PRIORITY 0x0
+#define PLIC_PENDING 0x1000
+#define PLIC_ENABLE 0x2000
+#define PLIC_ENABLE_STRIDE 0x80
+#define PLIC_CONTEXT 0x200000
+#define PLIC_CONTEXT_STRIDE 0x1000
+
+#define PLIC_SOURCES 32
+#define PLIC_CONTEXTS 2
+
+typedef struct PLIC {
+    pthread_mutex_t lock;  // lines are raised from device threads
+    uint32_t priority[PLIC_SOURCES];
+    uint32_t level;    // current level of each interrupt line
+    uint32_t pending;  // gateway pending bits
+    uint32_t claimed;  // claimed and not yet completed
+    uint32_t enable[PLIC_CONTEXTS];
+    uint32_t threshold[PLIC_CONTEXTS];
+
+    // drives the MEIP (context 0) and SEIP (context 1) bits of the hart
+    void (*notify)(void *opaque, int context, int level);
+    void *opaque;
+} PLIC;
+
+void plic_init(PLIC *plic);
+
+// return every register and line to its reset value, keeping the wiring
+// to the hart
+void plic_reset(PLIC *plic);
+
+// set the level of a device interrupt line (1..PLIC_SOURCES-1)
+void plic_set_irq(PLIC *plic, int irq, int level);
+
+uint64_t plic_load(PLIC *plic, uint64_t addr, uint64_t size);
+
+void plic_store(PLIC *plic, uint64_t addr, uint64_t size, uint64_t value);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+// REPLAY
+// Deterministic record and replay. Recording logs every input the guest
+// sees that does not follow from its own execution; replaying feeds the
+// log back in place of the host, so the run repeats bit for bit on another
+// machine.
+//
+// The inputs of this machine are:
+//   - mtime, as read through the CLINT or the time CSR, logged per read;
+//   - the asynchronous mip bits (MEIP, SEIP, MTIP). The guest sees them
+//     change only at interrupt polls, which fall on block boundaries, and
+//     each change is logged with the instret of its poll;
+//   - virtio-blk completions: the bytes read from the disk and the status
+//     of each request. Requests are served on the hart's thread as soon as
+//     the queue is notified, so they complete at the same instruction in
+//     both runs.
+// Replay needs no per-instruction check: the poll budget is cut so that
+// the dispatcher polls exactly at the instret of the next logged mip
+// change. WFI returns at once, since the wake-up is in the log. The
+// network device is not supported, as frames arrive from outside.
+//
+// The log is a stream of events in the order the guest consumed them: a
+// type byte followed by LEB128 numbers, times and instrets delta coded.
+#include <stdint.h>
+#include <stdio.h>
+
+#define REPLAY_ASYNC_MIP (MIP_MEIP | MIP_SEIP | MIP_MTIP)
+
+enum {
+    REPLAY_RECORD,
+    REPLAY_PLAY,
+};
+
+// event types
+enum {
+    REPLAY_MIP = 'I',     // instret, mip & REPLAY_ASYNC_MIP
+    REPLAY_TIME = 'T',    // mtime
+    REPLAY_STATUS = 'S',  // a virtio request's status byte
+    REPLAY_DATA = 'D',    // length, bytes DMAed into guest RAM
+    REPLAY_END = -1,
+};
+
+struct cpu;
+
+typedef struct REPLAY {
+    FILE *log;
+    int mode;
+    struct cpu *cpu;
+    uint64_t mip;  // the asynchronous mip bits the guest currently sees
+
+    // delta coding state, the same on both sides
+    uint64_t instret;
+    uint64_t time;
+
+    // replay: the next event, read ahead so that a mip change can be
+    // scheduled
+    int next;
+    uint64_t next_instret;
+
+    uint64_t events;
+} REPLAY;
+
+// open a log for "record:<path>" or "replay:<path>"; returns NULL on error
+REPLAY *replay_open(const char *spec);
+
+// wire the log into the CPU and the devices whose inputs it carries
+void replay_attach(REPLAY *r, struct cpu *cpu);
+
+// an input of the given type: logged and returned when recording, taken
+// from the log when replaying
+uint64_t replay_input(REPLAY *r, int type, uint64_t live);
+
+// len bytes that a device puts in guest RAM at dst, from src when recording
+// and from the log when replaying
+void replay_data(REPLAY *r, void *dst, const void *src, uint64_t len);
+
+// the interrupt poll: latch (record) or apply (replay) the asynchronous
+// mip bits, and schedule the next poll for the next logged change
+void replay_poll(struct cpu *cpu);
+
+// flush the log and report
+void replay_close(REPLAY *r);
+
+#endif
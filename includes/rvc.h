@@ -0,0 +1,26 @@
+#ifndef RVC_H
+#define RVC_H
+// RVC
+// The C extension: every 16-bit instruction has a 32-bit equivalent, so a
+// compressed parcel is expanded once and the interpreter only ever sees
+// 32-bit encodings. Expansion depends on nothing but the parcel itself, so
+// the cache is indexed by the parcel value and never needs invalidating.
+#include <stdint.h>
+
+#define RVC_IS_COMPRESSED(parcel) (((parcel) & 0x3) != 0x3)
+
+// 32-bit equivalent of every parcel seen so far, 0 if not yet expanded
+extern uint32_t rvc_cache[1 << 16];
+
+// expand a compressed instruction, 0 if the encoding is reserved or illegal
+uint32_t rvc_expand(uint16_t c);
+
+static inline uint32_t rvc_decode(uint16_t c)
+{
+    uint32_t inst = rvc_cache[c];
+    if (inst)
+        return inst;
+    return rvc_cache[c] = rvc_expand(c);
+}
+
+#endif
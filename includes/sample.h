@@ -0,0 +1,41 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+// SAMPLE
+// Sampled simulation: fast-forward through most of a run and look closely
+// at evenly spaced windows of it, SimPoint style, without restarting.
+//
+// The two modes are separate dispatch loops rather than a flag tested per
+// instruction. The fast loop runs blocks with nothing but the instructions
+// themselves; the detail loop traces each instruction with its disassembly
+// and the registers, logs loads, stores and AMOs with their addresses and
+// values, and counts instructions by class. Modes switch at the first
+// block boundary once instret reaches the end of the current window.
+#include <stdint.h>
+
+#include "isa.h"
+
+struct cpu;
+
+typedef struct SAMPLE {
+    uint64_t fast;    // instructions to fast-forward before each window
+    uint64_t detail;  // instructions in each detail window
+    int detailed;     // mode currently running
+    uint64_t switch_at;  // instret at which the mode changes
+
+    uint64_t windows;
+    uint64_t insns;  // instructions run in detail windows
+    uint64_t classes[CLASS_SYSTEM + 1];
+    uint64_t loads;
+    uint64_t stores;
+} SAMPLE;
+
+// fast = 0 runs in detail throughout; detail = 0 never leaves fast mode
+void sample_init(SAMPLE *s, uint64_t fast, uint64_t detail);
+
+// dispatch until pc reaches 0. Exceptions unwind to the caller's trap_env,
+// which calls this again; the window position is kept in s.
+void sample_run(struct cpu *cpu, SAMPLE *s);
+
+void sample_dump_stats(SAMPLE *s);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SEMIHOST_H
+#define SEMIHOST_H
+// SEMIHOST
+// RISC-V semihosting: host file access for bare-metal guests, much faster
+// than a console device for bulk data.
+//
+// A call is the uncompressed sequence
+//     slli x0, x0, 0x1f; ebreak; srai x0, x0, 7
+// executed in M or S mode, with the operation in a0 and a pointer to its
+// parameter block (XLEN words) in a1; the result comes back in a0 and the
+// guest continues after the ebreak. Anywhere else, EBREAK traps as usual.
+//
+// Supported operations: SYS_OPEN (":tt" names the console), SYS_CLOSE,
+// SYS_WRITE and SYS_READ (returning the bytes not transferred), SYS_FLEN
+// and SYS_EXIT, which ends the run with the exit code of the emulator set
+// to the guest's. Others return -1. Reads and writes go straight between
+// the host file and guest RAM with one readv or writev over the pages of
+// the buffer; a buffer page that is not mapped faults at the ebreak before
+// any data moves, so the guest's handler can map it and the call rerun.
+#include <stdint.h>
+
+#define SEMIHOST_FILES 64  // open handles per guest
+#define SEMIHOST_IOV 512   // pages moved per SYS_READ or SYS_WRITE
+
+// operations
+#define SYS_OPEN 0x01
+#define SYS_CLOSE 0x02
+#define SYS_WRITE 0x05
+#define SYS_READ 0x06
+#define SYS_FLEN 0x0c
+#define SYS_EXIT 0x18
+
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+struct cpu;
+
+typedef struct SEMIHOST {
+    int fds[SEMIHOST_FILES];  // host fd of each handle, -1 if free
+    int status;               // exit code from SYS_EXIT
+
+    uint64_t calls;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} SEMIHOST;
+
+SEMIHOST *semihost_create(void);
+
+// called for an EBREAK; returns 1 if it was a semihosting call, which has
+// been carried out
+int semihost_call(struct cpu *cpu);
+
+void semihost_dump_stats(SEMIHOST *s);
+
+#endif
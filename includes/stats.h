@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+// STATS
+// Live statistics for long runs: a JSON snapshot of the engine's counters,
+// written to a file or a UNIX socket every few seconds and on SIGUSR1,
+// while the guest keeps running.
+//
+// Collection costs nothing extra on the paths that count. Each hart keeps
+// its counters in its own CPU state (instret, block cache and TLB counters,
+// and HART_COUNTERS on a cache line of its own); each device thread keeps
+// its byte counts on its own line in the device. Nothing is shared or
+// atomic while counting: the exporter thread reads the counters as they
+// are, sums them over the harts and only then derives the rates.
+//
+// Guest MIPS comes from a once-a-second sample of instret, averaged over
+// the last 1, 10 and 60 seconds. Dirty pages are the RAM pages the hart
+// stored to between the last two snapshots: while stats are on, a DTLB
+// entry only allows stores once a store filled it, which marks its page in
+// the DRAM dirty map. A snapshot asks the hart to cut the interval, and at
+// its next interrupt poll the hart drops the write permission of its DTLB
+// entries, counts the map and clears it.
+//
+// A file target is replaced atomically (written aside, then renamed); a
+// socket target gets one snapshot per line over a stream connection,
+// reconnected as needed.
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+#define STATS_MAX_HARTS 8
+#define STATS_HISTORY 61  // seconds of instret samples, for the 60 s window
+
+struct cpu;
+
+// counters of one hart that live outside its hot state
+typedef struct HART_COUNTERS {
+    uint64_t exceptions;
+    uint64_t interrupts;
+    uint64_t dirty_pages;  // RAM pages stored to in the last cut interval
+    int cut;  // set by the exporter: start the next interval
+} __attribute__((aligned(64))) HART_COUNTERS;
+
+typedef struct STATS_SAMPLE {
+    double time;  // seconds since the start
+    uint64_t instret;
+} STATS_SAMPLE;
+
+typedef struct STATS {
+    struct cpu *harts[STATS_MAX_HARTS];
+    int nharts;
+    char *path;  // file, or socket path when socket is set
+    int socket;
+    int fd;      // the socket's connection, -1 if none
+    int period;  // seconds between snapshots, 0 for SIGUSR1 only
+
+    pthread_t thread;
+    pthread_mutex_t lock;  // one snapshot at a time
+    sem_t wake;  // posted by SIGUSR1
+    double start;
+    STATS_SAMPLE history[STATS_HISTORY];  // ring, one sample a second
+    uint64_t samples;
+    uint64_t snapshots;
+} STATS;
+
+// "<path>" or "unix:<path>", then optionally ",<seconds>" (default 1);
+// returns NULL on a bad spec
+STATS *stats_create(const char *spec);
+
+// count a hart in the snapshots; harts are added before stats_start
+void stats_add_hart(STATS *s, struct cpu *cpu);
+
+// start the exporter thread and take SIGUSR1
+void stats_start(STATS *s);
+
+// the interrupt poll: cut the dirty page interval if a snapshot asked to
+void stats_poll(struct cpu *cpu);
+
+// write a last snapshot
+void stats_close(STATS *s);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+// SYMBOLS
+// Guest symbol table, read from the ELF file the loaded image was built
+// from, so that reports can name guest addresses as symbol+offset.
+#include <stdint.h>
+
+typedef struct SYMBOL {
+    uint64_t addr;
+    uint64_t size;
+    char *name;
+} SYMBOL;
+
+typedef struct SYMBOLS {
+    SYMBOL *syms;  // sorted by address
+    int count;
+} SYMBOLS;
+
+// read the function and object symbols of an ELF64 file; returns -1 and
+// leaves the table empty if the file cannot be read
+int symbols_load(SYMBOLS *symbols, const char *path);
+
+// the symbol containing addr, or the closest one below it; NULL if none
+const SYMBOL *symbols_lookup(const SYMBOLS *symbols, uint64_t addr);
+
+// the symbol with the given name, or NULL
+const SYMBOL *symbols_find(const SYMBOLS *symbols, const char *name);
+
+// print addr as "name+0x10" (or just the address) into buf
+void symbols_format(const SYMBOLS *symbols, uint64_t addr, char *buf,
+                    int size);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef TIER_H
+#define TIER_H
+// TIER
+// Tiered execution: a block that keeps running is translated again, off
+// the hart's thread, into ops that skip the per-instruction work of the
+// decoded block.
+//
+// Tier 1 is the decoded block (block.h): every instruction stores inst_pc,
+// pc and instret and clears x0 around an indirect call to its exec, which
+// extracts its operands from the encoding again. Tier 2 ops have their
+// operands, immediates and branch targets worked out in advance. ALU ops
+// and memory accesses that hit a RAM page in the DTLB touch only the
+// registers (and memory); LUI or AUIPC followed by an ADDI of the same
+// register becomes one constant, ALU results to x0 are dropped, and a
+// direct branch or jump sets pc from its precomputed targets. Everything
+// else, and any access that misses the DTLB, crosses a page or stores to a
+// page with translated code on it, runs the instruction's own exec the
+// tier 1 way, with inst_pc, pc and instret brought up to date first, so
+// faults, CSR reads of instret and self-modifying stores behave exactly as
+// in tier 1.
+//
+// Watchpoints set with -w are not tracked pages: the host faults on the
+// store itself. A fast store therefore publishes its inst_pc before it
+// writes, and when a store stops the block, its ops bring instret and pc
+// up to the instruction after the store.
+//
+// Blocks count their runs. When a block reaches TIER_HOT, the hart copies
+// its decoded instructions into a single-producer, single-consumer ring
+// (lock-free: each side owns one index) and carries on with tier 1. A
+// background thread translates the queued blocks and publishes each with
+// one compare-and-swap into the block; the hart picks the ops up on the
+// block's next run. A block's generation count changes whenever its slot
+// is translated again, so ops made from an older translation are never
+// run, and only the hart frees ops, when it replaces them.
+//
+// Tier 2 is off with the cache or timing model, a debugger or coverage,
+// like idioms; -b turns it off.
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+#include "block.h"
+
+#define TIER_HOT 64     // runs of a block before it is queued
+#define TIER_QUEUE 64   // blocks waiting for the worker
+
+struct cpu;
+struct TIER_OP;
+
+typedef void (*TIER_RUN)(struct cpu *cpu, const struct TIER_OP *op,
+                         uint64_t base);
+
+typedef struct TIER_OP {
+    TIER_RUN run;     // given instret at the block's entry
+    BLOCK_INSN in;    // the instruction, for the ops that run its exec
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t index;    // of the instruction in the block
+    int64_t imm;      // immediate, constant or branch target
+    uint64_t pc;      // of the instruction
+} TIER_OP;
+
+// what the end of the block still has to do after the last op
+#define TIER_SYNC_INSTRET 1
+#define TIER_SYNC_PC 2
+
+typedef struct TIER_OPS {
+    uint32_t gen;    // the block translation they were made from
+    int n;           // ops
+    int count;       // instructions
+    int tail;        // TIER_SYNC_* bits
+    uint64_t end;    // pc after the block
+    TIER_OP op[];
+} TIER_OPS;
+
+typedef struct TIER_REQUEST {
+    BLOCK *block;
+    uint32_t gen;
+    uint64_t pc;
+    int n;
+    BLOCK_INSN insn[BLOCK_MAX_INSNS];
+} TIER_REQUEST;
+
+typedef struct TIER {
+    // each index is written by one side only
+    uint32_t head __attribute__((aligned(64)));  // next request the hart fills
+    uint64_t queued;   // hart side
+    uint64_t dropped;  // the ring was full
+    uint32_t tail __attribute__((aligned(64)));  // next request the worker takes
+    uint64_t translated;  // worker side
+    uint64_t stale;       // the block was translated again meanwhile
+    TIER_REQUEST ring[TIER_QUEUE];
+
+    sem_t wake;
+    pthread_t thread;
+} TIER;
+
+// start the worker thread
+TIER *tier_create(void);
+
+// a block reached TIER_HOT: queue it, unless the ring is full
+void tier_submit(struct cpu *cpu, BLOCK *block);
+
+// run a block's ops; leaves pc at the next block's entry
+void tier_run(struct cpu *cpu, BLOCK *block, const TIER_OPS *ops);
+
+void tier_dump_stats(struct cpu *cpu);
+
+#endif
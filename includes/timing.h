@@ -0,0 +1,91 @@
+#ifndef TIMING_H
+#define TIMING_H
+// TIMING
+// Optional cycle-approximate model of an in-order pipeline, for estimating
+// how guest code will perform on target silicon. With it enabled, cycle
+// and mcycle count estimated cycles instead of instructions.
+//
+// The model consumes the ops of translated blocks after they execute: the
+// decoded id gives the instruction class and which register fields are
+// sources and destinations, and the new pc gives the branch outcome. Up to
+// `width` instructions issue per cycle, in order, each once its source
+// registers are ready; a result is ready after its class latency. Control
+// flow goes through a bimodal or gshare direction predictor, a BTB for
+// targets and a return-address stack. A mispredict costs `penalty` cycles,
+// and SYSTEM instructions drain the pipeline. Caches are not modelled
+// here; loads take the load-use latency.
+#include <stdint.h>
+
+#include "isa.h"
+
+struct cpu;
+struct BLOCK_INSN;
+
+enum {
+    STALL_LOAD,       // waiting on a load result
+    STALL_MULDIV,     // ... on a multiply or divide
+    STALL_FP,         // ... on an FP or vector result
+    STALL_DEPEND,     // ... on a result from the same issue group
+    STALL_BRANCH,     // direction or target mispredicted
+    STALL_BTB,        // taken and predicted so, but the target missed the BTB
+    STALL_SERIALIZE,  // a SYSTEM instruction drained the pipeline
+    STALL_CAUSES,
+};
+
+typedef struct TIMING_OP {
+    uint8_t src[3];  // register fields: 1-3 = rs1-rs3, | 4 for f registers
+    uint8_t dst;     // 0 = none, 1 = x rd, 2 = f rd
+    uint8_t cls;
+} TIMING_OP;
+
+typedef struct TIMING {
+    // configuration
+    int width;
+    int latency[CLASS_SYSTEM + 1];
+    int penalty;  // cycles lost to a mispredict
+    int gshare;   // else bimodal
+    int bht_bits, btb_bits, ras_size;
+
+    TIMING_OP ops[ISA_COUNT];
+
+    // pipeline state
+    uint64_t cycle;  // current issue cycle
+    int slots;       // instructions issued in it
+    uint64_t ready[64];  // cycle each x (0-31) and f (32-63) register is ready
+    uint8_t producer[64];  // class that last wrote it
+    uint64_t cycle_offset;  // mcycle = cycle + cycle_offset
+
+    // predictors
+    uint8_t *bht;  // 2-bit counters
+    uint64_t *btb_tag;
+    uint64_t *btb_target;
+    uint64_t *ras;
+    int ras_top;
+    uint64_t history;
+
+    // statistics
+    uint64_t insns;
+    uint64_t stalls[STALL_CAUSES];
+    uint64_t branches, mispredicts;
+    uint64_t jumps, btb_misses;
+    uint64_t returns, ras_misses;
+} TIMING;
+
+// Build the model from a spec of comma-separated key=value settings:
+// width, load, mul, div, fp, fdiv, vec, penalty, bp (bimodal|gshare),
+// bht, btb (entries, powers of two) and ras. "default" keeps every
+// default. Returns NULL on a malformed spec.
+TIMING *timing_create(const char *spec);
+
+// account for one op that has just executed at pc; cpu->pc is the next pc
+void timing_op(TIMING *t, struct cpu *cpu, const struct BLOCK_INSN *in,
+               uint64_t pc);
+
+// the estimated cycle count, as mcycle reads it
+uint64_t timing_cycles(TIMING *t);
+
+void timing_set_cycles(TIMING *t, uint64_t value);
+
+void timing_dump_stats(TIMING *t);
+
+#endif
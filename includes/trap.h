@@ -0,0 +1,38 @@
+#ifndef TRAP_H
+#define TRAP_H
+
+#include <stdint.h>
+
+// Exception causes (mcause/scause with the interrupt bit clear)
+#define EXC_INST_MISALIGNED 0
+#define EXC_INST_ACCESS_FAULT 1
+#define EXC_ILLEGAL_INST 2
+#define EXC_BREAKPOINT 3
+#define EXC_LOAD_MISALIGNED 4
+#define EXC_LOAD_ACCESS_FAULT 5
+#define EXC_STORE_MISALIGNED 6
+#define EXC_STORE_ACCESS_FAULT 7
+#define EXC_ECALL_U 8
+#define EXC_ECALL_S 9
+#define EXC_ECALL_M 11
+#define EXC_INST_PAGE_FAULT 12
+#define EXC_LOAD_PAGE_FAULT 13
+#define EXC_STORE_PAGE_FAULT 15
+
+struct cpu;
+
+// Raise a synchronous exception for the current instruction and longjmp back
+// to the dispatcher, which resumes at the trap handler. Instruction helpers
+// can therefore fault from anywhere without returning a status.
+void cpu_exception(struct cpu *cpu, uint64_t cause, uint64_t tval)
+    __attribute__((noreturn));
+
+// take the highest priority pending and enabled interrupt, if any
+void cpu_poll_interrupts(struct cpu *cpu);
+
+// return from an M-mode / S-mode trap handler
+void cpu_mret(struct cpu *cpu);
+
+void cpu_sret(struct cpu *cpu);
+
+#endif
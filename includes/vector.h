@@ -0,0 +1,54 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+// VECTOR
+// The core of RVV 1.0: vsetvl, integer arithmetic, compares, mask and
+// permutation basics, reductions, and unit-stride, strided and indexed
+// loads and stores.
+//
+// VLEN is 256 bits so that one vector register is one AVX2 register, and
+// element-wise operations run as loops over 256-bit host vectors (GCC
+// vector extensions) with a scalar loop only for masked-off, tail or
+// non-SIMD-able elements. Registers of a group are stored back to back, so
+// an LMUL = 8 operand is one contiguous 256-byte array.
+#include <stdint.h>
+
+#define VLEN 256
+#define VLENB (VLEN / 8)
+#define ELEN 64
+
+// vtype
+#define VTYPE_VLMUL 0x7
+#define VTYPE_VSEW_SHIFT 3
+#define VTYPE_VTA (1 << 6)
+#define VTYPE_VMA (1 << 7)
+#define VTYPE_VILL (1ULL << 63)
+
+typedef struct VECTOR {
+    uint8_t reg[32][VLENB] __attribute__((aligned(VLENB)));
+    uint64_t vl;
+    uint64_t vtype;
+    uint64_t vstart;  // instructions always run to completion, so stays 0
+    uint64_t vxsat;
+    uint64_t vxrm;
+
+    // decoded from vtype by vsetvl so that instructions never re-decode it
+    int vill;
+    int sew;     // element width in bytes
+    int lmul;    // registers per group, 1 for fractional LMUL
+    uint64_t vlmax;
+} VECTOR;
+
+struct cpu;
+
+void vector_init(struct cpu *cpu);
+
+// vsetvli, vsetivli and vsetvl
+void vector_setvl(struct cpu *cpu, uint32_t inst);
+
+// vector loads and stores (LOAD-FP / STORE-FP with a vector width)
+void vector_load_store(struct cpu *cpu, uint32_t inst, int store);
+
+// OP-V arithmetic, mask and permutation instructions
+void vector_op(struct cpu *cpu, uint32_t inst);
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+// VIRTIO
+// The virtio-mmio (version 2) transport shared by the virtio devices, and
+// the split virtqueue helpers they use to walk descriptor chains in guest RAM.
+#include <pthread.h>
+#include <stdint.h>
+
+#include "dram.h"
+#include "plic.h"
+
+#define VIRTIO_MAGIC 0x74726976  // "virt"
+#define VIRTIO_VENDOR 0x6d657672  // "rvem"
+
+// MMIO register offsets
+#define VIRTIO_MMIO_MAGIC_VALUE 0x000
+#define VIRTIO_MMIO_VERSION 0x004
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_VENDOR_ID 0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_READY 0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW 0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW 0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH 0x0a4
+#define VIRTIO_MMIO_CONFIG_GENERATION 0x0fc
+#define VIRTIO_MMIO_CONFIG 0x100
+#define VIRTIO_MMIO_SIZE 0x1000
+
+#define VIRTIO_F_VERSION_1 (1ULL << 32)
+
+#define VIRTIO_INT_USED_RING 0x1
+
+#define VIRTQ_DESC_F_NEXT 0x1
+#define VIRTQ_DESC_F_WRITE 0x2
+
+#define VIRTIO_QUEUE_SIZE 256  // QueueNumMax of every queue
+#define VIRTIO_MAX_QUEUES 2
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+typedef struct VIRTQ {
+    uint32_t num;
+    uint32_t ready;
+    uint64_t desc;   // guest physical address of the descriptor table
+    uint64_t avail;  // ... of the driver (available) ring
+    uint64_t used;   // ... of the device (used) ring
+    uint16_t last_avail;  // next avail ring entry the device will consume
+    uint16_t used_idx;    // used ring index not yet published to the driver
+} VIRTQ;
+
+typedef struct VIRTIO {
+    uint32_t device_id;
+    uint64_t device_features;
+    uint64_t driver_features;
+    uint32_t device_features_sel;
+    uint32_t driver_features_sel;
+    uint32_t queue_sel;
+    uint32_t status;
+    uint32_t interrupt_status;
+    VIRTQ queues[VIRTIO_MAX_QUEUES];
+
+    struct DRAM *dram;  // guest RAM the rings and buffers live in
+    struct PLIC *plic;
+    int irq;
+
+    // held by an I/O thread while it walks the queues, and by a reset
+    pthread_mutex_t queue_lock;
+    uint32_t resets;  // under queue_lock: chains popped before one are gone
+
+    // bytes the device moved into and out of guest RAM, each updated by one
+    // device thread and read by the stats exporter
+    uint64_t bytes_in __attribute__((aligned(64)));
+    uint64_t bytes_out __attribute__((aligned(64)));
+} VIRTIO;
+
+void virtio_init(VIRTIO *vio, uint32_t device_id, uint64_t features,
+                 DRAM *dram, PLIC *plic, int irq);
+
+// the common transport registers; offset is relative to the device base
+uint64_t virtio_mmio_load(VIRTIO *vio, uint64_t offset);
+
+void virtio_mmio_store(VIRTIO *vio, uint64_t offset, uint64_t value);
+
+// host pointer to len bytes of guest RAM at addr, or NULL if out of range
+uint8_t *virtio_guest_ptr(VIRTIO *vio, uint64_t addr, uint64_t len);
+
+// head of the next available descriptor chain, or -1 if the ring is empty
+int virtq_pop(VIRTIO *vio, VIRTQ *vq);
+
+// copy descriptor idx of the queue into desc; -1 if the table is out of
+// range. Devices use only the copy, never the guest's table entry.
+int virtq_desc(VIRTIO *vio, VIRTQ *vq, uint16_t idx, struct virtq_desc *desc);
+
+// queue a used element; it becomes visible at the next virtq_flush()
+void virtq_push(VIRTIO *vio, VIRTQ *vq, uint16_t head, uint32_t len);
+
+// publish the pushed used elements and interrupt the driver
+void virtq_flush(VIRTIO *vio, VIRTQ *vq);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+// VIRTIO_BLK
+// A virtio block device backed by a host disk image mapped into the emulator
+// with mmap. Requests are served by a dedicated I/O thread that drains the
+// whole available ring per notification, copies straight between guest RAM
+// and the mapping, and raises a single interrupt per batch. Under record/
+// replay they are served on the hart's thread during the notifying store
+// instead, and what the guest reads goes through the replay log.
+#include <pthread.h>
+#include <stdint.h>
+
+#include "virtio.h"
+
+#define VIRTIO_BLK_BASE 0x10001000
+#define VIRTIO_BLK_IRQ 1
+#define VIRTIO_BLK_ID 2  // virtio device ID of a block device
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+#define VIRTIO_BLK_F_FLUSH (1ULL << 9)
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_T_GET_ID 8
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+typedef struct VIRTIO_BLK {
+    VIRTIO virtio;
+    uint8_t *disk;  // the mapped image, NULL when no disk is attached
+    uint64_t disk_size;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t kick;  // signalled on QueueNotify
+    int notified;
+
+    struct REPLAY *replay;  // serve requests synchronously, or NULL
+} VIRTIO_BLK;
+
+// attach the image at path; a NULL path leaves the device absent
+int virtio_blk_init(VIRTIO_BLK *blk, const char *path, DRAM *dram,
+                    PLIC *plic);
+
+uint64_t virtio_blk_load(VIRTIO_BLK *blk, uint64_t addr, uint64_t size);
+
+void virtio_blk_store(VIRTIO_BLK *blk, uint64_t addr, uint64_t size,
+                      uint64_t value);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+// VIRTIO_NET
+// A virtio network device whose "wire" is a local datagram socket: either a
+// UNIX socket bound to a path and connected to a peer emulator's path, or an
+// in-process loopback socket pair that hands transmitted frames back to the
+// receive queue. Each datagram is one ethernet frame. Both rings are moved in
+// batches with sendmmsg()/recvmmsg() whose iovecs point straight into guest
+// RAM.
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+#include "virtio.h"
+
+#define VIRTIO_NET_BASE 0x10002000
+#define VIRTIO_NET_IRQ 2
+#define VIRTIO_NET_ID 1  // virtio device ID of a network card
+
+#define VIRTIO_NET_F_MAC (1ULL << 5)
+#define VIRTIO_NET_F_STATUS (1ULL << 16)
+
+#define VIRTIO_NET_RXQ 0
+#define VIRTIO_NET_TXQ 1
+
+#define VIRTIO_NET_HDR_SIZE 12  // struct virtio_net_hdr with num_buffers
+#define VIRTIO_NET_BATCH 32     // chains moved per sendmmsg/recvmmsg call
+#define VIRTIO_NET_MAX_SEGS 16  // iovecs per frame
+
+typedef struct VIRTIO_NET {
+    VIRTIO virtio;
+    int present;
+    uint8_t mac[6];
+    int tx_fd;  // the device transmits on tx_fd and receives from rx_fd
+    int rx_fd;
+    struct sockaddr_un peer;  // destination of the unix backend
+    int has_peer;
+
+    pthread_t tx_thread;
+    pthread_t rx_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t kick;  // signalled on QueueNotify
+    int tx_notified;
+    int rx_notified;
+} VIRTIO_NET;
+
+// backend is "loop" or "unix:<local path>:<peer path>"; NULL leaves the
+// device absent
+int virtio_net_init(VIRTIO_NET *net, const char *backend, DRAM *dram,
+                    PLIC *plic);
+
+uint64_t virtio_net_load(VIRTIO_NET *net, uint64_t addr, uint64_t size);
+
+void virtio_net_store(VIRTIO_NET *net, uint64_t addr, uint64_t size,
+                      uint64_t value);
+
+#endif
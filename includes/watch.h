@@ -0,0 +1,67 @@
+#ifndef WATCH_H
+#define WATCH_H
+// WATCH
+// Write watchpoints on guest physical addresses for long runs, caught by
+// the host MMU instead of by a check on the store path.
+//
+// The host pages of DRAM backing a watched range are made read-only. A
+// store into one of them faults; the CPU's SIGSEGV handler passes the
+// fault to watch_fault, which snapshots the watched values on that page,
+// opens the page for writing and ends the running block after the storing
+// instruction, so the store retries and completes.
+// At the next interrupt poll every open page is protected again and each
+// watched value that was written is reported with the pc of the store and
+// its old and new value. A write the hart makes outside a block (a single
+// step from the debugger) has no pc to report and counts as a device's. Accesses to unwatched pages, and loads from
+// watched ones, run exactly as without watchpoints.
+//
+// Device DMA into a watched page is not reported, and the host kernel's
+// copies into one (a disk read into the page) fail instead of faulting, so
+// watch CPU data rather than I/O buffers.
+#include <pthread.h>
+#include <stdint.h>
+
+#include "dram.h"
+
+#define WATCH_MAX 16
+
+struct cpu;
+
+typedef struct WATCH_RANGE {
+    uint64_t addr;  // physical
+    int len;        // 1, 2, 4 or 8 bytes
+    int armed;      // old holds the value from before the faulting store
+    int hit;        // the store began inside the range
+    uint64_t old;
+    uint64_t pc;    // of the store, or ~0 if a device thread wrote
+} WATCH_RANGE;
+
+typedef struct WATCH {
+    struct cpu *cpu;
+    pthread_t thread;  // the hart's, whose stores report a pc
+    long page_size;    // host
+    WATCH_RANGE ranges[WATCH_MAX];
+    int n;
+    uint8_t open[DRAM_PAGES];  // host pages unprotected until the poll
+    int pending;  // set atomically by a fault on any thread
+
+    uint64_t hits;
+    uint64_t faults;
+} WATCH;
+
+WATCH *watch_create(struct cpu *cpu);
+
+// watch len bytes at the physical address addr; returns -1 if the range
+// is not in DRAM or the length is not 1, 2, 4 or 8
+int watch_add(WATCH *w, uint64_t addr, int len);
+
+// a host fault at addr: returns 1 if it was a store to a watched page,
+// which is open for the store to retry once this returns
+int watch_fault(WATCH *w, void *addr);
+
+// the interrupt poll: report the stores and protect the pages again
+void watch_poll(struct cpu *cpu);
+
+void watch_dump_stats(WATCH *w);
+
+#endif
@@ -1,10 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "cache.h"
+#include "cov.h"
 #include "cpu.h"
+#include "gdb.h"
+#include "isa.h"
+#include "replay.h"
+#include "rvc.h"
+#include "sample.h"
+#include "semihost.h"
+#include "stats.h"
+#include "symbols.h"
+#include "tier.h"
+#include "timing.h"
+#include "watch.h"
 
-void read_file(CPU *cpu, char *filename)
+unsigned long read_file(CPU *cpu, char *filename)
 {
     FILE *file;
     uint8_t *buffer;
@@ -38,40 +52,239 @@ void read_file(CPU *cpu, char *filename)
     printf("\n");
 
     // copy the bin executable to dram
-    memcpy(cpu->bus.dram.mem, buffer, fileLen * sizeof(uint8_t));
+    memcpy(cpu->bus->dram.mem, buffer, fileLen * sizeof(uint8_t));
     free(buffer);
+    return fileLen;
+}
+
+// print the loaded image as instructions, from DRAM_BASE
+void disassemble(CPU *cpu, unsigned long len)
+{
+    uint8_t *mem = cpu->bus->dram.mem;
+    char buf[80];
+
+    for (unsigned long off = 0; off + 2 <= len;) {
+        uint32_t inst = mem[off] | mem[off + 1] << 8;
+        uint64_t pc = DRAM_BASE + off;
+        if (RVC_IS_COMPRESSED(inst)) {
+            isa_disasm(buf, sizeof(buf), pc, rvc_decode(inst));
+            printf("%8lx:     %04x  %s\n", pc, inst, buf);
+            off += 2;
+            continue;
+        }
+        if (off + 4 > len)
+            break;
+        inst |= (mem[off + 2] | mem[off + 3] << 8) << 16;
+        isa_disasm(buf, sizeof(buf), pc, inst);
+        printf("%8lx: %08x  %s\n", pc, inst, buf);
+        off += 4;
+    }
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2) {
-        printf("Usage: rvemu <filename>\n");
+    char *disk = NULL;
+    char *net = NULL;
+    char *cache_spec = NULL;
+    char *elf = NULL;
+    char *fuzz = NULL;
+    char *gdb = NULL;
+    char *replay = NULL;
+    char *stats = NULL;
+    char *watches[WATCH_MAX];
+    int nwatches = 0;
+    char *timing_spec = NULL;
+    int disasm = 0;
+    int semihosting = 0;
+    int tiers = 1;
+    uint64_t fast = 0, detail = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bc:d:f:g:Hj:n:r:s:St:w:y:")) != -1) {
+        switch (opt) {
+        case 'b':
+            tiers = 0;  // decoded blocks only, no background translation
+            break;
+        case 'c':
+            cache_spec = optarg;
+            break;
+        case 'd':
+            disk = optarg;
+            break;
+        case 'f':
+            fuzz = optarg;  // run test cases from stdin, read to <addr>
+            break;
+        case 'g':
+            gdb = optarg;  // wait for gdb on <port> or unix:<path>
+            break;
+        case 'H':
+            semihosting = 1;  // give the guest host files
+            break;
+        case 'j':
+            // JSON statistics to <path> or unix:<path>[,seconds]
+            stats = optarg;
+            break;
+        case 'n':
+            net = optarg;
+            break;
+        case 'r':
+            replay = optarg;  // record:<log> or replay:<log>
+            break;
+        case 's':
+            // fast-forward <fast> instructions, then trace <detail>, repeat
+            if (sscanf(optarg, "%lu:%lu", &fast, &detail) != 2 || !fast)
+                optind = argc;
+            break;
+        case 'S':
+            disasm = 1;
+            break;
+        case 't':
+            timing_spec = optarg;
+            break;
+        case 'w':
+            // report stores to <addr>[:len], a physical address
+            if (nwatches < WATCH_MAX)
+                watches[nwatches++] = optarg;
+            else
+                optind = argc;
+            break;
+        case 'y':
+            elf = optarg;  // symbols of the image, for reports
+            break;
+        default:
+            optind = argc;  // print the usage below
+        }
+    }
+    if (argc - optind != 1) {
+        printf("Usage: rvemu [-S] [-b] [-s fast:detail] [-c cache-spec] "
+               "[-t timing-spec] [-y image.elf] [-f input-addr] "
+               "[-g port|unix:<path>] "
+               "[-w addr[:len]]... [-r record|replay:<log>] [-H] "
+               "[-j path|unix:<path>[,seconds]] "
+               "[-d disk.img] [-n loop|unix:<local>:<peer>] <filename>\n");
         exit(1);
     }
 
     // Initialize cpu, registers and program counter
-    CPU cpu;
+    static CPU cpu;
     cpu_init(&cpu);
+    if (virtio_blk_init(&cpu.bus->virtio_blk, disk, &cpu.bus->dram,
+                        &cpu.bus->plic) < 0 ||
+        virtio_net_init(&cpu.bus->virtio_net, net, &cpu.bus->dram,
+                        &cpu.bus->plic) < 0)
+        exit(1);
+    if (replay) {
+        REPLAY *r = replay_open(replay);
+        if (!r)
+            exit(1);
+        if (net || semihosting) {
+            fprintf(stderr, "Record/replay does not cover the network or "
+                            "semihosting\n");
+            exit(1);
+        }
+        replay_attach(r, &cpu);
+    }
+    if (semihosting)
+        cpu.semihost = semihost_create();
+    static SYMBOLS symbols;
+    if (elf && symbols_load(&symbols, elf) < 0)
+        exit(1);
+    if (elf)
+        idiom_set_symbols(&cpu, &symbols);
+    if (cache_spec &&
+        !(cpu.cache = cache_create(cache_spec, elf ? &symbols : NULL)))
+        exit(1);
+    if (timing_spec && !(cpu.timing = timing_create(timing_spec)))
+        exit(1);
     printf("CPU init complete!\n");
     // Read input file
     printf("Reading input file!\n");
-    read_file(&cpu, argv[1]);
+    unsigned long len = read_file(&cpu, argv[optind]);
+    if (disasm) {
+        disassemble(&cpu, len);
+        return 0;
+    }
+    if (fuzz) {
+        if (disk || net || gdb || replay || nwatches || stats) {
+            fprintf(stderr,
+                    "Coverage runs take no -d, -n, -g, -r, -w or -j\n");
+            exit(1);
+        }
+        if (!(cpu.cov = cov_create(&cpu, strtoull(fuzz, NULL, 0))))
+            exit(1);
+        // test cases run untraced unless -s asks for detail windows
+        if (!fast) {
+            fast = UINT64_MAX;
+            detail = 0;
+        }
+    }
+    if (nwatches)
+        cpu.watch = watch_create(&cpu);
+    for (int i = 0; i < nwatches; i++) {
+        char *end;
+        uint64_t addr = strtoull(watches[i], &end, 0);
+        int size = *end == ':' ? atoi(end + 1) : 8;
+        if (watch_add(cpu.watch, addr, size) < 0) {
+            fprintf(stderr, "Bad watchpoint %s\n", watches[i]);
+            exit(1);
+        }
+    }
     
     // cpu loop
     printf("\nCPU execute!\n");
-    while (1) {
-        // fetch
-        uint32_t inst = cpu_fetch(&cpu);
-        // Increment the program counter
-        cpu.pc += 4;
-        // execute
-        if (!cpu_execute(&cpu, inst))
-            break;
-        dump_registers(&cpu);
-        if (cpu.pc == 0)
-            break;
+    // Exceptions longjmp back here with pc at the trap handler. A trap with
+    // no handler installed (tvec == 0) ends the run like a return to 0 does.
+    // Without -s every instruction is traced.
+    static SAMPLE sample;
+    sample_init(&sample, fast, detail);
+    if (gdb) {
+        // the guest starts stopped at its first instruction
+        if (!(cpu.gdb = gdb_create(&cpu, gdb)))
+            exit(1);
+        gdb_stop(&cpu, GDB_SIGTRAP);
     }
+    if (tiers && !cpu.cache && !cpu.timing && !cpu.gdb && !cpu.cov)
+        cpu.tier = tier_create();
+    if (stats) {
+        if (!(cpu.stats = stats_create(stats)))
+            exit(1);
+        stats_add_hart(cpu.stats, &cpu);
+        stats_start(cpu.stats);
+    }
+    // with coverage, one run per test case; under AFL the process forks
+    // and loops here
+    if (cpu.cov)
+        cov_next(&cpu);
+    do {
+        setjmp(cpu.trap_env);
+        sample_run(&cpu, &sample);
+    } while (cpu.cov && cov_next(&cpu));
+    if (cpu.gdb)
+        gdb_exit(&cpu, 0);
 
+    if (!sample.detailed)
+        dump_registers(&cpu);  // the final state, which no trace showed
+    mmu_dump_stats(&cpu);
+    block_dump_stats(&cpu);
+    if (cpu.tier)
+        tier_dump_stats(&cpu);
+    sample_dump_stats(&sample);
+    if (cpu.cache)
+        cache_dump_stats(cpu.cache);
+    if (cpu.timing)
+        timing_dump_stats(cpu.timing);
+    if (cpu.watch)
+        watch_dump_stats(cpu.watch);
+    if (cpu.replay)
+        replay_close(cpu.replay);
+    if (cpu.cov)
+        cov_dump_stats(cpu.cov);
+    if (cpu.stats)
+        stats_close(cpu.stats);
+    if (cpu.semihost) {
+        semihost_dump_stats(cpu.semihost);
+        return cpu.semihost->status;
+    }
     // printf("hello world\n");
     return 0;
 }
\ No newline at end of file
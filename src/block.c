@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "gdb.h"
+#include "isa.h"
+#include "rvc.h"
+#include "tier.h"
+
+void block_init(CPU *cpu)
+{
+    cpu->bcache.blocks = calloc(BLOCK_CACHE_SIZE, sizeof(BLOCK));
+    if (!cpu->bcache.blocks) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    cpu->bcache.funcs = (IDIOM_FUNCS){BLOCK_INVALID, BLOCK_INVALID,
+                                      BLOCK_INVALID};
+    cpu->bcache.running = NULL;
+    block_flush(cpu);
+}
+
+static void block_unlink(CPU *cpu, BLOCK *block)
+{
+    if (block->page < 0)
+        return;
+    if (block->page_prev)
+        block->page_prev->page_next = block->page_next;
+    else
+        cpu->bcache.page_blocks[block->page] = block->page_next;
+    if (block->page_next)
+        block->page_next->page_prev = block->page_prev;
+    block->page = -1;
+}
+
+static void block_link(CPU *cpu, BLOCK *block, uint64_t page)
+{
+    DRAM *dram = &cpu->bus->dram;
+
+    block->page = page;
+    block->page_prev = NULL;
+    block->page_next = cpu->bcache.page_blocks[page];
+    if (block->page_next)
+        block->page_next->page_prev = block;
+    cpu->bcache.page_blocks[page] = block;
+    dram_mark_page(dram, dram->code_map, page, 1);
+}
+
+// fetch, expand and decode the instruction at addr
+static void block_decode(CPU *cpu, BLOCK_INSN *in, uint64_t addr)
+{
+    uint32_t inst = cpu_fetch(cpu, addr);
+
+    if (RVC_IS_COMPRESSED(inst)) {
+        uint32_t expanded = rvc_decode(inst & 0xffff);
+        in->inst = expanded ? expanded : inst & 0xffff;
+        in->id = expanded ? isa_decode(expanded) : ISA_ILLEGAL;
+        in->len = 2;
+    } else {
+        in->inst = inst;
+        in->id = isa_decode(inst);
+        in->len = 4;
+    }
+    in->exec = isa_exec[in->id];
+}
+
+// the decode step: decode until the block has to end
+static void block_translate(CPU *cpu, BLOCK *block, uint64_t pc)
+{
+    uint64_t addr = pc;
+    int n = 0;
+    int end;
+
+    block_unlink(cpu, block);
+    // ops of the old translation are stale, including any the worker is
+    // still to publish
+    __atomic_store_n(&block->gen, block->gen + 1, __ATOMIC_RELAXED);
+    free(__atomic_exchange_n(&block->ops, NULL, __ATOMIC_ACQUIRE));
+    block->heat = 0;
+    block->pc = BLOCK_INVALID;  // until complete, a fetch fault may unwind
+    cpu->inst_pc = pc;          // and is reported at the block entry
+    do {
+        BLOCK_INSN *in = &block->insn[n++];
+
+        block_decode(cpu, in, addr);
+        if (cpu->gdb && gdb_breakpoint_at(cpu->gdb, addr)) {
+            // the block ends with a stop into the debugger
+            in->exec = gdb_exec_breakpoint;
+            in->id = ISA_EBREAK;
+        }
+        addr += in->len;
+        end = isa_info[in->id].cls >= CLASS_BRANCH || n == BLOCK_MAX_INSNS ||
+              PAGE_OFFSET(addr) == 0 || PAGE_OFFSET(addr) == PAGE_SIZE - 2;
+    } while (!end);
+
+    block->n = n;
+    block->ctx = cpu->mmu.ctx_fetch;
+    block->bytes = addr - pc;
+    block->cov_loc = cov_location(pc);
+    idiom_match(cpu, block, pc);
+
+    // cache the block only if its code is in one RAM page that stores will
+    // find it by; otherwise it stays untagged and runs just this once
+    TLB_ENTRY *e = &cpu->mmu.itlb[TLB_INDEX(pc)];
+    uint64_t page = DRAM_PAGE(e->paddr);
+
+    block->paddr = e->paddr | PAGE_OFFSET(pc);
+
+    if (!e->addend || PAGE_OFFSET(pc) + block->insn[0].len > PAGE_SIZE)
+        return;
+    if (cpu->bcache.page_smc[page] >= BLOCK_SMC_LIMIT) {
+        // interpreted until the window of its count has passed
+        if (cpu->instret - cpu->bcache.page_smc_start[page] < BLOCK_SMC_WINDOW)
+            return;
+        cpu->bcache.page_smc[page] = 0;
+    }
+    block_link(cpu, block, page);
+    block->pc = pc;
+}
+
+BLOCK *block_lookup(CPU *cpu, uint64_t pc)
+{
+    BLOCK *block = &cpu->bcache.blocks[BLOCK_INDEX(pc)];
+
+    if (block->pc == pc && block->ctx == cpu->mmu.ctx_fetch) {
+        cpu->bcache.hits++;
+    } else {
+        cpu->bcache.misses++;
+        block_translate(cpu, block, pc);
+    }
+    return block;
+}
+
+// block_execute with each op handed to the timing model after it runs
+static void block_execute_timed(CPU *cpu, BLOCK *block, uint64_t pc)
+{
+    for (int i = 0; i < block->n; i++) {
+        BLOCK_INSN *in = &block->insn[i];
+        cpu->regs[0] = 0;  // x0 hardwired to 0 at each cycle
+        cpu->inst_pc = pc;
+        pc += in->len;
+        cpu->pc = pc;
+        in->exec(cpu, in->inst);
+        cpu->instret++;
+        timing_op(cpu->timing, cpu, in, cpu->inst_pc);
+    }
+}
+
+static void block_run(CPU *cpu, BLOCK *block)
+{
+    uint64_t pc = cpu->pc;
+
+    cpu->poll_budget -= block->n;
+    if (cpu->cov)
+        cov_edge(cpu->cov, block->cov_loc);
+    if (cpu->cache)
+        cache_access(cpu->cache, pc, block->paddr, block->bytes, CACHE_FETCH);
+    if (block->idiom.kind && idiom_run(cpu, block))
+        return;
+    if (cpu->tier) {
+        TIER_OPS *ops = __atomic_load_n(&block->ops, __ATOMIC_ACQUIRE);
+        if (ops && ops->gen == block->gen) {
+            tier_run(cpu, block, ops);
+            return;
+        }
+        if (++block->heat == TIER_HOT)
+            tier_submit(cpu, block);
+    }
+    if (cpu->timing) {
+        block_execute_timed(cpu, block, pc);
+        return;
+    }
+    // only the last instruction can redirect pc; a store into the block's
+    // own page zeroes n and ends it early
+    for (int i = 0; i < block->n; i++) {
+        BLOCK_INSN *in = &block->insn[i];
+        cpu->regs[0] = 0;  // x0 hardwired to 0 at each cycle
+        cpu->inst_pc = pc;
+        pc += in->len;
+        cpu->pc = pc;
+        in->exec(cpu, in->inst);
+        cpu->instret++;
+    }
+}
+
+void block_execute(CPU *cpu, BLOCK *block)
+{
+    cpu->bcache.running = block;
+    block_run(cpu, block);
+    cpu->bcache.running = NULL;
+}
+
+void block_step(CPU *cpu)
+{
+    BLOCK_INSN in;
+    uint64_t pc = cpu->pc;
+
+    cpu->inst_pc = pc;
+    block_decode(cpu, &in, pc);
+    cpu->regs[0] = 0;  // x0 hardwired to 0 at each cycle
+    cpu->pc = pc + in.len;
+    in.exec(cpu, in.inst);
+    cpu->instret++;
+    if (cpu->timing)
+        timing_op(cpu->timing, cpu, &in, pc);
+}
+
+void block_flush(CPU *cpu)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        cpu->bcache.blocks[i].pc = BLOCK_INVALID;
+        cpu->bcache.blocks[i].page = -1;
+    }
+    memset(cpu->bcache.page_blocks, 0, sizeof(cpu->bcache.page_blocks));
+    memset(cpu->bus->dram.code_map, 0, sizeof(cpu->bus->dram.code_map));
+    memcpy(cpu->bus->dram.write_map, cpu->bus->dram.watch_map,
+           sizeof(cpu->bus->dram.write_map));
+}
+
+// drop the blocks of one page, leaving the page's SMC count alone
+static void block_drop_page(CPU *cpu, uint64_t page)
+{
+    DRAM *dram = &cpu->bus->dram;
+    BLOCK *block;
+
+    while ((block = cpu->bcache.page_blocks[page])) {
+        block->pc = BLOCK_INVALID;
+        block->n = 0;
+        block_unlink(cpu, block);
+    }
+    dram_mark_page(dram, dram->code_map, page, 0);
+}
+
+void block_invalidate_code(CPU *cpu, uint64_t paddr, uint64_t len)
+{
+    DRAM *dram = &cpu->bus->dram;
+    uint64_t page = DRAM_PAGE(paddr);
+    BLOCK *block, *next;
+    int dropped = 0;
+
+    // a store to data beside the code leaves the blocks and the count alone
+    for (block = cpu->bcache.page_blocks[page]; block; block = next) {
+        next = block->page_next;
+        if (paddr < block->paddr + block->bytes &&
+            block->paddr < paddr + len) {
+            block->pc = BLOCK_INVALID;
+            block->n = 0;
+            block_unlink(cpu, block);
+            dropped++;
+        }
+    }
+    if (!dropped)
+        return;
+    if (!cpu->bcache.page_blocks[page])
+        dram_mark_page(dram, dram->code_map, page, 0);
+    // the count covers one window of instructions, from its first store
+    if (!cpu->bcache.page_smc[page] ||
+        cpu->instret - cpu->bcache.page_smc_start[page] >= BLOCK_SMC_WINDOW) {
+        cpu->bcache.page_smc[page] = 0;
+        cpu->bcache.page_smc_start[page] = cpu->instret;
+    }
+    cpu->bcache.page_smc[page]++;
+    cpu->bcache.invalidations++;
+}
+
+void block_invalidate_pc(CPU *cpu, uint64_t pc)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        BLOCK *block = &cpu->bcache.blocks[i];
+        if (block->pc != BLOCK_INVALID && pc >= block->pc &&
+            pc < block->pc + block->bytes) {
+            block->pc = BLOCK_INVALID;
+            block->n = 0;
+            block_unlink(cpu, block);
+        }
+    }
+}
+
+void block_stop(CPU *cpu)
+{
+    BLOCK *block = cpu->bcache.running;
+
+    if (!block)
+        return;
+    block->pc = BLOCK_INVALID;
+    block->n = 0;
+    block_unlink(cpu, block);
+}
+
+void block_fence_i(CPU *cpu)
+{
+    DRAM *dram = &cpu->bus->dram;
+
+    for (int i = 0; i < DRAM_PAGES / 64; i++) {
+        uint64_t map =
+            __atomic_exchange_n(&dram->dma_map[i], 0, __ATOMIC_ACQUIRE);
+        for (map &= dram->code_map[i]; map; map &= map - 1)
+            block_drop_page(cpu, i * 64 + __builtin_ctzll(map));
+    }
+}
+
+void block_dump_stats(CPU *cpu)
+{
+    fprintf(stderr, "Blocks: %lu hits, %lu misses, %lu invalidated by stores\n",
+            cpu->bcache.hits, cpu->bcache.misses, cpu->bcache.invalidations);
+    if (cpu->bcache.idiom_iterations || cpu->bcache.idiom_calls)
+        fprintf(stderr, "Idioms: %lu loop iterations, %lu calls run in bulk\n",
+                cpu->bcache.idiom_iterations, cpu->bcache.idiom_calls);
+}
@@ -1,11 +1,51 @@
 #include "bus.h"
 
+#define IN_RANGE(addr, base, size) ((addr) >= (base) && (addr) < (base) + (size))
+
+void bus_init(BUS *bus)
+{
+    dram_init(&(bus->dram));
+    clint_init(&(bus->clint));
+    plic_init(&(bus->plic));
+    virtio_blk_init(&(bus->virtio_blk), NULL, &(bus->dram), &(bus->plic));
+    virtio_net_init(&(bus->virtio_net), NULL, &(bus->dram), &(bus->plic));
+}
+
+int bus_has_device(BUS *bus, uint64_t addr)
+{
+    return IN_RANGE(addr, VIRTIO_BLK_BASE, VIRTIO_MMIO_SIZE) ||
+           IN_RANGE(addr, VIRTIO_NET_BASE, VIRTIO_MMIO_SIZE) ||
+           IN_RANGE(addr, PLIC_BASE, PLIC_SIZE) ||
+           IN_RANGE(addr, CLINT_BASE, CLINT_SIZE);
+}
+
 uint64_t bus_load(BUS *bus, uint64_t addr, uint64_t size)
 {
-    return dram_load(&(bus->dram), addr, size);
+    // one compare for both ends: dram_host would wrap an address past the
+    // window back onto RAM, so those are a hole like any other
+    if (addr - DRAM_BASE < DRAM_WINDOW)
+        return dram_load(&(bus->dram), addr, size);
+    if (IN_RANGE(addr, VIRTIO_BLK_BASE, VIRTIO_MMIO_SIZE))
+        return virtio_blk_load(&(bus->virtio_blk), addr, size);
+    if (IN_RANGE(addr, VIRTIO_NET_BASE, VIRTIO_MMIO_SIZE))
+        return virtio_net_load(&(bus->virtio_net), addr, size);
+    if (IN_RANGE(addr, PLIC_BASE, PLIC_SIZE))
+        return plic_load(&(bus->plic), addr, size);
+    if (IN_RANGE(addr, CLINT_BASE, CLINT_SIZE))
+        return clint_load(&(bus->clint), addr, size);
+    return 0;
 }
 
 void bus_store(BUS *bus, uint64_t addr, uint64_t size, uint64_t value)
 {
-    dram_store(&(bus->dram), addr, size, value);
+    if (addr - DRAM_BASE < DRAM_WINDOW)
+        dram_store(&(bus->dram), addr, size, value);
+    else if (IN_RANGE(addr, VIRTIO_BLK_BASE, VIRTIO_MMIO_SIZE))
+        virtio_blk_store(&(bus->virtio_blk), addr, size, value);
+    else if (IN_RANGE(addr, VIRTIO_NET_BASE, VIRTIO_MMIO_SIZE))
+        virtio_net_store(&(bus->virtio_net), addr, size, value);
+    else if (IN_RANGE(addr, PLIC_BASE, PLIC_SIZE))
+        plic_store(&(bus->plic), addr, size, value);
+    else if (IN_RANGE(addr, CLINT_BASE, CLINT_SIZE))
+        clint_store(&(bus->clint), addr, size, value);
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "cache.h"
+
+static const char *level_name[CACHE_LEVELS] = {"L1I", "L1D", "L2"};
+static const char *policy_name[] = {"lru", "fifo", "random"};
+
+static int cache_level_init(CACHE_LEVEL *c)
+{
+    if (c->line < 4 || (c->line & (c->line - 1)) || c->ways == 0 ||
+        c->size % (c->ways * c->line))
+        return -1;
+    c->sets = c->size / (c->ways * c->line);
+    if (c->sets == 0 || (c->sets & (c->sets - 1)))
+        return -1;
+    c->line_shift = __builtin_ctz(c->line);
+    c->tags = malloc(c->sets * c->ways * sizeof(uint64_t));
+    c->stamp = calloc(c->sets * c->ways, sizeof(uint64_t));
+    if (!c->tags || !c->stamp) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    memset(c->tags, 0xff, c->sets * c->ways * sizeof(uint64_t));
+    return 0;
+}
+
+// "size[:ways[:line[:policy]]]", size with an optional k or m suffix
+static int cache_parse_level(CACHE_LEVEL *c, char *s)
+{
+    char *end;
+
+    c->size = strtoul(s, &end, 0);
+    if (*end == 'k' || *end == 'K')
+        c->size <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        c->size <<= 20, end++;
+    if (*end == ':')
+        c->ways = strtoul(end + 1, &end, 0);
+    if (*end == ':')
+        c->line = strtoul(end + 1, &end, 0);
+    if (*end == ':') {
+        end++;
+        for (c->policy = 0; c->policy <= CACHE_RANDOM; c->policy++)
+            if (!strcmp(end, policy_name[c->policy]))
+                break;
+        if (c->policy > CACHE_RANDOM)
+            return -1;
+        end += strlen(end);
+    }
+    return *end ? -1 : 0;
+}
+
+CACHE_SIM *cache_create(const char *spec, SYMBOLS *symbols)
+{
+    CACHE_SIM *cache = calloc(1, sizeof(CACHE_SIM));
+    char *copy = strdup(spec);
+    char *save, *tok;
+
+    if (!cache || !copy) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    for (int i = 0; i < CACHE_LEVELS; i++)
+        cache->level[i] = (CACHE_LEVEL){
+            .size = i == CACHE_L2 ? 256 << 10 : 32 << 10, .ways = 8,
+            .line = 64, .policy = CACHE_LRU};
+    cache->symbols = symbols;
+
+    for (tok = strtok_r(copy, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        int i;
+
+        if (!strcmp(tok, "default"))
+            continue;
+        if (!eq)
+            goto bad;
+        *eq = '\0';
+        for (i = 0; i < CACHE_LEVELS; i++)
+            if (!strcasecmp(tok, level_name[i]))
+                break;
+        if (i == CACHE_LEVELS || cache_parse_level(&cache->level[i], eq + 1))
+            goto bad;
+    }
+    for (int i = 0; i < CACHE_LEVELS; i++)
+        if (cache_level_init(&cache->level[i]) < 0)
+            goto bad;
+    free(copy);
+    return cache;
+
+bad:
+    fprintf(stderr, "Bad cache configuration %s\n", spec);
+    free(copy);
+    return NULL;
+}
+
+// look up one line, filling it on a miss; returns whether it hit
+static int cache_lookup(CACHE_LEVEL *c, uint64_t line)
+{
+    uint64_t *tags = &c->tags[(line & (c->sets - 1)) * c->ways];
+    uint64_t *stamp = &c->stamp[(line & (c->sets - 1)) * c->ways];
+    int victim = 0;
+
+    c->clock++;
+    for (int w = 0; w < c->ways; w++) {
+        if (tags[w] == line) {
+            if (c->policy == CACHE_LRU)
+                stamp[w] = c->clock;
+            c->hits++;
+            return 1;
+        }
+        if (stamp[w] < stamp[victim])
+            victim = w;  // the oldest, or a way never filled
+    }
+    if (c->policy == CACHE_RANDOM && stamp[victim])
+        victim = (c->clock * 0x9e3779b97f4a7c15ULL >> 32) % c->ways;
+    tags[victim] = line;
+    stamp[victim] = c->clock;
+    c->misses++;
+    return 0;
+}
+
+static void cache_miss(CACHE_SIM *cache, uint64_t pc, int level)
+{
+    uint32_t mask = (1 << CACHE_PC_BITS) - 1;
+    uint32_t h = (uint32_t) (pc >> 1) * 0x9e3779b1u >> (32 - CACHE_PC_BITS);
+
+    for (int i = 0; i < 16; i++) {
+        CACHE_PC *e = &cache->pcs[(h + i) & mask];
+        if (e->pc == pc || !e->pc) {
+            e->pc = pc;
+            e->misses[level]++;
+            return;
+        }
+    }
+    cache->untracked[level]++;
+}
+
+void cache_drain(CACHE_SIM *cache)
+{
+    CACHE_LEVEL *l2 = &cache->level[CACHE_L2];
+
+    for (int i = 0; i < cache->n; i++) {
+        CACHE_REF *r = &cache->buf[i];
+        int l = r->type == CACHE_FETCH ? CACHE_L1I : CACHE_L1D;
+        CACHE_LEVEL *l1 = &cache->level[l];
+        uint64_t first = r->addr >> l1->line_shift;
+        uint64_t last = (r->addr + r->size - 1) >> l1->line_shift;
+
+        for (uint64_t line = first; line <= last; line++) {
+            uint64_t start = line << l1->line_shift;
+            uint64_t pc = r->pc;
+
+            if (r->type == CACHE_FETCH && line > first)
+                pc += start - r->addr;  // the first instruction in the line
+            if (cache_lookup(l1, line))
+                continue;
+            cache_miss(cache, pc, l);
+            for (uint64_t a = start; a < start + l1->line; a += l2->line)
+                if (!cache_lookup(l2, a >> l2->line_shift))
+                    cache_miss(cache, pc, CACHE_L2);
+        }
+    }
+    cache->n = 0;
+}
+
+// ---------- Report ----------
+typedef struct CACHE_ROW {
+    const char *name;  // symbol name, or NULL for a pc row
+    uint64_t pc;
+    uint64_t misses[CACHE_LEVELS];
+} CACHE_ROW;
+
+static uint64_t row_total(const CACHE_ROW *r)
+{
+    return r->misses[CACHE_L1I] + r->misses[CACHE_L1D] + r->misses[CACHE_L2];
+}
+
+static int row_cmp(const void *a, const void *b)
+{
+    uint64_t x = row_total(a), y = row_total(b);
+    return x > y ? -1 : x < y;
+}
+
+static void cache_print_rows(CACHE_SIM *cache, CACHE_ROW *rows, int n,
+                             const char *title)
+{
+    char sym[64], where[96];
+
+    qsort(rows, n, sizeof(CACHE_ROW), row_cmp);
+    fprintf(stderr, "Cache misses by %s (L1I, L1D, L2):\n", title);
+    for (int i = 0; i < n && i < CACHE_REPORT_TOP; i++) {
+        if (rows[i].name) {
+            snprintf(where, sizeof(where), "%s", rows[i].name);
+        } else if (cache->symbols) {
+            symbols_format(cache->symbols, rows[i].pc, sym, sizeof(sym));
+            snprintf(where, sizeof(where), "%#lx %s", rows[i].pc, sym);
+        } else {
+            snprintf(where, sizeof(where), "%#lx", rows[i].pc);
+        }
+        fprintf(stderr, "    %-36s %lu, %lu, %lu\n", where,
+                rows[i].misses[CACHE_L1I], rows[i].misses[CACHE_L1D],
+                rows[i].misses[CACHE_L2]);
+    }
+}
+
+void cache_dump_stats(CACHE_SIM *cache)
+{
+    int size = 1 << CACHE_PC_BITS;
+    CACHE_ROW *rows = calloc(size, sizeof(CACHE_ROW));
+    int n = 0;
+
+    cache_drain(cache);
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        CACHE_LEVEL *c = &cache->level[i];
+        uint64_t total = c->hits + c->misses;
+        fprintf(stderr,
+                "%s: %lu hits, %lu misses, %.2f%% hit rate "
+                "(%uk, %u-way, %u-byte lines, %s)\n",
+                level_name[i], c->hits, c->misses,
+                total ? 100.0 * c->hits / total : 0.0, c->size >> 10, c->ways,
+                c->line, policy_name[c->policy]);
+    }
+    if (!rows)
+        return;
+    for (int i = 0; i < size; i++)
+        if (cache->pcs[i].pc)
+            rows[n++] = (CACHE_ROW){NULL, cache->pcs[i].pc,
+                                    {cache->pcs[i].misses[0],
+                                     cache->pcs[i].misses[1],
+                                     cache->pcs[i].misses[2]}};
+    cache_print_rows(cache, rows, n, "pc");
+    if (cache->untracked[0] + cache->untracked[1] + cache->untracked[2])
+        fprintf(stderr, "    (untracked pcs: %lu, %lu, %lu)\n",
+                cache->untracked[0], cache->untracked[1],
+                cache->untracked[2]);
+
+    if (cache->symbols && cache->symbols->count) {
+        // fold the pc rows into one row per symbol
+        CACHE_ROW *syms = calloc(cache->symbols->count, sizeof(CACHE_ROW));
+        int m = 0;
+
+        for (int i = 0; syms && i < n; i++) {
+            const SYMBOL *s = symbols_lookup(cache->symbols, rows[i].pc);
+            if (!s)
+                continue;
+            CACHE_ROW *r = &syms[s - cache->symbols->syms];
+            r->name = s->name;
+            for (int l = 0; l < CACHE_LEVELS; l++)
+                r->misses[l] += rows[i].misses[l];
+        }
+        for (int i = 0; syms && i < cache->symbols->count; i++)
+            if (syms[i].name)
+                syms[m++] = syms[i];
+        if (syms)
+            cache_print_rows(cache, syms, m, "symbol");
+        free(syms);
+    }
+    free(rows);
+}
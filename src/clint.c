@@ -0,0 +1,74 @@
+#include "clint.h"
+#include "replay.h"
+
+static uint64_t host_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * CLINT_FREQ +
+           (uint64_t) ts.tv_nsec / (1000000000 / CLINT_FREQ);
+}
+
+void clint_init(CLINT *clint)
+{
+    clint->msip = 0;
+    clint->mtimecmp = UINT64_MAX;  // no timer interrupt until programmed
+    clint->mtime_offset = host_ticks();
+    clint->replay = NULL;
+}
+
+uint64_t clint_mtime(CLINT *clint)
+{
+    return host_ticks() - clint->mtime_offset;
+}
+
+uint64_t clint_read_mtime(CLINT *clint)
+{
+    uint64_t mtime = clint_mtime(clint);
+
+    if (clint->replay)
+        mtime = replay_input(clint->replay, REPLAY_TIME, mtime);
+    return mtime;
+}
+
+struct timespec clint_deadline(CLINT *clint)
+{
+    uint64_t ticks = clint->mtimecmp + clint->mtime_offset;
+    struct timespec ts;
+    ts.tv_sec = ticks / CLINT_FREQ;
+    ts.tv_nsec = (ticks % CLINT_FREQ) * (1000000000 / CLINT_FREQ);
+    return ts;
+}
+
+uint64_t clint_load(CLINT *clint, uint64_t addr, uint64_t size)
+{
+    uint64_t offset = addr - CLINT_BASE;
+    uint64_t value;
+
+    if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+        value = clint_read_mtime(clint) >> ((offset - CLINT_MTIME) * 8);
+    } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+        value = clint->mtimecmp >> ((offset - CLINT_MTIMECMP) * 8);
+    } else if (offset == CLINT_MSIP) {
+        value = clint->msip;
+    } else {
+        return 0;
+    }
+    if (size < 64)
+        value &= (1ULL << size) - 1;
+    return value;
+}
+
+void clint_store(CLINT *clint, uint64_t addr, uint64_t size, uint64_t value)
+{
+    uint64_t offset = addr - CLINT_BASE;
+
+    if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+        // a 32-bit store only replaces its half of mtimecmp
+        int shift = (offset - CLINT_MTIMECMP) * 8;
+        uint64_t mask = (size < 64 ? (1ULL << size) - 1 : ~0ULL) << shift;
+        clint->mtimecmp = (clint->mtimecmp & ~mask) | ((value << shift) & mask);
+    } else if (offset == CLINT_MSIP) {
+        clint->msip = value & 0x1;
+    }
+}
@@ -0,0 +1,177 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "cov.h"
+#include "cpu.h"
+
+// the fork server's pipes, by AFL convention
+#define COV_FORKSRV_FD 198
+
+// afl-fuzz looks for this in the binary to run it in persistent mode
+const char cov_persistent_signature[] = "##SIG_AFL_PERSISTENT##";
+
+COV *cov_create(CPU *cpu, uint64_t input)
+{
+    char *shm = getenv("__AFL_SHM_ID");
+    COV *cov;
+
+    if (input < DRAM_BASE || input - DRAM_BASE >= DRAM_SIZE) {
+        fprintf(stderr, "Test case address %#lx is not in RAM\n", input);
+        return NULL;
+    }
+    cov = calloc(1, sizeof(COV));
+    if (!cov) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    cov->cpu = cpu;
+    cov->input = input;
+    if (shm) {
+        cov->map = shmat(atoi(shm), NULL, 0);
+        if (cov->map == (void *) -1) {
+            fprintf(stderr, "Unable to attach the AFL map %s\n", shm);
+            exit(1);
+        }
+    } else if (!(cov->map = calloc(1, COV_MAP_SIZE))) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    return cov;
+}
+
+// Hand test cases to children until AFL closes the control pipe. A child
+// that stopped itself after a test case is resumed for the next one; one
+// that exited, crashed or was killed on a timeout is replaced by a fork.
+static void cov_fork_server(void)
+{
+    pid_t child = -1;
+    int stopped = 0;
+    uint32_t killed;
+    int status = 0;
+
+    for (;;) {
+        if (read(COV_FORKSRV_FD, &killed, 4) != 4)
+            _exit(0);
+        if (stopped && killed) {
+            stopped = 0;
+            if (waitpid(child, &status, 0) < 0)
+                _exit(1);
+        }
+        if (stopped) {
+            kill(child, SIGCONT);
+            stopped = 0;
+        } else if ((child = fork()) < 0) {
+            _exit(1);
+        } else if (!child) {
+            close(COV_FORKSRV_FD);
+            close(COV_FORKSRV_FD + 1);
+            return;
+        }
+        if (write(COV_FORKSRV_FD + 1, &child, 4) != 4 ||
+            waitpid(child, &status, WUNTRACED) < 0)
+            _exit(1);
+        stopped = WIFSTOPPED(status);
+        if (write(COV_FORKSRV_FD + 1, &status, 4) != 4)
+            _exit(1);
+    }
+}
+
+static void cov_snapshot(COV *cov)
+{
+    cov->snapshot = malloc(sizeof(CPU));
+    cov->snapshot_mem = malloc(DRAM_SIZE);
+    if (!cov->snapshot || !cov->snapshot_mem) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    memcpy(cov->snapshot, cov->cpu, sizeof(CPU));
+    memcpy(cov->snapshot_mem, cov->cpu->bus->dram.mem, DRAM_SIZE);
+}
+
+// put the machine back as it was loaded; only the pages the last test case
+// wrote are copied back
+static void cov_restore(COV *cov)
+{
+    CPU *cpu = cov->cpu;
+    CPU *s = cov->snapshot;
+    DRAM *dram = &cpu->bus->dram;
+    int flush = (cpu->csr.satp >> 60) != 0;  // page tables may be restored
+
+    for (uint64_t off = 0; off < DRAM_SIZE; off += 1 << DRAM_PAGE_SHIFT) {
+        if (!memcmp(dram->mem + off, cov->snapshot_mem + off,
+                    1 << DRAM_PAGE_SHIFT))
+            continue;
+        memcpy(dram->mem + off, cov->snapshot_mem + off, 1 << DRAM_PAGE_SHIFT);
+        flush |= dram_is_code(dram, DRAM_BASE + off);
+    }
+    memcpy(cpu->regs, s->regs, sizeof(cpu->regs));
+    memcpy(cpu->fregs, s->fregs, sizeof(cpu->fregs));
+    cpu->vec = s->vec;
+    cpu->csr = s->csr;
+    cpu->pc = s->pc;
+    cpu->instret = s->instret;
+    cpu->poll_budget = s->poll_budget;
+    cpu->priv = s->priv;
+    clint_init(&cpu->bus->clint);
+    plic_reset(&cpu->bus->plic);
+    mmu_flush_all(cpu);
+    mmu_update_ctx(cpu);
+    // bare firmware keeps its translated blocks from one case to the next
+    if (flush)
+        block_flush(cpu);
+}
+
+// read the test case on stdin into guest RAM
+static void cov_load_input(COV *cov)
+{
+    CPU *cpu = cov->cpu;
+    uint8_t *buf = dram_host(&cpu->bus->dram, cov->input);
+    uint64_t room = DRAM_SIZE - (cov->input - DRAM_BASE);
+    uint64_t len = 0;
+    ssize_t n;
+
+    lseek(0, 0, SEEK_SET);  // AFL rewrites the same file for each case
+    while (len < room && (n = read(0, buf + len, room - len)) > 0)
+        len += n;
+    cpu->regs[10] = cov->input;
+    cpu->regs[11] = len;
+    cov->prev = 0;
+}
+
+int cov_next(CPU *cpu)
+{
+    COV *cov = cpu->cov;
+    uint32_t hello = 0;
+
+    if (cov->runs == 0) {
+        cov_snapshot(cov);
+        // an AFL fork server answers the hello on the status pipe
+        cov->afl = write(COV_FORKSRV_FD + 1, &hello, 4) == 4;
+        if (cov->afl)
+            cov_fork_server();
+    } else {
+        if (!cov->afl || cov->runs == COV_RUNS)
+            return 0;
+        raise(SIGSTOP);  // the fork server reports the case and resumes us
+        cov_restore(cov);
+    }
+    cov_load_input(cov);
+    cov->runs++;
+    return 1;
+}
+
+void cov_dump_stats(COV *cov)
+{
+    int hit = 0;
+
+    for (int i = 0; i < COV_MAP_SIZE; i++)
+        hit += cov->map[i] != 0;
+    fprintf(stderr, "Coverage: %d of %d map entries hit in %d test cases\n",
+            hit, COV_MAP_SIZE, cov->runs);
+}
@@ -1,13 +1,71 @@
+#define _GNU_SOURCE  // REG_ERR
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <ucontext.h>
 #include <unistd.h>
 
 #include "cpu.h"
+#include "clint.h"
 #include "cpu_exec.h"
-#include "opcode.h"
+#include "isa.h"
+#include "rvc.h"
 
 // ---------- Initialize ----------
+_Static_assert(offsetof(CPU, mmu.itlb) <= offsetof(CPU, regs) + 5 * 64,
+               "hot CPU state spills past five cache lines");
+
+// PLIC context 0 drives the machine, context 1 the supervisor external line
+static void cpu_plic_notify(void *opaque, int context, int level)
+{
+    cpu_set_irq((CPU *) opaque, context ? MIP_SEIP : MIP_MEIP, level);
+}
+
+// a store of len bytes hit a page in the DRAM write map
+static void cpu_tracked_write(CPU *cpu, uint64_t paddr, uint64_t len)
+{
+    if (dram_is_code(&cpu->bus->dram, paddr))
+        block_invalidate_code(cpu, paddr, len);
+    if (cpu->gdb && dram_is_watched(&cpu->bus->dram, paddr))
+        gdb_watch_store(cpu, paddr, len);
+}
+
+static void cpu_dram_write(void *opaque, uint64_t addr, uint64_t len)
+{
+    cpu_tracked_write((CPU *) opaque, addr, len);
+}
+
+static CPU *cpu_hart;  // for the SIGSEGV handler
+static pthread_t cpu_hart_thread;
+
+// A host fault in the reservation around guest RAM. Stores to watched
+// pages go to the watchpoints; an access by the hart past the end of RAM
+// becomes an access fault for the instruction making it. Anything else is
+// a real crash, and faults again with the default action on return.
+static void cpu_host_fault(int sig, siginfo_t *si, void *uctx)
+{
+    CPU *cpu = cpu_hart;
+    DRAM *dram = &cpu->bus->dram;
+    uint8_t *host = si->si_addr;
+    int store = 0;
+
+    if (cpu->watch && watch_fault(cpu->watch, host))
+        return;
+    if (!dram_reserved(dram, host) ||
+        !pthread_equal(pthread_self(), cpu_hart_thread)) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+#ifdef __x86_64__
+    store = (((ucontext_t *) uctx)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+#endif
+    cpu_exception(cpu, store ? EXC_STORE_ACCESS_FAULT : EXC_LOAD_ACCESS_FAULT,
+                  DRAM_BASE + (host - dram->mem));
+}
+
 void cpu_init(CPU *cpu)
 {
     cpu->regs[0] = 0x00;
@@ -15,362 +73,325 @@ void cpu_init(CPU *cpu)
                                            // to the top address of the memory
     cpu->pc =
         DRAM_BASE;  // The program counter points to the start of the memory
+    memset(&cpu->csr, 0, sizeof(cpu->csr));
+    cpu->csr.misa = MISA_XLEN_64 | MISA_EXT('I') | MISA_EXT('M') |
+                    MISA_EXT('F') | MISA_EXT('D') | MISA_EXT('C') |
+                    MISA_EXT('V') | MISA_EXT('B') | MISA_EXT('S') |
+                    MISA_EXT('U');
+    cpu->csr.mstatus = (2ULL << 32) | (2ULL << 34);  // UXL = SXL = 64
+    cpu->priv = PRIV_M;
+    cpu->poll_budget = CPU_POLL_INTERVAL;
+    cpu->poll_now = 0;
+    cpu->instret = 0;
+    cpu->cache = NULL;
+    cpu->timing = NULL;
+    cpu->gdb = NULL;
+    cpu->watch = NULL;
+    cpu->replay = NULL;
+    cpu->cov = NULL;
+    cpu->semihost = NULL;
+    cpu->stats = NULL;
+    cpu->tier = NULL;
+    // the bus holds DRAM, so it stays out of the CPU's cache lines
+    // aligned for the device counters kept on cache lines of their own
+    cpu->bus = aligned_alloc(64, sizeof(BUS));
+    if (!cpu->bus) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    memset(cpu->bus, 0, sizeof(BUS));
+    bus_init(cpu->bus);
+    mmu_init(cpu);
+    block_init(cpu);
+    fpu_init(cpu);
+    vector_init(cpu);
+    cpu->bus->plic.notify = cpu_plic_notify;
+    cpu->bus->plic.opaque = cpu;
+    cpu->bus->dram.tracked_write = cpu_dram_write;
+    cpu->bus->dram.opaque = cpu;
+
+    // WFI deadlines come from mtime, which follows CLOCK_MONOTONIC
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cpu->wfi_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&cpu->wfi_lock, NULL);
+
+    // NODEFER: an access fault longjmps out of the handler
+    struct sigaction sa = {.sa_sigaction = cpu_host_fault,
+                           .sa_flags = SA_SIGINFO | SA_NODEFER};
+    cpu_hart = cpu;
+    cpu_hart_thread = pthread_self();
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
 }
 
-uint32_t cpu_fetch(CPU *cpu)
+// ---------- Interrupts ----------
+void cpu_set_irq(CPU *cpu, uint64_t mask, int level)
 {
-    return bus_load(&(cpu->bus), cpu->pc, 32);
+    pthread_mutex_lock(&cpu->wfi_lock);
+    if (level)
+        __atomic_fetch_or(&cpu->csr.mip, mask, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&cpu->csr.mip, ~mask, __ATOMIC_RELAXED);
+    cpu_request_poll(cpu);  // let the dispatcher take it right away
+    pthread_cond_signal(&cpu->wfi_cond);
+    pthread_mutex_unlock(&cpu->wfi_lock);
 }
 
-uint64_t cpu_load(CPU *cpu, uint64_t addr, uint64_t size)
+void cpu_request_poll(CPU *cpu)
 {
-    return bus_load(&(cpu->bus), addr, size);
+    __atomic_store_n(&cpu->poll_now, 1, __ATOMIC_RELEASE);
 }
 
-void cpu_store(CPU *cpu, uint64_t addr, uint64_t size, uint64_t value)
+uint64_t cpu_mip_live(CPU *cpu)
 {
-    bus_store(&(cpu->bus), addr, size, value);
+    CLINT *clint = &(cpu->bus->clint);
+    uint64_t mip = __atomic_load_n(&cpu->csr.mip, __ATOMIC_RELAXED);
+
+    mip &= ~(MIP_MTIP | MIP_MSIP);
+    if (clint_mtime(clint) >= clint->mtimecmp)
+        mip |= MIP_MTIP;
+    if (clint->msip)
+        mip |= MIP_MSIP;
+    return mip;
 }
 
-int cpu_execute(CPU *cpu, uint32_t inst)
+uint64_t cpu_mip(CPU *cpu)
 {
-    int opcode = inst & 0x7f;          // opcode in bits 6..0
-    int funct3 = (inst >> 12) & 0x7;   // funct3 in bits 14..12
-    int funct7 = (inst >> 25) & 0x7f;  // funct7 in bits 31..25
+    uint64_t mip = cpu_mip_live(cpu);
 
-    cpu->regs[0] = 0;  // x0 hardwired to 0 at each cycle
+    // under record/replay the guest sees them change only at polls
+    if (cpu->replay)
+        mip = (mip & ~REPLAY_ASYNC_MIP) | cpu->replay->mip;
+    return mip;
+}
 
-    // If cpu get I Type opcode:
-    switch (opcode) {
-    case R_TYPE:
-        switch (funct3) {
-        case ADDSUB:
-            switch (funct7) {
-            case ADD:
-                exec_ADD(cpu, inst);  // finish
-                break;
-            case SUB:
-                exec_ADD(cpu, inst);  // finish
-                break;
-            default:
-                break;
-            }
-        case SLL:
-            exec_SLL(cpu, inst);  // finish
-            break;
-        case SLT:
-            exec_SLT(cpu, inst);  // finish
-            break;
-        case SLTU:
-            exec_SLTU(cpu, inst);  // finish
-            break;
-        case XOR:
-            exec_XOR(cpu, inst);  // finish
-            break;
-        case SR:
-            switch (funct7) {
-            case SRL:
-                exec_SRL(cpu, inst);  // finish
-                break;
-            case SRA:
-                exec_SRA(cpu, inst);  // finish
-                break;
-            default:;
-            }
-            break;
-        case OR:
-            exec_OR(cpu, inst);  // finish
-            break;
-        case AND:
-            exec_AND(cpu, inst);  // finish
-            break;
-        default:
-            fprintf(stderr,
-                    "[-]R_TYPE ERROR-> opcode:0x%x, funct3:0x%x, funct7:0x%x\n",
-                    opcode, funct3, funct7);
-            return 0;
-        }
-        break;
+int cpu_interrupt_pending(CPU *cpu)
+{
+    return (cpu_mip_live(cpu) & cpu->csr.mie) != 0;
+}
 
-    case R_TYPE_64:
-        switch (funct3) {
-        case ADDSUB:
-            switch (funct7) {
-            case ADDW:
-                exec_ADDW(cpu, inst);  // finish
-                break;
-            case SUBW:
-                exec_SUBW(cpu, inst);  // finish
-                break;
-            case MULW:
-                exec_MULW(cpu, inst);  // finish
-                break;
-            }
-            break;
-        case DIVW:
-            exec_DIVW(cpu, inst);  // finish
-            break;
-        case SLLW:
-            exec_SLLW(cpu, inst);  // finish
-            break;
-        case SRW:
-            switch (funct7) {
-            case SRLW:
-                exec_SRLW(cpu, inst);  // finish
-                break;
-            case SRAW:
-                exec_SRAW(cpu, inst);  // finish
-                break;
-            case DIVUW:
-                exec_DIVUW(cpu, inst);  // finish
-                break;
-            }
-            break;
-        case REMW:
-            exec_REMW(cpu, inst);  // finish
-            break;
-        case REMUW:
-            exec_REMUW(cpu, inst);  // finish
-            break;
-        default:;
-        }
-        break;
+#define CPU_WFI_SLICE 10000000  // ns; the longest a debugger waits on WFI
 
-    case I_TYPE:
-        switch (funct3) {
-        case ADDI:
-            exec_ADDI(cpu, inst);  // finish
-            break;
-        case SLLI:
-            exec_SLLI(cpu, inst);  // finish
-            break;
-        case SLTI:
-            exec_SLTI(cpu, inst);  // finish
-            break;
-        case SLTIU:
-            exec_SLTIU(cpu, inst);  // finish
-            break;
-        case XORI:
-            exec_XORI(cpu, inst);  // finish
-            break;
-        case SRI:
-            switch (funct7) {
-            case SRLI:
-                exec_SRLI(cpu, inst);  // finish
-                break;
-            case SRAI:
-                exec_SRAI(cpu, inst);  // finish
-                break;
-            default:;
-            }
-            break;
-        case ORI:
-            exec_ORI(cpu, inst);  // finish
-            break;
-        case ANDI:
-            exec_ANDI(cpu, inst);  // finish
-            break;
-        default:
-            fprintf(stderr,
-                    "[-]I_TYPE ERROR-> opcode:0x%x, funct3:0x%x, funct7:0x%x\n",
-                    opcode, funct3, funct7);
-            return 0;
-        }
-        break;
+// the end of one wait in WFI: the timer's deadline, cut short with a
+// debugger attached, whose SIGIO handler cannot signal wfi_cond and only
+// requests a poll
+static struct timespec cpu_wfi_deadline(CPU *cpu, int timer)
+{
+    struct timespec slice, deadline = clint_deadline(&cpu->bus->clint);
 
-    case I_TYPE_64:
-        switch (funct3) {
-        case ADDIW:
-            exec_ADDIW(cpu, inst);  // finish
-            break;
-        case SLLIW:
-            exec_SLLIW(cpu, inst);  // finish
-            break;
-        case SRIW:
-            switch (funct7) {
-            case SRLIW:
-                exec_SRLIW(cpu, inst);  // finish
-                break;
-            case SRAIW:
-                exec_SRAIW(cpu, inst);  // finish
-                break;
-            default:;
-            }
-            break;
-        default:;
-        }
-        break;
+    if (!cpu->gdb)
+        return deadline;
+    clock_gettime(CLOCK_MONOTONIC, &slice);
+    slice.tv_nsec += CPU_WFI_SLICE;
+    if (slice.tv_nsec >= 1000000000) {
+        slice.tv_sec++;
+        slice.tv_nsec -= 1000000000;
+    }
+    if (timer && (deadline.tv_sec < slice.tv_sec ||
+                  (deadline.tv_sec == slice.tv_sec &&
+                   deadline.tv_nsec < slice.tv_nsec)))
+        return deadline;
+    return slice;
+}
 
-    case S_TYPE:
-        switch (funct3) {
-        case SB:
-            exec_SB(cpu, inst);  // finish
-            break;
-        case SH:
-            exec_SH(cpu, inst);  // finish
-            break;
-        case SW:
-            exec_SW(cpu, inst);  // finish
-            break;
-        case SD:
-            exec_SD(cpu, inst);  // finish
-            break;
-        default:;
-        }
-        break;
+// WFI: instead of spinning on the instruction, block the host thread on
+// wfi_cond. Devices wake it through cpu_set_irq(); the timer wakes it by the
+// timeout, which is the host time at which mtime reaches mtimecmp. With no
+// enabled interrupt that could still arrive, WFI is a nop. A poll request
+// (a break from the debugger) ends the wait as well.
+void cpu_wfi(CPU *cpu)
+{
+    CLINT *clint = &(cpu->bus->clint);
+    int timer = (cpu->csr.mie & MIP_MTIP) &&
+                clint->mtimecmp < UINT64_MAX - clint->mtime_offset;
 
-    case LOAD:
-        switch (funct3) {
-        case LB:
-            exec_LB(cpu, inst);  // finish
-            break;
-        case LH:
-            exec_LH(cpu, inst);  // finish
-            break;
-        case LW:
-            exec_LW(cpu, inst);  // finish
-            break;
-        case LD:
-            exec_LD(cpu, inst);  // finish
-            break;
-        case LBU:
-            exec_LBU(cpu, inst);  // finish
-            break;
-        case LHU:
-            exec_LHU(cpu, inst);  // finish
-            break;
-        case LWU:
-            exec_LWU(cpu, inst);  // finish
-            break;
-        default:;
+    if (cpu->replay && cpu->replay->mode == REPLAY_PLAY)
+        return;  // the wake-up is the next mip change in the log
+    if (!timer && !(cpu->csr.mie & (MIP_MEIP | MIP_SEIP)))
+        return;
+    pthread_mutex_lock(&cpu->wfi_lock);
+    while (!cpu_interrupt_pending(cpu) &&
+           !__atomic_load_n(&cpu->poll_now, __ATOMIC_ACQUIRE)) {
+        if (timer || cpu->gdb) {
+            struct timespec deadline = cpu_wfi_deadline(cpu, timer);
+            pthread_cond_timedwait(&cpu->wfi_cond, &cpu->wfi_lock, &deadline);
+        } else {
+            pthread_cond_wait(&cpu->wfi_cond, &cpu->wfi_lock);
         }
-        break;
+    }
+    cpu->poll_budget = 1;
+    pthread_mutex_unlock(&cpu->wfi_lock);
+}
 
-    case B_TYPE:
-        switch (funct3) {
-        case BEQ:
-            exec_BEQ(cpu, inst);  // finish
-            break;
-        case BNE:
-            exec_BNE(cpu, inst);  // finish
-            break;
-        case BLT:
-            exec_BLT(cpu, inst);  // finish
-            break;
-        case BGE:
-            exec_BGE(cpu, inst);  // finish
-            break;
-        case BLTU:
-            exec_BLTU(cpu, inst);  // finish
-            break;
-        case BGEU:
-            exec_BGEU(cpu, inst);  // finish
-            break;
-        default:;
-        }
-        break;
+// ---------- Memory access ----------
+// Every access goes through the TLB. A hit on a RAM page reads or writes the
+// host memory directly; MMIO pages and page-crossing accesses take the bus.
+static inline uint64_t host_load(uintptr_t host, uint64_t size)
+{
+    switch (size) {
+    case 8:
+        return *(uint8_t *) host;
+    case 16:
+        return *(uint16_t *) host;
+    case 32:
+        return *(uint32_t *) host;
+    default:
+        return *(uint64_t *) host;
+    }
+}
 
-    case LUI:
-        exec_LUI(cpu, inst);  // finish
-        break;
-    case AUIPC:
-        exec_AUIPC(cpu, inst);  // finish
+static inline void host_store(uintptr_t host, uint64_t size, uint64_t value)
+{
+    switch (size) {
+    case 8:
+        *(uint8_t *) host = value;
         break;
-
-    case JAL:
-        exec_JAL(cpu, inst);  // finish
+    case 16:
+        *(uint16_t *) host = value;
         break;
-    case JALR:
-        exec_JALR(cpu, inst);  // finish
+    case 32:
+        *(uint32_t *) host = value;
         break;
+    default:
+        *(uint64_t *) host = value;
+    }
+}
 
-    case CSR:
-        switch (funct3) {
-        case ECALLBREAK:
-            exec_ECALLBREAK(cpu, inst);
-            break;
-        case CSRRW:
-            exec_CSRRW(cpu, inst);
-            break;
-        case CSRRS:
-            exec_CSRRS(cpu, inst);
-            break;
-        case CSRRC:
-            exec_CSRRC(cpu, inst);
-            break;
-        case CSRRWI:
-            exec_CSRRWI(cpu, inst);
-            break;
-        case CSRRSI:
-            exec_CSRRSI(cpu, inst);
-            break;
-        case CSRRCI:
-            exec_CSRRCI(cpu, inst);
-            break;
-        default:
-            fprintf(stderr,
-                    "[-]CSR ERROR-> opcode:0x%x, funct3:0x%x, funct7:0x%x\n",
-                    opcode, funct3, funct7);
-            return 0;
-        }
-        break;
+// read a 16- or 32-bit parcel that does not cross a page
+static uint32_t fetch_parcel(CPU *cpu, uint64_t addr, uint64_t size)
+{
+    TLB_ENTRY *e = &cpu->mmu.itlb[TLB_INDEX(addr)];
 
-    case AMO_W:
-        switch (funct7 >> 2) {  // since, funct[1:0] = aq, rl
-        case LR_W:
-            exec_LR_W(cpu, inst);
-            break;
-        case SC_W:
-            exec_SC_W(cpu, inst);
-            break;
-        case AMOSWAP_W:
-            exec_AMOSWAP_W(cpu, inst);
-            break;
-        case AMOADD_W:
-            exec_AMOADD_W(cpu, inst);
-            break;
-        case AMOXOR_W:
-            exec_AMOXOR_W(cpu, inst);
-            break;
-        case AMOAND_W:
-            exec_AMOAND_W(cpu, inst);
-            break;
-        case AMOOR_W:
-            exec_AMOOR_W(cpu, inst);
-            break;
-        case AMOMIN_W:
-            exec_AMOMIN_W(cpu, inst);
-            break;
-        case AMOMAX_W:
-            exec_AMOMAX_W(cpu, inst);
-            break;
-        case AMOMINU_W:
-            exec_AMOMINU_W(cpu, inst);
-            break;
-        case AMOMAXU_W:
-            exec_AMOMAXU_W(cpu, inst);
-            break;
-        default:
-            fprintf(stderr,
-                    "[-]AMO_W ERROR-> opcode:0x%x, funct3:0x%x, funct7:0x%x\n",
-                    opcode, funct3, funct7);
-            return 0;
-        }
-        break;
+    if (e->tag == TLB_TAG(addr, cpu->mmu.ctx_fetch)) {
+        cpu->mmu.itlb_hits++;
+    } else {
+        cpu->mmu.itlb_misses++;
+        e = mmu_fill(cpu, addr, ACCESS_FETCH);
+    }
+    if (e->addend)
+        return host_load(addr + e->addend, size);
+    return bus_load(cpu->bus, e->paddr | PAGE_OFFSET(addr), size);
+}
 
-    case FENCE:
-        exec_FENCE(cpu, inst);
-        break;
+uint32_t cpu_fetch(CPU *cpu, uint64_t addr)
+{
+    uint32_t inst;
 
-    case 0x00:
-        return 0;
+    if (PAGE_OFFSET(addr) == PAGE_SIZE - 2) {
+        // the upper half of a 32-bit instruction is on the next page, which
+        // is translated (and may fault) separately
+        inst = fetch_parcel(cpu, addr, 16);
+        if (!RVC_IS_COMPRESSED(inst))
+            inst |= fetch_parcel(cpu, addr + 2, 16) << 16;
+        return inst;
+    }
+    return fetch_parcel(cpu, addr, 32);
+}
 
-    default:
-        fprintf(stderr, "Undefine Opcode [-] ERROR-> opcode:0x%x, funct3:0x%x, funct3:0x%x\n",
-                opcode, funct3, funct7);
-        return 0;
-        /*exit(1);*/
+uint64_t cpu_load(CPU *cpu, uint64_t addr, uint64_t size)
+{
+    TLB_ENTRY *e = &cpu->mmu.dtlb[TLB_INDEX(addr)];
+
+    if (PAGE_OFFSET(addr) > PAGE_SIZE - size / 8) {
+        // split an access crossing a page into bytes
+        uint64_t value = 0;
+        for (int i = 0; i < size / 8; i++)
+            value |= cpu_load(cpu, addr + i, 8) << (8 * i);
+        return value;
     }
+    if (e->tag == TLB_TAG(addr, cpu->mmu.ctx_data)) {
+        cpu->mmu.dtlb_hits++;
+    } else {
+        cpu->mmu.dtlb_misses++;
+        e = mmu_fill(cpu, addr, ACCESS_LOAD);
+    }
+    if (e->addend) {
+        if (cpu->cache)
+            cache_access(cpu->cache, cpu->inst_pc, e->paddr | PAGE_OFFSET(addr),
+                         size / 8, CACHE_LOAD);
+        return host_load(addr + e->addend, size);
+    }
+    return bus_load(cpu->bus, e->paddr | PAGE_OFFSET(addr), size);
+}
+
+void cpu_store(CPU *cpu, uint64_t addr, uint64_t size, uint64_t value)
+{
+    TLB_ENTRY *e = &cpu->mmu.dtlb[TLB_INDEX(addr)];
+
+    if (PAGE_OFFSET(addr) > PAGE_SIZE - size / 8) {
+        for (int i = 0; i < size / 8; i++)
+            cpu_store(cpu, addr + i, 8, value >> (8 * i));
+        return;
+    }
+    if (e->tag_write == TLB_TAG(addr, cpu->mmu.ctx_data)) {
+        cpu->mmu.dtlb_hits++;
+    } else {
+        cpu->mmu.dtlb_misses++;
+        e = mmu_fill(cpu, addr, ACCESS_STORE);
+    }
+    if (e->addend) {
+        if (cpu->cache)
+            cache_access(cpu->cache, cpu->inst_pc, e->paddr | PAGE_OFFSET(addr),
+                         size / 8, CACHE_STORE);
+        host_store(addr + e->addend, size, value);
+        if (dram_write_tracked(&cpu->bus->dram, e->paddr))
+            cpu_tracked_write(cpu, e->paddr | PAGE_OFFSET(addr), size / 8);
+    } else {
+        bus_store(cpu->bus, e->paddr | PAGE_OFFSET(addr), size, value);
+    }
+}
+
+static void *cpu_ram_lookup(CPU *cpu, uint64_t addr, uint64_t len, int access,
+                           int fill)
+{
+    TLB_ENTRY *e = &cpu->mmu.dtlb[TLB_INDEX(addr)];
+    uint64_t tag = TLB_TAG(addr, cpu->mmu.ctx_data);
+
+    if (len == 0 || PAGE_OFFSET(addr) + len > PAGE_SIZE)
+        return NULL;
+    if ((access == ACCESS_STORE ? e->tag_write : e->tag) == tag) {
+        cpu->mmu.dtlb_hits++;
+    } else if (fill) {
+        cpu->mmu.dtlb_misses++;
+        e = mmu_fill(cpu, addr, access);
+    } else {
+        return NULL;
+    }
+    if (!e->addend)
+        return NULL;
+    if (cpu->cache)
+        cache_access(cpu->cache, cpu->inst_pc, e->paddr | PAGE_OFFSET(addr),
+                     len, access == ACCESS_STORE ? CACHE_STORE : CACHE_LOAD);
+    if (access == ACCESS_STORE && dram_write_tracked(&cpu->bus->dram, e->paddr))
+        cpu_tracked_write(cpu, e->paddr | PAGE_OFFSET(addr), len);
+    return (void *) (addr + e->addend);
+}
+
+void *cpu_ram_ptr(CPU *cpu, uint64_t addr, uint64_t len, int access)
+{
+    return cpu_ram_lookup(cpu, addr, len, access, 1);
+}
+
+void *cpu_ram_peek(CPU *cpu, uint64_t addr, uint64_t len, int access)
+{
+    return cpu_ram_lookup(cpu, addr, len, access, 0);
+}
+
+// ---------- Execute ----------
+void (*const isa_exec[])(CPU *cpu, uint32_t inst) = {
+#define INSN(id, name, mask, match, args, exec, cls) exec_##exec,
+#include "isa.def"
+#undef INSN
+};
+
+int cpu_execute(CPU *cpu, uint32_t inst)
+{
+    cpu->regs[0] = 0;  // x0 hardwired to 0 at each cycle
+    isa_exec[isa_decode(inst)](cpu, inst);
+    return 1;
 }
 
 void dump_registers(CPU *cpu)
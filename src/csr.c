@@ -1,12 +1,268 @@
 #include "../includes/csr.h"
+#include <stddef.h>
 #include <stdint.h>
+#include "cpu.h"
+#include "fpu.h"
+
+// sstatus is a restricted view of mstatus, sie/sip of mie/mip
+#define SSTATUS_MASK                                                       \
+    (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_VS | MSTATUS_FS | \
+     MSTATUS_SUM | MSTATUS_MXR | MSTATUS_UXL | MSTATUS_SD)
+#define MSTATUS_WRITABLE                                                 \
+    (MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE |           \
+     MSTATUS_SPP | MSTATUS_MPP | MSTATUS_VS | MSTATUS_FS | MSTATUS_MPRV | \
+     MSTATUS_SUM | MSTATUS_MXR | MSTATUS_TVM | MSTATUS_TW | MSTATUS_TSR)
+#define MIP_S_BITS (MIP_SSIP | MIP_STIP | MIP_SEIP)
+#define MIP_M_BITS (MIP_MSIP | MIP_MTIP | MIP_MEIP)
+#define MEDELEG_WRITABLE (0xffffULL & ~(1ULL << 11))  // not ECALL from M
+
+// ---------- CSR table ----------
+// Every CSR number maps to a CSR_FILE slot and its access rules; numbers
+// missing from the table are not implemented and raise illegal instruction.
+#define CSR_SLOT(field) (offsetof(CSR_FILE, field) / sizeof(uint64_t))
+#define CSR_RULES(num, flags)                                           \
+    CSR_VALID | (flags) | (((num) >> 10) == 3 ? CSR_READONLY : 0)
+#define CSR(num, slot, flags) \
+    [num] = {(slot), CSR_RULES(num, flags), ((num) >> 8) & 0x3}
+#define CSR_RANGE(first, last, flags) \
+    [first ... last] = {CSR_NO_SLOT, CSR_RULES(first, flags), ((first) >> 8) & 0x3}
+#define CSR_PMPADDR(i) CSR(PMPADDR0 + (i), CSR_SLOT(pmpaddr[i]), 0)
+
+const CSR_INFO csr_table[4096] = {
+    // user
+    CSR(FFLAGS, CSR_NO_SLOT, CSR_FP),
+    CSR(FRM, CSR_SLOT(frm), CSR_FP),
+    CSR(FCSR, CSR_NO_SLOT, CSR_FP),
+    CSR(VSTART, CSR_NO_SLOT, CSR_VEC),
+    CSR(VXSAT, CSR_NO_SLOT, CSR_VEC),
+    CSR(VXRM, CSR_NO_SLOT, CSR_VEC),
+    CSR(VCSR, CSR_NO_SLOT, CSR_VEC),
+    CSR(VL, CSR_NO_SLOT, CSR_VEC),
+    CSR(VTYPE, CSR_NO_SLOT, CSR_VEC),
+    CSR(VLENB_CSR, CSR_NO_SLOT, CSR_VEC),
+    CSR(CYCLE, CSR_NO_SLOT, 0),
+    CSR(TIME, CSR_NO_SLOT, 0),
+    CSR(INSTRET, CSR_NO_SLOT, 0),
+    CSR_RANGE(HPMCOUNTER3, HPMCOUNTER31, CSR_ZERO),
+
+    // supervisor
+    CSR(SSTATUS, CSR_NO_SLOT, 0),
+    CSR(SIE, CSR_NO_SLOT, 0),
+    CSR(STVEC, CSR_SLOT(stvec), 0),
+    CSR(SCOUNTEREN, CSR_SLOT(scounteren), 0),
+    CSR(SSCRATCH, CSR_SLOT(sscratch), 0),
+    CSR(SEPC, CSR_SLOT(sepc), 0),
+    CSR(SCAUSE, CSR_SLOT(scause), 0),
+    CSR(STVAL, CSR_SLOT(stval), 0),
+    CSR(SIP, CSR_NO_SLOT, 0),
+    CSR(SATP, CSR_SLOT(satp), CSR_TVM),
+
+    // machine
+    CSR_RANGE(MVENDORID, MHARTID, CSR_ZERO),
+    CSR(MSTATUS, CSR_SLOT(mstatus), 0),
+    CSR(MISA, CSR_SLOT(misa), 0),
+    CSR(MEDELEG, CSR_SLOT(medeleg), 0),
+    CSR(MIDELEG, CSR_SLOT(mideleg), 0),
+    CSR(MIE, CSR_SLOT(mie), 0),
+    CSR(MTVEC, CSR_SLOT(mtvec), 0),
+    CSR(MCOUNTEREN, CSR_SLOT(mcounteren), 0),
+    CSR(MSCRATCH, CSR_SLOT(mscratch), 0),
+    CSR(MEPC, CSR_SLOT(mepc), 0),
+    CSR(MCAUSE, CSR_SLOT(mcause), 0),
+    CSR(MTVAL, CSR_SLOT(mtval), 0),
+    CSR(MIP, CSR_NO_SLOT, 0),
+    CSR(PMPCFG0, CSR_SLOT(pmpcfg[0]), 0),
+    CSR(PMPCFG2, CSR_SLOT(pmpcfg[1]), 0),
+    CSR_PMPADDR(0), CSR_PMPADDR(1), CSR_PMPADDR(2), CSR_PMPADDR(3),
+    CSR_PMPADDR(4), CSR_PMPADDR(5), CSR_PMPADDR(6), CSR_PMPADDR(7),
+    CSR_PMPADDR(8), CSR_PMPADDR(9), CSR_PMPADDR(10), CSR_PMPADDR(11),
+    CSR_PMPADDR(12), CSR_PMPADDR(13), CSR_PMPADDR(14), CSR_PMPADDR(15),
+    CSR_RANGE(PMPADDR0 + 16, PMPADDR0 + 63, CSR_ZERO),  // 16 PMP entries
+    CSR(MCYCLE, CSR_NO_SLOT, 0),
+    CSR(MINSTRET, CSR_NO_SLOT, 0),
+    CSR_RANGE(MHPMCOUNTER3, MHPMCOUNTER31, CSR_ZERO),
+    CSR(MCOUNTINHIBIT, CSR_NO_SLOT, CSR_ZERO),
+    CSR_RANGE(MHPMEVENT3, MHPMEVENT31, CSR_ZERO),
+};
+
+// csr[9:8] is the lowest privilege allowed to access the CSR and
+// csr[11:10] == 3 marks it read-only. satp is M-only while mstatus.TVM is set.
+int csr_accessible(CPU *cpu, uint64_t csr, int write)
+{
+    const CSR_INFO *info = &csr_table[csr & 0xfff];
+    uint64_t mstatus = cpu->csr.mstatus;
+
+    return (info->flags & CSR_VALID) && cpu->priv >= info->priv &&
+           !(write && (info->flags & CSR_READONLY)) &&
+           !((info->flags & CSR_TVM) && cpu->priv == PRIV_S &&
+             (mstatus & MSTATUS_TVM)) &&
+           !((info->flags & CSR_FP) && !(mstatus & MSTATUS_FS)) &&
+           !((info->flags & CSR_VEC) && !(mstatus & MSTATUS_VS));
+}
+
+static inline uint64_t *csr_slot(CPU *cpu, uint64_t csr)
+{
+    return &((uint64_t *) &cpu->csr)[csr_table[csr].slot];
+}
+
+// SD summarizes a Dirty FS or VS field
+static uint64_t mstatus_sd(uint64_t mstatus)
+{
+    if ((mstatus & MSTATUS_FS) == MSTATUS_FS ||
+        (mstatus & MSTATUS_VS) == MSTATUS_VS)
+        return mstatus | MSTATUS_SD;
+    return mstatus;
+}
 
 uint64_t csr_read(CPU *cpu, uint64_t csr)
 {
-    return (uint64_t) (uint32_t) cpu->csr[csr];
+    switch (csr) {
+    case FFLAGS:
+        fpu_sync_flags(cpu);
+        return cpu->csr.fflags;
+    case FCSR:
+        fpu_sync_flags(cpu);
+        return cpu->csr.frm << 5 | cpu->csr.fflags;
+    case MSTATUS:
+        return mstatus_sd(cpu->csr.mstatus);
+    case VSTART:
+        return cpu->vec.vstart;
+    case VXSAT:
+        return cpu->vec.vxsat;
+    case VXRM:
+        return cpu->vec.vxrm;
+    case VCSR:
+        return cpu->vec.vxrm << 1 | cpu->vec.vxsat;
+    case VL:
+        return cpu->vec.vl;
+    case VTYPE:
+        return cpu->vec.vtype;
+    case VLENB_CSR:
+        return VLENB;
+    case TIME:
+        return clint_read_mtime(&(cpu->bus->clint));
+    case CYCLE:
+    case MCYCLE:
+        return cpu->timing ? timing_cycles(cpu->timing) : cpu->instret;
+    case INSTRET:
+    case MINSTRET:
+        return cpu->instret;
+    case MIP:
+        return cpu_mip(cpu);
+    case SSTATUS:
+        return mstatus_sd(cpu->csr.mstatus) & SSTATUS_MASK;
+    case SIE:
+        return cpu->csr.mie & cpu->csr.mideleg;
+    case SIP:
+        return cpu_mip(cpu) & cpu->csr.mideleg;
+    default:
+        if (csr_table[csr].flags & CSR_ZERO)
+            return 0;
+        return *csr_slot(cpu, csr);
+    }
 }
 
 void csr_write(CPU *cpu, uint64_t csr, uint64_t value)
 {
-    cpu->csr[csr] = value;
+    switch (csr) {
+    case FFLAGS:
+        fpu_write_flags(cpu, value);
+        cpu->csr.mstatus |= MSTATUS_FS;
+        return;
+    case FRM:
+        // takes effect on the host at the next instruction using it
+        cpu->csr.frm = value & 0x7;
+        cpu->csr.mstatus |= MSTATUS_FS;
+        return;
+    case FCSR:
+        fpu_write_flags(cpu, value);
+        cpu->csr.frm = (value >> 5) & 0x7;
+        cpu->csr.mstatus |= MSTATUS_FS;
+        return;
+    case MSTATUS:
+    case SSTATUS: {
+        uint64_t mask = csr == MSTATUS ? MSTATUS_WRITABLE
+                                       : SSTATUS_MASK & MSTATUS_WRITABLE;
+        uint64_t old = cpu->csr.mstatus;
+        value = (old & ~mask) | (value & mask);
+        if (((value & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT) == 2)
+            value &= ~MSTATUS_MPP;  // WARL: there is no H mode
+        if ((old ^ value) & MSTATUS_MXR)
+            mmu_flush_all(cpu);  // MXR is not part of the TLB tag
+        cpu->csr.mstatus = value;
+        mmu_update_ctx(cpu);
+        cpu->poll_budget = 1;  // interrupts may have been enabled
+        return;
+    }
+    case MIP:
+    case SIP: {
+        // MTIP/MSIP/MEIP are driven by devices; from S mode only SSIP
+        uint64_t mask = csr == MIP ? MIP_S_BITS : MIP_SSIP & cpu->csr.mideleg;
+        cpu_set_irq(cpu, value & mask, 1);
+        cpu_set_irq(cpu, ~value & mask, 0);
+        return;
+    }
+    case MIE:
+    case SIE: {
+        uint64_t mask = csr == MIE ? MIP_S_BITS | MIP_M_BITS
+                                   : cpu->csr.mideleg;
+        cpu->csr.mie = (cpu->csr.mie & ~mask) | (value & mask);
+        cpu->poll_budget = 1;
+        return;
+    }
+    case MIDELEG:
+        cpu->csr.mideleg = value & MIP_S_BITS;
+        cpu->poll_budget = 1;
+        return;
+    case MEDELEG:
+        cpu->csr.medeleg = value & MEDELEG_WRITABLE;
+        return;
+    case VSTART:
+        cpu->vec.vstart = value & (VLEN - 1);
+        cpu->csr.mstatus |= MSTATUS_VS;
+        return;
+    case VXSAT:
+        cpu->vec.vxsat = value & 0x1;
+        cpu->csr.mstatus |= MSTATUS_VS;
+        return;
+    case VXRM:
+        cpu->vec.vxrm = value & 0x3;
+        cpu->csr.mstatus |= MSTATUS_VS;
+        return;
+    case VCSR:
+        cpu->vec.vxsat = value & 0x1;
+        cpu->vec.vxrm = (value >> 1) & 0x3;
+        cpu->csr.mstatus |= MSTATUS_VS;
+        return;
+    case MISA:
+        return;  // the extensions cannot be switched off
+    case MCYCLE:
+        if (cpu->timing) {
+            timing_set_cycles(cpu->timing, value);
+            return;
+        }
+        cpu->instret = value;  // without timing, one count serves both
+        return;
+    case MINSTRET:
+        cpu->instret = value;
+        return;
+    case MEPC:
+    case SEPC:
+        *csr_slot(cpu, csr) = value & ~1ULL;  // IALIGN = 16 with C
+        return;
+    case SATP: {
+        // WARL: unsupported modes leave satp unchanged, high ASID bits are 0
+        uint64_t mode = value >> 60;
+        if (mode != SATP_MODE_BARE && mode != SATP_MODE_SV39 &&
+            mode != SATP_MODE_SV48)
+            return;
+        value &= ~(((1ULL << 16) - (1ULL << SATP_ASID_BITS)) << 44);
+        cpu->csr.satp = value;
+        mmu_update_ctx(cpu);
+        return;
+    }
+    default:
+        if (!(csr_table[csr].flags & CSR_ZERO))
+            *csr_slot(cpu, csr) = value;
+    }
 }
\ No newline at end of file
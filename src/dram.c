@@ -1,34 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
 #include "dram.h"
 
+void dram_init(DRAM *dram)
+{
+    // reserve the window and its guards without committing memory, then
+    // open up the RAM at its start
+    uint8_t *base = mmap(NULL, DRAM_WINDOW + 2 * DRAM_GUARD, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base == MAP_FAILED ||
+        mprotect(base + DRAM_GUARD, DRAM_SIZE, PROT_READ | PROT_WRITE) < 0) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    dram->mem = base + DRAM_GUARD;
+}
+
 uint64_t dram_load_8(DRAM *dram, uint64_t addr)
 {
-    return (uint64_t) dram->mem[addr - DRAM_BASE];
+    uint8_t *p = dram_host(dram, addr);
+
+    return (uint64_t) p[0];
 }
 
 uint64_t dram_load_16(DRAM *dram, uint64_t addr)
 {
-    return (uint64_t) dram->mem[addr - DRAM_BASE] |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 1] << 8;
+    uint8_t *p = dram_host(dram, addr);
+
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8;
 }
 
 uint64_t dram_load_32(DRAM *dram, uint64_t addr)
 {
-    return (uint64_t) dram->mem[addr - DRAM_BASE] |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 1] << 8 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 2] << 16 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 3] << 24;
+    uint8_t *p = dram_host(dram, addr);
+
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+           (uint64_t) p[3] << 24;
 }
 
 uint64_t dram_load_64(DRAM *dram, uint64_t addr)
 {
-    return (uint64_t) dram->mem[addr - DRAM_BASE] |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 1] << 8 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 2] << 16 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 3] << 24 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 4] << 32 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 5] << 40 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 6] << 48 |
-           (uint64_t) dram->mem[addr - DRAM_BASE + 7] << 56;
+    uint8_t *p = dram_host(dram, addr);
+
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+           (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 |
+           (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 |
+           (uint64_t) p[7] << 56;
 }
 
 uint64_t dram_load(DRAM *dram, uint64_t addr, uint64_t size)
@@ -53,33 +73,41 @@ uint64_t dram_load(DRAM *dram, uint64_t addr, uint64_t size)
 
 void dram_store_8(DRAM *dram, uint64_t addr, uint64_t value)
 {
-    dram->mem[addr - DRAM_BASE] = (uint8_t) (value & 0xff);
+    uint8_t *p = dram_host(dram, addr);
+
+    p[0] = (uint8_t) (value & 0xff);
 }
 
 void dram_store_16(DRAM *dram, uint64_t addr, uint64_t value)
 {
-    dram->mem[addr - DRAM_BASE] = (uint8_t) (value & 0xff);
-    dram->mem[addr - DRAM_BASE + 1] = (uint8_t) ((value >> 8) & 0xff);
+    uint8_t *p = dram_host(dram, addr);
+
+    p[0] = (uint8_t) (value & 0xff);
+    p[1] = (uint8_t) ((value >> 8) & 0xff);
 }
 
 void dram_store_32(DRAM *dram, uint64_t addr, uint64_t value)
 {
-    dram->mem[addr - DRAM_BASE] = (uint8_t) (value & 0xff);
-    dram->mem[addr - DRAM_BASE + 1] = (uint8_t) ((value >> 8) & 0xff);
-    dram->mem[addr - DRAM_BASE + 2] = (uint8_t) ((value >> 16) & 0xff);
-    dram->mem[addr - DRAM_BASE + 3] = (uint8_t) ((value >> 24) & 0xff);
+    uint8_t *p = dram_host(dram, addr);
+
+    p[0] = (uint8_t) (value & 0xff);
+    p[1] = (uint8_t) ((value >> 8) & 0xff);
+    p[2] = (uint8_t) ((value >> 16) & 0xff);
+    p[3] = (uint8_t) ((value >> 24) & 0xff);
 }
 
 void dram_store_64(DRAM *dram, uint64_t addr, uint64_t value)
 {
-    dram->mem[addr - DRAM_BASE] = (uint8_t) (value & 0xff);
-    dram->mem[addr - DRAM_BASE + 1] = (uint8_t) ((value >> 8) & 0xff);
-    dram->mem[addr - DRAM_BASE + 2] = (uint8_t) ((value >> 16) & 0xff);
-    dram->mem[addr - DRAM_BASE + 3] = (uint8_t) ((value >> 24) & 0xff);
-    dram->mem[addr - DRAM_BASE + 4] = (uint8_t) ((value >> 32) & 0xff);
-    dram->mem[addr - DRAM_BASE + 5] = (uint8_t) ((value >> 40) & 0xff);
-    dram->mem[addr - DRAM_BASE + 6] = (uint8_t) ((value >> 48) & 0xff);
-    dram->mem[addr - DRAM_BASE + 7] = (uint8_t) ((value >> 56) & 0xff);
+    uint8_t *p = dram_host(dram, addr);
+
+    p[0] = (uint8_t) (value & 0xff);
+    p[1] = (uint8_t) ((value >> 8) & 0xff);
+    p[2] = (uint8_t) ((value >> 16) & 0xff);
+    p[3] = (uint8_t) ((value >> 24) & 0xff);
+    p[4] = (uint8_t) ((value >> 32) & 0xff);
+    p[5] = (uint8_t) ((value >> 40) & 0xff);
+    p[6] = (uint8_t) ((value >> 48) & 0xff);
+    p[7] = (uint8_t) ((value >> 56) & 0xff);
 }
 
 void dram_store(DRAM *dram, uint64_t addr, uint64_t size, uint64_t value)
@@ -99,4 +127,6 @@ void dram_store(DRAM *dram, uint64_t addr, uint64_t size, uint64_t value)
         break;
     default:;
     }
+    if (dram_write_tracked(dram, addr))
+        dram->tracked_write(dram->opaque, addr, size / 8);
 }
\ No newline at end of file
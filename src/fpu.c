@@ -0,0 +1,207 @@
+#include <fenv.h>
+#include <math.h>
+
+#include "cpu.h"
+#include "csr.h"
+#include "fpu.h"
+
+// host rounding mode of each RISC-V rm; RMM has no SSE equivalent, so only
+// the ops that round without the host (conversions to integers, with
+// round()) or never round (widening) accept it, and the rest trap on it
+static const int host_rm[] = {
+    [RM_RNE] = FE_TONEAREST, [RM_RTZ] = FE_TOWARDZERO, [RM_RDN] = FE_DOWNWARD,
+    [RM_RUP] = FE_UPWARD,    [RM_RMM] = FE_TONEAREST,
+};
+
+void fpu_init(CPU *cpu)
+{
+    fesetround(FE_TONEAREST);
+    feclearexcept(FE_ALL_EXCEPT);
+    cpu->fp_rm = RM_RNE;
+}
+
+int fpu_set_rm(CPU *cpu, int rm)
+{
+    if (rm == RM_DYN)
+        rm = cpu->csr.frm;
+    if (rm > RM_RMM)
+        return -1;
+    if (rm != cpu->fp_rm) {
+        fesetround(host_rm[rm]);
+        cpu->fp_rm = rm;
+    }
+    return rm;
+}
+
+void fpu_sync_flags(CPU *cpu)
+{
+    int host = fetestexcept(FE_ALL_EXCEPT);
+    if (!host)
+        return;
+    feclearexcept(FE_ALL_EXCEPT);
+    cpu->csr.fflags |= (host & FE_INEXACT ? FFLAGS_NX : 0) |
+                        (host & FE_UNDERFLOW ? FFLAGS_UF : 0) |
+                        (host & FE_OVERFLOW ? FFLAGS_OF : 0) |
+                        (host & FE_DIVBYZERO ? FFLAGS_DZ : 0) |
+                        (host & FE_INVALID ? FFLAGS_NV : 0);
+}
+
+void fpu_write_flags(CPU *cpu, uint64_t flags)
+{
+    feclearexcept(FE_ALL_EXCEPT);
+    cpu->csr.fflags = flags & 0x1f;
+}
+
+void fpu_raise(CPU *cpu, int flags)
+{
+    cpu->csr.fflags |= flags;
+}
+
+// fclass result bits
+#define CLASS_NEG_INF (1 << 0)
+#define CLASS_NEG_NORMAL (1 << 1)
+#define CLASS_NEG_SUBNORMAL (1 << 2)
+#define CLASS_NEG_ZERO (1 << 3)
+#define CLASS_POS_ZERO (1 << 4)
+#define CLASS_POS_SUBNORMAL (1 << 5)
+#define CLASS_POS_NORMAL (1 << 6)
+#define CLASS_POS_INF (1 << 7)
+#define CLASS_SNAN (1 << 8)
+#define CLASS_QNAN (1 << 9)
+
+static uint64_t classify(int sign, int exp_zero, int exp_ones, int frac_zero,
+                         int quiet)
+{
+    if (exp_ones) {
+        if (frac_zero)
+            return sign ? CLASS_NEG_INF : CLASS_POS_INF;
+        return quiet ? CLASS_QNAN : CLASS_SNAN;
+    }
+    if (exp_zero) {
+        if (frac_zero)
+            return sign ? CLASS_NEG_ZERO : CLASS_POS_ZERO;
+        return sign ? CLASS_NEG_SUBNORMAL : CLASS_POS_SUBNORMAL;
+    }
+    return sign ? CLASS_NEG_NORMAL : CLASS_POS_NORMAL;
+}
+
+uint64_t fpu_class_s(uint32_t u)
+{
+    uint32_t exp = (u >> 23) & 0xff;
+    return classify(u >> 31, exp == 0, exp == 0xff, !(u & 0x7fffff),
+                    (u >> 22) & 1);
+}
+
+uint64_t fpu_class_d(uint64_t u)
+{
+    uint64_t exp = (u >> 52) & 0x7ff;
+    return classify(u >> 63, exp == 0, exp == 0x7ff,
+                    !(u & 0xfffffffffffffULL), (u >> 51) & 1);
+}
+
+uint32_t fpu_minmax_s(CPU *cpu, uint32_t a, uint32_t b, int max)
+{
+    if (f32_issnan(a) || f32_issnan(b))
+        fpu_raise(cpu, FFLAGS_NV);
+    if (f32_isnan(a) && f32_isnan(b))
+        return F32_CANONICAL_NAN;
+    if (f32_isnan(a))
+        return b;
+    if (f32_isnan(b))
+        return a;
+    // with equal values only the signs of zeros can differ
+    if (f32_from(a) == f32_from(b))
+        return max ? a & b : a | b;
+    return (f32_from(a) < f32_from(b)) ^ max ? a : b;
+}
+
+uint64_t fpu_minmax_d(CPU *cpu, uint64_t a, uint64_t b, int max)
+{
+    if (f64_issnan(a) || f64_issnan(b))
+        fpu_raise(cpu, FFLAGS_NV);
+    if (f64_isnan(a) && f64_isnan(b))
+        return F64_CANONICAL_NAN;
+    if (f64_isnan(a))
+        return b;
+    if (f64_isnan(b))
+        return a;
+    if (f64_from(a) == f64_from(b))
+        return max ? a & b : a | b;
+    return (f64_from(a) < f64_from(b)) ^ max ? a : b;
+}
+
+int fpu_compare(CPU *cpu, double a, double b, int a_nan, int b_nan,
+                int a_snan, int b_snan, int funct3)
+{
+    if (a_nan || b_nan) {
+        // feq is quiet, flt and fle signal on any NaN
+        if (funct3 != 2 || a_snan || b_snan)
+            fpu_raise(cpu, FFLAGS_NV);
+        return 0;
+    }
+    switch (funct3) {
+    case 0:
+        return a <= b;
+    case 1:
+        return a < b;
+    default:
+        return a == b;
+    }
+}
+
+// round to an integral value in the current mode, raising NX if inexact
+static double round_integral(CPU *cpu, double x, int rm)
+{
+    if (rm != RM_RMM)
+        return rint(x);
+    double r = round(x);
+    if (r != x)
+        fpu_raise(cpu, FFLAGS_NX);
+    return r;
+}
+
+int64_t fpu_to_int(CPU *cpu, double x, int nan, int rm, double lo, double hi)
+{
+    if (nan || x >= hi) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return hi == 0x1p63 ? INT64_MAX : (int64_t) hi - 1;
+    }
+    // values below lo - 1 cannot round into range; lo - 1 itself is exact
+    // for 32-bit results and rounds to lo for 64-bit ones, which is valid
+    if (x < lo - 1) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return (int64_t) lo;
+    }
+    double r = round_integral(cpu, x, rm);
+    if (r >= hi) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return hi == 0x1p63 ? INT64_MAX : (int64_t) hi - 1;
+    }
+    if (r < lo) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return (int64_t) lo;
+    }
+    return (int64_t) r;
+}
+
+uint64_t fpu_to_uint(CPU *cpu, double x, int nan, int rm, double hi)
+{
+    if (nan || x >= hi) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return hi == 0x1p64 ? UINT64_MAX : (uint64_t) hi - 1;
+    }
+    if (x <= -1) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return 0;
+    }
+    double r = round_integral(cpu, x, rm);
+    if (r >= hi) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return hi == 0x1p64 ? UINT64_MAX : (uint64_t) hi - 1;
+    }
+    if (r < 0) {
+        fpu_raise(cpu, FFLAGS_NV);
+        return 0;
+    }
+    return (uint64_t) r;
+}
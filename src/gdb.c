@@ -0,0 +1,552 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "gdb.h"
+
+static CPU *gdb_cpu;  // for the SIGIO handler
+
+static void gdb_sigio(int sig)
+{
+    if (gdb_cpu && gdb_cpu->gdb) {
+        gdb_cpu->gdb->io = 1;
+        // any thread may take the signal: look at it at the next block
+        // boundary
+        cpu_request_poll(gdb_cpu);
+    }
+}
+
+GDB *gdb_create(CPU *cpu, const char *where)
+{
+    GDB *gdb = calloc(1, sizeof(GDB));
+    struct sigaction sa = {.sa_handler = gdb_sigio, .sa_flags = SA_RESTART};
+    int tcp = strncmp(where, "unix:", 5) != 0;
+    int one = 1;
+    int fd, err;
+
+    if (!gdb) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    if (tcp) {
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(atoi(where)),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        err = fd < 0 ||
+              setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+              bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    } else {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, where + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        err = fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    if (err || listen(fd, 1) < 0) {
+        fprintf(stderr, "gdb: cannot listen on %s: %s\n", where,
+                strerror(errno));
+        goto fail;
+    }
+    fprintf(stderr, "Waiting for gdb on %s\n", where);
+    gdb->fd = accept(fd, NULL, NULL);
+    close(fd);
+    if (gdb->fd < 0) {
+        fprintf(stderr, "gdb: accept: %s\n", strerror(errno));
+        goto fail;
+    }
+    if (tcp)
+        setsockopt(gdb->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // a break from gdb arrives while the guest runs, as SIGIO
+    gdb_cpu = cpu;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGIO, &sa, NULL);
+    fcntl(gdb->fd, F_SETOWN, getpid());
+    fcntl(gdb->fd, F_SETFL, fcntl(gdb->fd, F_GETFL) | O_ASYNC);
+    snprintf(gdb->reply, sizeof(gdb->reply), "S%02x", GDB_SIGTRAP);
+    return gdb;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    free(gdb);
+    return NULL;
+}
+
+// ---------- Packets ----------
+static int gdb_hex(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int gdb_getc(GDB *gdb)
+{
+    if (gdb->rx_pos == gdb->rx_len) {
+        ssize_t n;
+        do {
+            n = recv(gdb->fd, gdb->rx, sizeof(gdb->rx), 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return -1;
+        gdb->rx_pos = 0;
+        gdb->rx_len = n;
+    }
+    return gdb->rx[gdb->rx_pos++];
+}
+
+// the payload of the next well-formed packet, or NULL once gdb is gone.
+// Acks and breaks between packets are skipped: the guest is stopped.
+static char *gdb_recv(GDB *gdb)
+{
+    for (;;) {
+        uint8_t sum = 0;
+        int n = 0;
+        int c, hi, lo;
+
+        while ((c = gdb_getc(gdb)) != '$')
+            if (c < 0)
+                return NULL;
+        while ((c = gdb_getc(gdb)) != '#') {
+            if (c < 0)
+                return NULL;
+            if (n < GDB_PACKET_SIZE - 1)
+                gdb->packet[n++] = c;
+            sum += c;
+        }
+        hi = gdb_hex(gdb_getc(gdb));
+        lo = gdb_hex(gdb_getc(gdb));
+        gdb->packet[n] = '\0';
+        if (hi >= 0 && lo >= 0 && (hi << 4 | lo) == sum) {
+            send(gdb->fd, "+", 1, MSG_NOSIGNAL);
+            return gdb->packet;
+        }
+        send(gdb->fd, "-", 1, MSG_NOSIGNAL);
+    }
+}
+
+static void gdb_send(GDB *gdb, const char *payload)
+{
+    static char out[2 * GDB_PACKET_SIZE];
+    uint8_t sum = 0;
+    int n = 0;
+
+    out[n++] = '$';
+    for (const char *p = payload; *p && n < sizeof(out) - 4; p++) {
+        out[n++] = *p;
+        sum += *p;
+    }
+    n += sprintf(out + n, "#%02x", sum);
+    send(gdb->fd, out, n, MSG_NOSIGNAL);
+}
+
+static char *gdb_put_bytes(char *p, const uint8_t *bytes, uint64_t len)
+{
+    for (uint64_t i = 0; i < len; i++)
+        p += sprintf(p, "%02x", bytes[i]);
+    return p;
+}
+
+// parse 2 * len hex digits; returns the end, or NULL if they are not there
+static const char *gdb_get_bytes(const char *p, uint8_t *bytes, uint64_t len)
+{
+    for (uint64_t i = 0; i < len; i++, p += 2) {
+        int hi = gdb_hex(p[0]), lo = hi < 0 ? -1 : gdb_hex(p[1]);
+        if (lo < 0)
+            return NULL;
+        bytes[i] = hi << 4 | lo;
+    }
+    return p;
+}
+
+// ---------- Registers and memory ----------
+// gdb's RISC-V numbering: x0-x31, pc, f0-f31, then 65 + the CSR number
+#define GDB_REG_PC 32
+#define GDB_REG_F0 33
+#define GDB_REG_CSR0 65
+
+static int gdb_read_reg(CPU *cpu, uint64_t n, uint64_t *value)
+{
+    if (n < 32)
+        *value = n ? cpu->regs[n] : 0;
+    else if (n == GDB_REG_PC)
+        *value = cpu->pc;
+    else if (n < GDB_REG_CSR0)
+        *value = cpu->fregs[n - GDB_REG_F0];
+    else if (n < GDB_REG_CSR0 + 4096 &&
+             (csr_table[n - GDB_REG_CSR0].flags & CSR_VALID))
+        *value = csr_read(cpu, n - GDB_REG_CSR0);
+    else
+        return -1;
+    return 0;
+}
+
+static int gdb_write_reg(CPU *cpu, uint64_t n, uint64_t value)
+{
+    if (n < 32) {
+        if (n)
+            cpu->regs[n] = value;
+    } else if (n == GDB_REG_PC) {
+        cpu->pc = value;
+    } else if (n < GDB_REG_CSR0) {
+        cpu->fregs[n - GDB_REG_F0] = value;
+    } else if (n < GDB_REG_CSR0 + 4096 &&
+               (csr_table[n - GDB_REG_CSR0].flags & CSR_VALID) &&
+               !(csr_table[n - GDB_REG_CSR0].flags & CSR_READONLY)) {
+        csr_write(cpu, n - GDB_REG_CSR0, value);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// DRAM backing a physical range, or NULL if it is not all RAM
+static uint8_t *gdb_mem(CPU *cpu, uint64_t addr, uint64_t len)
+{
+    if (addr < DRAM_BASE || addr - DRAM_BASE > DRAM_SIZE ||
+        len > DRAM_SIZE - (addr - DRAM_BASE))
+        return NULL;
+    return &cpu->bus->dram.mem[addr - DRAM_BASE];
+}
+
+static void gdb_write_mem(CPU *cpu, uint64_t addr, const uint8_t *bytes,
+                          uint64_t len)
+{
+    DRAM *dram = &cpu->bus->dram;
+
+    memcpy(gdb_mem(cpu, addr, len), bytes, len);
+    // translated code has to see the new bytes; watchpoints do not fire
+    for (uint64_t a = addr, next; a < addr + len; a = next) {
+        next = (a | (PAGE_SIZE - 1)) + 1;
+        if (next > addr + len)
+            next = addr + len;
+        if (dram_is_code(dram, a))
+            block_invalidate_code(cpu, a, next - a);
+    }
+}
+
+// ---------- Breakpoints and watchpoints ----------
+int gdb_breakpoint_at(GDB *gdb, uint64_t pc)
+{
+    for (int i = 0; i < gdb->nbreakpoints; i++)
+        if (gdb->breakpoints[i] == pc)
+            return 1;
+    return 0;
+}
+
+static int gdb_set_breakpoint(CPU *cpu, uint64_t pc, int set)
+{
+    GDB *gdb = cpu->gdb;
+    int i;
+
+    for (i = 0; i < gdb->nbreakpoints; i++)
+        if (gdb->breakpoints[i] == pc)
+            break;
+    if (set == (i < gdb->nbreakpoints))
+        return 0;
+    if (set) {
+        if (gdb->nbreakpoints == GDB_MAX_BREAKPOINTS)
+            return -1;
+        gdb->breakpoints[gdb->nbreakpoints++] = pc;
+    } else {
+        gdb->breakpoints[i] = gdb->breakpoints[--gdb->nbreakpoints];
+    }
+    // retranslate whatever covers pc, with or without the breakpoint
+    block_invalidate_pc(cpu, pc);
+    return 0;
+}
+
+static void gdb_update_watch_map(CPU *cpu)
+{
+    DRAM *dram = &cpu->bus->dram;
+    GDB *gdb = cpu->gdb;
+
+    memset(dram->watch_map, 0, sizeof(dram->watch_map));
+    for (int i = 0; gdb && i < gdb->nwatches; i++) {
+        GDB_WATCH *w = &gdb->watches[i];
+        for (uint64_t page = DRAM_PAGE(w->addr);
+             page <= DRAM_PAGE(w->addr + w->len - 1); page++)
+            dram->watch_map[page / 64] |= 1ULL << (page % 64);
+    }
+    for (int i = 0; i < DRAM_PAGES / 64; i++)
+        dram->write_map[i] = dram->code_map[i] | dram->watch_map[i];
+}
+
+static int gdb_set_watch(CPU *cpu, uint64_t addr, uint64_t len, int set)
+{
+    GDB *gdb = cpu->gdb;
+    int i;
+
+    if (len == 0 || !gdb_mem(cpu, addr, len))
+        return -1;
+    for (i = 0; i < gdb->nwatches; i++)
+        if (gdb->watches[i].addr == addr && gdb->watches[i].len == len)
+            break;
+    if (set == (i < gdb->nwatches))
+        return 0;
+    if (set) {
+        if (gdb->nwatches == GDB_MAX_WATCHPOINTS)
+            return -1;
+        gdb->watches[gdb->nwatches++] = (GDB_WATCH){addr, len};
+    } else {
+        gdb->watches[i] = gdb->watches[--gdb->nwatches];
+    }
+    gdb_update_watch_map(cpu);
+    return 0;
+}
+
+void gdb_watch_store(CPU *cpu, uint64_t paddr, uint64_t len)
+{
+    GDB *gdb = cpu->gdb;
+
+    for (int i = 0; i < gdb->nwatches; i++) {
+        GDB_WATCH *w = &gdb->watches[i];
+        if (paddr < w->addr + w->len && w->addr < paddr + len) {
+            // stop after this instruction: end its block and poll
+            gdb->watch_hit = 1;
+            gdb->watch_addr = w->addr;
+            block_stop(cpu);
+            cpu->poll_budget = 0;
+            return;
+        }
+    }
+}
+
+// ---------- Run control ----------
+// run one instruction; an exception it raises ends the step at the handler
+static void gdb_step(CPU *cpu)
+{
+    jmp_buf env;
+
+    memcpy(env, cpu->trap_env, sizeof(env));
+    if (!setjmp(cpu->trap_env))
+        block_step(cpu);
+    memcpy(cpu->trap_env, env, sizeof(env));
+}
+
+static void gdb_report(GDB *gdb, int signal)
+{
+    if (gdb->watch_hit)
+        snprintf(gdb->reply, sizeof(gdb->reply), "T%02xwatch:%lx;", signal,
+                 gdb->watch_addr);
+    else
+        snprintf(gdb->reply, sizeof(gdb->reply), "S%02x", signal);
+    gdb->watch_hit = 0;
+    gdb_send(gdb, gdb->reply);
+}
+
+// drop every breakpoint and watchpoint and let the guest run on its own
+static void gdb_detach(CPU *cpu)
+{
+    GDB *gdb = cpu->gdb;
+
+    fcntl(gdb->fd, F_SETFL, fcntl(gdb->fd, F_GETFL) & ~O_ASYNC);
+    close(gdb->fd);
+    cpu->gdb = NULL;
+    free(gdb);
+    gdb_update_watch_map(cpu);
+    block_flush(cpu);
+    fprintf(stderr, "gdb detached\n");
+}
+
+// one packet; returns 1 when the guest should resume
+static int gdb_command(CPU *cpu, char *p)
+{
+    GDB *gdb = cpu->gdb;
+    static char out[GDB_PACKET_SIZE];
+    static uint8_t bytes[GDB_PACKET_SIZE / 2];
+    uint64_t addr, len, value;
+    char *end;
+
+    out[0] = '\0';
+    switch (*p++) {
+    case '?':
+        gdb_send(gdb, gdb->reply);
+        return 0;
+    case 'g': {
+        char *o = out;
+        for (int i = 0; i <= GDB_REG_PC; i++) {
+            gdb_read_reg(cpu, i, &value);
+            o = gdb_put_bytes(o, (uint8_t *) &value, 8);
+        }
+        break;
+    }
+    case 'G':
+        for (int i = 0; i <= GDB_REG_PC && p; i++) {
+            if ((p = (char *) gdb_get_bytes(p, (uint8_t *) &value, 8)))
+                gdb_write_reg(cpu, i, value);
+        }
+        strcpy(out, "OK");
+        break;
+    case 'p':
+        if (gdb_read_reg(cpu, strtoull(p, NULL, 16), &value) < 0)
+            strcpy(out, "E01");
+        else
+            gdb_put_bytes(out, (uint8_t *) &value, 8);
+        break;
+    case 'P':
+        addr = strtoull(p, &end, 16);
+        if (*end != '=' || !gdb_get_bytes(end + 1, (uint8_t *) &value, 8) ||
+            gdb_write_reg(cpu, addr, value) < 0)
+            strcpy(out, "E01");
+        else
+            strcpy(out, "OK");
+        break;
+    case 'm':
+        addr = strtoull(p, &end, 16);
+        len = *end == ',' ? strtoull(end + 1, NULL, 16) : 0;
+        if (len > sizeof(bytes) - 1 || !gdb_mem(cpu, addr, len))
+            strcpy(out, "E01");
+        else
+            gdb_put_bytes(out, gdb_mem(cpu, addr, len), len);
+        break;
+    case 'M':
+        addr = strtoull(p, &end, 16);
+        len = *end == ',' ? strtoull(end + 1, &end, 16) : 0;
+        if (*end != ':' || len > sizeof(bytes) || !gdb_mem(cpu, addr, len) ||
+            !gdb_get_bytes(end + 1, bytes, len)) {
+            strcpy(out, "E01");
+        } else {
+            gdb_write_mem(cpu, addr, bytes, len);
+            strcpy(out, "OK");
+        }
+        break;
+    case 'c':
+        if (*p)
+            cpu->pc = strtoull(p, NULL, 16);
+        gdb->running = 1;
+        return 1;
+    case 's':
+        if (*p)
+            cpu->pc = strtoull(p, NULL, 16);
+        gdb_step(cpu);
+        gdb_report(gdb, GDB_SIGTRAP);
+        return 0;
+    case 'Z':
+    case 'z': {
+        int set = p[-1] == 'Z';
+        int type = *p;
+        int err;
+
+        addr = strtoull(p + 2, &end, 16);
+        len = *end == ',' ? strtoull(end + 1, NULL, 16) : 0;
+        if (p[1] != ',')
+            err = -1;
+        else if (type == '0' || type == '1')  // software or "hardware"
+            err = gdb_set_breakpoint(cpu, addr, set);
+        else if (type == '2')  // write watchpoint
+            err = gdb_set_watch(cpu, addr, len, set);
+        else
+            break;  // read and access watchpoints are not supported
+        strcpy(out, err < 0 ? "E01" : "OK");
+        break;
+    }
+    case 'D':
+        gdb_send(gdb, "OK");
+        gdb_detach(cpu);
+        return 1;
+    case 'k':
+        fprintf(stderr, "gdb: killed\n");
+        exit(0);
+    case 'H':
+    case 'T':
+        strcpy(out, "OK");
+        break;
+    case 'q':
+        if (!strncmp(p, "Supported", 9))
+            snprintf(out, sizeof(out), "PacketSize=%x", GDB_PACKET_SIZE);
+        else if (!strcmp(p, "Attached"))
+            strcpy(out, "1");
+        else if (!strcmp(p, "C"))
+            strcpy(out, "QC1");
+        else if (!strcmp(p, "fThreadInfo"))
+            strcpy(out, "m1");
+        else if (!strcmp(p, "sThreadInfo"))
+            strcpy(out, "l");
+        break;
+    default:;  // unsupported: the empty reply
+    }
+    gdb_send(gdb, out);
+    return 0;
+}
+
+void gdb_stop(CPU *cpu, int signal)
+{
+    GDB *gdb = cpu->gdb;
+    char *p;
+
+    if (gdb->running) {
+        gdb->running = 0;
+        gdb_report(gdb, signal);
+    }
+    do {
+        if (!(p = gdb_recv(gdb))) {
+            gdb_detach(cpu);
+            return;
+        }
+    } while (!gdb_command(cpu, p));
+}
+
+void gdb_exec_breakpoint(CPU *cpu, uint32_t inst)
+{
+    // stop with pc at the breakpoint, before the instruction has run
+    cpu->pc = cpu->inst_pc;
+    cpu->instret--;  // the dispatcher counts this op when it returns
+    gdb_stop(cpu, GDB_SIGTRAP);
+}
+
+void gdb_poll(CPU *cpu)
+{
+    GDB *gdb = cpu->gdb;
+
+    if (gdb->watch_hit) {
+        gdb_stop(cpu, GDB_SIGTRAP);
+        return;
+    }
+    gdb->io = 0;
+    for (;;) {
+        if (gdb->rx_pos == gdb->rx_len) {
+            ssize_t n = recv(gdb->fd, gdb->rx, sizeof(gdb->rx), MSG_DONTWAIT);
+            if (n == 0) {
+                gdb_detach(cpu);
+                return;
+            }
+            if (n < 0)
+                return;
+            gdb->rx_pos = 0;
+            gdb->rx_len = n;
+        }
+        if (gdb->rx[gdb->rx_pos++] == 0x03) {
+            gdb_stop(cpu, GDB_SIGINT);
+            return;
+        }
+    }
+}
+
+void gdb_exit(CPU *cpu, int code)
+{
+    char reply[8];
+
+    snprintf(reply, sizeof(reply), "W%02x", code & 0xff);
+    gdb_send(cpu->gdb, reply);
+    close(cpu->gdb->fd);
+    free(cpu->gdb);
+    cpu->gdb = NULL;
+}
@@ -0,0 +1,338 @@
+#include <string.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "idiom.h"
+#include "isa.h"
+#include "isa_decode.h"
+
+void idiom_set_symbols(CPU *cpu, const SYMBOLS *symbols)
+{
+    IDIOM_FUNCS *f = &cpu->bcache.funcs;
+    const SYMBOL *sym;
+
+    if ((sym = symbols_find(symbols, "memcpy")))
+        f->memcpy_pc = sym->addr;
+    if ((sym = symbols_find(symbols, "memset")))
+        f->memset_pc = sym->addr;
+    if ((sym = symbols_find(symbols, "strlen")))
+        f->strlen_pc = sym->addr;
+}
+
+// element width of a scalar integer load or store, 0 for anything else
+static int idiom_width(int id, uint8_t *sign)
+{
+    *sign = id == ISA_LB || id == ISA_LH || id == ISA_LW;
+    switch (id) {
+    case ISA_LB:
+    case ISA_LBU:
+    case ISA_SB:
+        return 1;
+    case ISA_LH:
+    case ISA_LHU:
+    case ISA_SH:
+        return 2;
+    case ISA_LW:
+    case ISA_LWU:
+    case ISA_SW:
+        return 4;
+    case ISA_LD:
+    case ISA_SD:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// the exit branch: a count of cond against an invariant bound, or a test
+// of the loaded element against zero
+static int idiom_match_exit(IDIOM *m, const int64_t *step, uint32_t inst,
+                            int id)
+{
+    int a = rs1(inst), b = rs2(inst);
+
+    if (id == ISA_BNE && m->data && (a == m->data || b == m->data)) {
+        if ((a == m->data ? b : a) != 0)
+            return 0;
+        m->exit = IDIOM_UNTIL_ZERO;
+        return 1;
+    }
+    if (id == ISA_BNE && !step[a] && step[b]) {
+        int t = a;  // count b
+        a = b;
+        b = t;
+    }
+    if (!step[a] || step[b] || b == m->data ||
+        (id != ISA_BNE && step[a] < 0))
+        return 0;
+    m->exit = id == ISA_BNE   ? IDIOM_UNTIL_EQ
+              : id == ISA_BLT ? IDIOM_WHILE_LT
+                              : IDIOM_WHILE_LTU;
+    m->cond = a;
+    m->bound = b;
+    return 1;
+}
+
+static int idiom_match_loop(BLOCK *block, uint64_t pc, IDIOM *m)
+{
+    BLOCK_INSN *br = &block->insn[block->n - 1];
+    int64_t step[32] = {0};
+    uint8_t sign;
+
+    if ((br->id != ISA_BNE && br->id != ISA_BLT && br->id != ISA_BLTU) ||
+        pc + block->bytes - br->len + imm_B(br->inst) != pc)
+        return 0;
+    *m = (IDIOM){.kind = IDIOM_LOOP};
+    for (int i = 0; i < block->n - 1; i++) {
+        uint32_t inst = block->insn[i].inst;
+        int id = block->insn[i].id;
+        int width = idiom_width(id, &sign);
+        int cls = isa_info[id].cls;
+
+        if (id == ISA_ADDI) {
+            // an induction register: stepped, and otherwise only read
+            if (rd(inst) == 0 || rd(inst) != rs1(inst) || rd(inst) == m->data)
+                return 0;
+            step[rd(inst)] += (int64_t) imm_I(inst);
+        } else if (cls == CLASS_LOAD && width) {
+            if (m->load.base || rd(inst) == 0 || rs1(inst) == 0 ||
+                rd(inst) == rs1(inst) || step[rd(inst)])
+                return 0;
+            m->load.base = rs1(inst);
+            m->load.offset = imm_I(inst) + step[rs1(inst)];
+            m->data = rd(inst);
+            m->sign = sign;
+            m->width = width;
+        } else if (cls == CLASS_STORE && width) {
+            if (m->store.base || rs1(inst) == 0 || rs1(inst) == m->data ||
+                (m->width && m->width != width))
+                return 0;
+            m->store.base = rs1(inst);
+            m->store.offset = imm_S(inst) + step[rs1(inst)];
+            m->copy = m->data && rs2(inst) == m->data;
+            m->fill = m->copy ? 0 : rs2(inst);
+            m->width = width;
+        } else {
+            return 0;
+        }
+    }
+    // pointers move forward one element per iteration, the stored value is
+    // the loaded one or invariant, and a load without a store only scans
+    if ((m->load.base && step[m->load.base] != m->width) ||
+        (m->store.base && step[m->store.base] != m->width) ||
+        (m->load.base && m->store.base && !m->copy) ||
+        (m->store.base && !m->copy && (step[m->fill] || m->fill == m->data)) ||
+        !idiom_match_exit(m, step, br->inst, br->id) ||
+        (!m->store.base && m->exit != IDIOM_UNTIL_ZERO))
+        return 0;
+    for (int r = 1; r < 32; r++) {
+        if (!step[r])
+            continue;
+        if (m->nsteps == IDIOM_STEPS)
+            return 0;
+        m->step_reg[m->nsteps] = r;
+        m->step[m->nsteps++] = step[r];
+    }
+    return 1;
+}
+
+void idiom_match(CPU *cpu, BLOCK *block, uint64_t pc)
+{
+    IDIOM_FUNCS *f = &cpu->bcache.funcs;
+    IDIOM *m = &block->idiom;
+
+    m->kind = IDIOM_NONE;
+    if (cpu->cache || cpu->timing || cpu->gdb)
+        return;
+    if (pc == f->memcpy_pc)
+        m->kind = IDIOM_MEMCPY;
+    else if (pc == f->memset_pc)
+        m->kind = IDIOM_MEMSET;
+    else if (pc == f->strlen_pc)
+        m->kind = IDIOM_STRLEN;
+    else if (!idiom_match_loop(block, pc, m))
+        m->kind = IDIOM_NONE;
+}
+
+static int64_t idiom_step(const IDIOM *m, int reg)
+{
+    for (int i = 0; i < m->nsteps; i++)
+        if (m->step_reg[i] == reg)
+            return m->step[i];
+    return 0;
+}
+
+// iterations of a counted loop before its last one, 0 if it runs just once
+// or wraps around
+static uint64_t idiom_trip(const IDIOM *m, const uint64_t *x)
+{
+    uint64_t v = x[m->cond], bound = m->bound ? x[m->bound] : 0;
+    int64_t step = idiom_step(m, m->cond);
+    uint64_t dist, mag;
+
+    switch (m->exit) {
+    case IDIOM_UNTIL_EQ:
+        // the smallest n > 0 with v + n * step == bound
+        dist = step > 0 ? bound - v : v - bound;
+        mag = step > 0 ? step : -step;
+        if (!dist || dist % mag)
+            return 0;
+        return dist / mag - 1;
+    case IDIOM_WHILE_LT:
+        if ((int64_t) v >= (int64_t) bound ||
+            (int64_t) bound > INT64_MAX - step)
+            return 0;
+        return (bound - v + step - 1) / step - 1;
+    case IDIOM_WHILE_LTU:
+        if (v >= bound || bound > UINT64_MAX - step)
+            return 0;
+        return (bound - v + step - 1) / step - 1;
+    default:
+        return UINT64_MAX;  // until a zero element
+    }
+}
+
+// whole elements from addr to the end of its page
+static uint64_t idiom_page_elems(uint64_t addr, int width)
+{
+    return (PAGE_SIZE - PAGE_OFFSET(addr)) / width;
+}
+
+static uint64_t idiom_element(const uint8_t *p, int width, int sign)
+{
+    uint64_t value = 0;
+
+    memcpy(&value, p, width);
+    if (sign && width < 8)
+        value = (int64_t) (value << (64 - 8 * width)) >> (64 - 8 * width);
+    return value;
+}
+
+// elements before the first zero one
+static uint64_t idiom_scan(const uint8_t *p, uint64_t count, int width)
+{
+    const uint8_t *zero;
+
+    if (width == 1)
+        return (zero = memchr(p, 0, count)) ? zero - p : count;
+    for (uint64_t i = 0; i < count; i++)
+        if (!idiom_element(p + i * width, width, 0))
+            return i;
+    return count;
+}
+
+// all but the last iteration left in the current pages, in bulk
+static void idiom_run_loop(CPU *cpu, BLOCK *block)
+{
+    const IDIOM *m = &block->idiom;
+    uint64_t *x = cpu->regs;
+    uint64_t count = idiom_trip(m, x);
+    uint64_t laddr = 0, saddr = 0;
+    uint8_t *src = NULL, *dst = NULL;
+    int w = m->width;
+    int n = block->n;
+
+    if (m->load.base) {
+        laddr = x[m->load.base] + m->load.offset;
+        if (idiom_page_elems(laddr, w) < count)
+            count = idiom_page_elems(laddr, w);
+    }
+    if (m->store.base) {
+        saddr = x[m->store.base] + m->store.offset;
+        if (idiom_page_elems(saddr, w) < count)
+            count = idiom_page_elems(saddr, w);
+    }
+    if (!count || (m->load.base &&
+                   !(src = cpu_ram_peek(cpu, laddr, count * w, ACCESS_LOAD))))
+        return;
+    if (m->exit == IDIOM_UNTIL_ZERO && !(count = idiom_scan(src, count, w)))
+        return;
+    if (m->store.base) {
+        // a forward copy that stores ahead of its loads is not a memmove
+        if (m->copy && saddr > laddr && saddr < laddr + count * w)
+            return;
+        cpu->inst_pc = cpu->pc;
+        dst = cpu_ram_peek(cpu, saddr, count * w, ACCESS_STORE);
+        if (!dst || !block->n || (m->copy && dst > src && dst < src + count * w))
+            return;  // not mapped yet, or the loop is storing into itself
+        if (m->copy) {
+            memmove(dst, src, count * w);
+        } else if (w == 1) {
+            memset(dst, m->fill ? x[m->fill] : 0, count);
+        } else {
+            uint64_t value = m->fill ? x[m->fill] : 0;
+            for (uint64_t i = 0; i < count; i++)
+                memcpy(dst + i * w, &value, w);
+        }
+    }
+    if (m->data)
+        x[m->data] = idiom_element(src + (count - 1) * w, w, m->sign);
+    for (int i = 0; i < m->nsteps; i++)
+        x[m->step_reg[i]] += count * m->step[i];
+    cpu->instret += count * n;
+    cpu->poll_budget -= count * n;
+    cpu->bcache.idiom_iterations += count;
+}
+
+// bytes from addr up to len, then to the end of addr's page
+static uint64_t idiom_page_bytes(uint64_t addr, uint64_t len)
+{
+    uint64_t left = PAGE_SIZE - PAGE_OFFSET(addr);
+    return len < left ? len : left;
+}
+
+// a whole memcpy, memset or strlen call; 0 to run the function's own code
+static int idiom_run_call(CPU *cpu, BLOCK *block)
+{
+    uint64_t *x = cpu->regs;
+    uint64_t len = x[12];
+    uint8_t *dst, *src;
+
+    cpu->inst_pc = cpu->pc;  // faults are reported at the entry
+    switch (block->idiom.kind) {
+    case IDIOM_MEMCPY:
+        for (uint64_t off = 0, chunk; off < len; off += chunk) {
+            chunk = idiom_page_bytes(x[10] + off, len - off);
+            chunk = idiom_page_bytes(x[11] + off, chunk);
+            if (!(src = cpu_ram_ptr(cpu, x[11] + off, chunk, ACCESS_LOAD)) ||
+                !(dst = cpu_ram_ptr(cpu, x[10] + off, chunk, ACCESS_STORE)))
+                return 0;
+            memmove(dst, src, chunk);
+        }
+        break;
+    case IDIOM_MEMSET:
+        for (uint64_t off = 0, chunk; off < len; off += chunk) {
+            chunk = idiom_page_bytes(x[10] + off, len - off);
+            if (!(dst = cpu_ram_ptr(cpu, x[10] + off, chunk, ACCESS_STORE)))
+                return 0;
+            memset(dst, x[11], chunk);
+        }
+        break;
+    case IDIOM_STRLEN:
+        for (len = 0;;) {
+            uint64_t chunk = idiom_page_bytes(x[10] + len, PAGE_SIZE);
+            uint8_t *zero;
+            if (!(src = cpu_ram_ptr(cpu, x[10] + len, chunk, ACCESS_LOAD)))
+                return 0;
+            if ((zero = memchr(src, 0, chunk))) {
+                len += zero - src;
+                break;
+            }
+            len += chunk;
+        }
+        x[10] = len;
+        break;
+    }
+    cpu->pc = x[1];
+    cpu->instret++;
+    cpu->bcache.idiom_calls++;
+    return 1;
+}
+
+int idiom_run(CPU *cpu, BLOCK *block)
+{
+    if (block->idiom.kind != IDIOM_LOOP)
+        return idiom_run_call(cpu, block);
+    idiom_run_loop(cpu, block);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+
+#include "isa.h"
+#include "isa_decode.h"
+
+const ISA_INFO isa_info[ISA_COUNT] = {
+#define INSN(id, name, mask, match, args, exec, cls) \
+    {name, mask, match, args, cls},
+#include "isa.def"
+#undef INSN
+};
+
+// ---------- Disassembler ----------
+static const char *xreg[] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0",
+    "a1",   "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5",
+    "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+static const char *freg[] = {
+    "ft0", "ft1", "ft2",  "ft3",  "ft4", "ft5", "ft6",  "ft7",
+    "fs0", "fs1", "fa0",  "fa1",  "fa2", "fa3", "fa4",  "fa5",
+    "fa6", "fa7", "fs2",  "fs3",  "fs4", "fs5", "fs6",  "fs7",
+    "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11",
+};
+
+// rounding modes by their rm encoding; 7 (dyn) is left out of the listing
+static const char *rounding[] = {"rne", "rtz", "rdn", "rup",
+                                 "rmm", "?",   "?",   "dyn"};
+
+// fence's access sets, e.g. "iorw, rw"
+static int print_fence(char *buf, size_t size, uint32_t inst)
+{
+    char set[2][5];
+
+    for (int i = 0; i < 2; i++) {
+        int bits = (inst >> (24 - 4 * i)) & 0xf, n = 0;
+        for (int b = 0; b < 4; b++)
+            if (bits & (8 >> b))
+                set[i][n++] = "iorw"[b];
+        set[i][n] = '\0';
+    }
+    return snprintf(buf, size, "%s, %s", set[0], set[1]);
+}
+
+// vtype as vsetvli spells it, e.g. "e32, m2, ta, mu"
+static int print_vtype(char *buf, size_t size, uint32_t vtype)
+{
+    static const char *lmul[] = {"m1", "m2", "m4", "m8", "?", "mf8", "mf4",
+                                 "mf2"};
+
+    return snprintf(buf, size, "e%d, %s, %s, %s", 8 << ((vtype >> 3) & 0x7),
+                    lmul[vtype & 0x7], vtype & 0x40 ? "ta" : "tu",
+                    vtype & 0x80 ? "ma" : "mu");
+}
+
+int isa_disasm(char *buf, size_t size, uint64_t pc, uint32_t inst)
+{
+    int id = isa_decode(inst);
+    const ISA_INFO *info = &isa_info[id];
+    size_t len = snprintf(buf, size, "%-10s ", info->name);
+
+    if (id == ISA_ILLEGAL) {
+        snprintf(buf, size, "%-10s %#x", info->name, inst);
+        return id;
+    }
+    for (const char *a = info->args; *a && len < size; a++) {
+        char *p = buf + len;
+        size_t room = size - len;
+        int n;
+
+        switch (*a) {
+        case 'd':
+            n = snprintf(p, room, "%s", xreg[rd(inst)]);
+            break;
+        case 's':
+            n = snprintf(p, room, "%s", xreg[rs1(inst)]);
+            break;
+        case 't':
+            n = snprintf(p, room, "%s", xreg[rs2(inst)]);
+            break;
+        case 'D':
+            n = snprintf(p, room, "%s", freg[rd(inst)]);
+            break;
+        case 'S':
+            n = snprintf(p, room, "%s", freg[rs1(inst)]);
+            break;
+        case 'T':
+            n = snprintf(p, room, "%s", freg[rs2(inst)]);
+            break;
+        case 'R':
+            n = snprintf(p, room, "%s", freg[rs3(inst)]);
+            break;
+        case 'j':
+        case 'o':
+            n = snprintf(p, room, "%ld", (int64_t) imm_I(inst));
+            break;
+        case 'q':
+            n = snprintf(p, room, "%ld", (int64_t) imm_S(inst));
+            break;
+        case 'b':
+            n = snprintf(p, room, "%#lx", pc + imm_B(inst));
+            break;
+        case 'a':
+            n = snprintf(p, room, "%#lx", pc + imm_J(inst));
+            break;
+        case 'u':
+            n = snprintf(p, room, "%#x", inst >> 12);
+            break;
+        case '>':
+            n = snprintf(p, room, "%u", shamt(inst));
+            break;
+        case '<':
+            n = snprintf(p, room, "%u", shamt(inst) & 0x1f);
+            break;
+        case 'E':
+            n = snprintf(p, room, "%#x", inst >> 20);
+            break;
+        case 'Z':
+            n = snprintf(p, room, "%lu", rs1(inst));
+            break;
+        case 'v':
+            n = snprintf(p, room, "v%lu", rd(inst));
+            break;
+        case 'w':
+            n = snprintf(p, room, "v%lu", rs2(inst));
+            break;
+        case 'y':
+            n = snprintf(p, room, "v%lu", rs1(inst));
+            break;
+        case 'k':
+            n = snprintf(p, room, "%d", (int32_t) (inst << 12) >> 27);
+            break;
+        case 'V':
+            n = print_vtype(p, room, (inst >> 20) & 0x7ff);
+            break;
+        case 'K':
+            n = print_vtype(p, room, (inst >> 20) & 0x3ff);
+            break;
+        case 'm':
+            n = inst & (1 << 25) ? 0 : snprintf(p, room, ", v0.t");
+            break;
+        case 'M':
+            n = snprintf(p, room, "v0");
+            break;
+        case 'r':
+            n = ((inst >> 12) & 0x7) == 0x7
+                    ? 0
+                    : snprintf(p, room, ", %s", rounding[(inst >> 12) & 0x7]);
+            break;
+        case 'p':
+            n = print_fence(p, room, inst);
+            break;
+        case ',':
+            n = snprintf(p, room, ", ");
+            break;
+        default:
+            n = snprintf(p, room, "%c", *a);
+        }
+        len += n;
+    }
+    return id;
+}
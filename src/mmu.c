@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "csr.h"
+#include "mmu.h"
+#include "trap.h"
+
+void mmu_init(CPU *cpu)
+{
+    memset(&cpu->mmu, 0, sizeof(cpu->mmu));
+    mmu_flush_all(cpu);
+    mmu_update_ctx(cpu);
+}
+
+static uint64_t mmu_ctx(CPU *cpu, int priv)
+{
+    uint64_t satp = cpu->csr.satp;
+    uint64_t ctx;
+
+    if (priv == PRIV_M || (satp >> 60) == SATP_MODE_BARE)
+        return TLB_CTX_BARE;
+    ctx = ((satp >> 44) & ((1 << SATP_ASID_BITS) - 1)) << 52;
+    if (priv == PRIV_U)
+        ctx |= TLB_CTX_USER;
+    if (cpu->csr.mstatus & MSTATUS_SUM)
+        ctx |= TLB_CTX_SUM;
+    return ctx;
+}
+
+void mmu_update_ctx(CPU *cpu)
+{
+    uint64_t mstatus = cpu->csr.mstatus;
+    int data_priv = cpu->priv;
+
+    // MPRV makes M-mode loads and stores use the privilege in MPP
+    if (cpu->priv == PRIV_M && (mstatus & MSTATUS_MPRV))
+        data_priv = (mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+    cpu->mmu.ctx_fetch = mmu_ctx(cpu, cpu->priv);
+    cpu->mmu.ctx_data = mmu_ctx(cpu, data_priv);
+}
+
+static void mmu_access_fault(CPU *cpu, uint64_t vaddr, int access)
+{
+    static const uint64_t cause[] = {
+        [ACCESS_LOAD] = EXC_LOAD_ACCESS_FAULT,
+        [ACCESS_STORE] = EXC_STORE_ACCESS_FAULT,
+        [ACCESS_FETCH] = EXC_INST_ACCESS_FAULT,
+    };
+    cpu_exception(cpu, cause[access], vaddr);
+}
+
+static void mmu_page_fault(CPU *cpu, uint64_t vaddr, int access)
+{
+    static const uint64_t cause[] = {
+        [ACCESS_LOAD] = EXC_LOAD_PAGE_FAULT,
+        [ACCESS_STORE] = EXC_STORE_PAGE_FAULT,
+        [ACCESS_FETCH] = EXC_INST_PAGE_FAULT,
+    };
+    cpu_exception(cpu, cause[access], vaddr);
+}
+
+// Translate vaddr for the given access, setting A/D in the leaf PTE.
+// Returns the physical address and the permissions granted by the leaf.
+static uint64_t mmu_walk(CPU *cpu, uint64_t vaddr, int access, int priv,
+                         uint64_t *perm)
+{
+    uint64_t satp = cpu->csr.satp;
+    uint64_t mstatus = cpu->csr.mstatus;
+    int levels = (satp >> 60) == SATP_MODE_SV48 ? 4 : 3;
+    int va_bits = PAGE_SHIFT + 9 * levels;
+    uint64_t table = (satp & ((1ULL << 44) - 1)) << PAGE_SHIFT;
+    uint64_t pte = 0, pte_addr = 0;
+    int level;
+
+    // the address must be sign-extended from bit va_bits - 1
+    if ((int64_t) (vaddr << (64 - va_bits)) >> (64 - va_bits) !=
+        (int64_t) vaddr)
+        mmu_page_fault(cpu, vaddr, access);
+
+    for (level = levels - 1; level >= 0; level--) {
+        uint64_t vpn = (vaddr >> (PAGE_SHIFT + 9 * level)) & 0x1ff;
+        pte_addr = table + vpn * 8;
+        if (pte_addr < DRAM_BASE || pte_addr - DRAM_BASE >= DRAM_SIZE)
+            mmu_access_fault(cpu, vaddr, access);
+        pte = bus_load(cpu->bus, pte_addr, 64);
+        if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)))
+            mmu_page_fault(cpu, vaddr, access);
+        if (pte & (PTE_R | PTE_X))
+            break;
+        table = ((pte >> 10) & ((1ULL << 44) - 1)) << PAGE_SHIFT;
+    }
+    if (level < 0)
+        mmu_page_fault(cpu, vaddr, access);
+
+    // privilege: S-mode may touch U pages only for data and only with SUM
+    if (priv == PRIV_U && !(pte & PTE_U))
+        mmu_page_fault(cpu, vaddr, access);
+    if (priv == PRIV_S && (pte & PTE_U) &&
+        (access == ACCESS_FETCH || !(mstatus & MSTATUS_SUM)))
+        mmu_page_fault(cpu, vaddr, access);
+
+    *perm = pte;
+    if (mstatus & MSTATUS_MXR && pte & PTE_X)
+        *perm |= PTE_R;
+    if ((access == ACCESS_FETCH && !(pte & PTE_X)) ||
+        (access == ACCESS_LOAD && !(*perm & PTE_R)) ||
+        (access == ACCESS_STORE && !(pte & PTE_W)))
+        mmu_page_fault(cpu, vaddr, access);
+
+    // a superpage must be aligned to its size
+    uint64_t ppn = (pte >> 10) & ((1ULL << 44) - 1);
+    uint64_t super_mask = (1ULL << (9 * level)) - 1;
+    if (ppn & super_mask)
+        mmu_page_fault(cpu, vaddr, access);
+
+    uint64_t ad = PTE_A | (access == ACCESS_STORE ? PTE_D : 0);
+    if ((pte & ad) != ad) {
+        pte |= ad;
+        bus_store(cpu->bus, pte_addr, 64, pte);
+        *perm |= ad;
+    }
+
+    ppn |= (vaddr >> PAGE_SHIFT) & super_mask;
+    return (ppn << PAGE_SHIFT) | PAGE_OFFSET(vaddr);
+}
+
+TLB_ENTRY *mmu_fill(CPU *cpu, uint64_t vaddr, int access)
+{
+    MMU *mmu = &cpu->mmu;
+    uint64_t ctx = access == ACCESS_FETCH ? mmu->ctx_fetch : mmu->ctx_data;
+    TLB_ENTRY *e = access == ACCESS_FETCH ? &mmu->itlb[TLB_INDEX(vaddr)]
+                                          : &mmu->dtlb[TLB_INDEX(vaddr)];
+    uint64_t tag = TLB_TAG(vaddr, ctx);
+    uint64_t perm = PTE_R | PTE_W | PTE_X | PTE_D;
+    uint64_t paddr = vaddr;
+
+    if (!(ctx & TLB_CTX_BARE)) {
+        int priv = ctx & TLB_CTX_USER ? PRIV_U : PRIV_S;
+        paddr = mmu_walk(cpu, vaddr, access, priv, &perm);
+    }
+    paddr -= PAGE_OFFSET(paddr);
+
+    uintptr_t addend = 0;
+    if (paddr >= DRAM_BASE && paddr - DRAM_BASE < DRAM_SIZE)
+        addend = (uintptr_t) &cpu->bus->dram.mem[paddr - DRAM_BASE] -
+                 (vaddr - PAGE_OFFSET(vaddr));
+    else if (access == ACCESS_FETCH || !bus_has_device(cpu->bus, paddr))
+        mmu_access_fault(cpu, vaddr, access);
+
+    e->paddr = paddr;
+    e->addend = addend;
+    e->asid = (ctx >> 52) & ((1 << SATP_ASID_BITS) - 1);
+    e->global = (perm & PTE_G) != 0;
+    if (access == ACCESS_FETCH) {
+        e->tag = tag;
+        e->tag_write = TLB_INVALID;
+    } else {
+        e->tag = (perm & PTE_R) ? tag : TLB_INVALID;
+        // a clean page keeps missing on stores until the walk sets D, and
+        // while stats log dirty pages a RAM page until a store fills it
+        e->tag_write = (perm & PTE_W) && (perm & PTE_D) &&
+                               (!cpu->stats || !addend || access == ACCESS_STORE)
+                           ? tag
+                           : TLB_INVALID;
+        if (cpu->stats && addend && e->tag_write != TLB_INVALID) {
+            uint64_t page = DRAM_PAGE(paddr);
+            cpu->bus->dram.dirty_map[page / 64] |= 1ULL << (page % 64);
+        }
+    }
+    return e;
+}
+
+static void tlb_flush(TLB_ENTRY *tlb, int n, int by_vaddr, uint64_t vaddr,
+                      int by_asid, uint64_t asid)
+{
+    for (int i = 0; i < n; i++) {
+        TLB_ENTRY *e = &tlb[i];
+        uint64_t tag = e->tag != TLB_INVALID ? e->tag : e->tag_write;
+        if (tag == TLB_INVALID || (tag & TLB_CTX_BARE))
+            continue;  // untranslated entries never go stale
+        if (by_vaddr && ((tag ^ (vaddr >> PAGE_SHIFT)) & ((1ULL << 52) - 1)))
+            continue;
+        if (by_asid && (e->global || e->asid != asid))
+            continue;
+        e->tag = e->tag_write = TLB_INVALID;
+    }
+}
+
+void mmu_flush(CPU *cpu, int by_vaddr, uint64_t vaddr, int by_asid,
+               uint64_t asid)
+{
+    asid &= (1 << SATP_ASID_BITS) - 1;
+    if (by_vaddr) {
+        // only one slot can hold the page
+        tlb_flush(&cpu->mmu.itlb[TLB_INDEX(vaddr)], 1, 1, vaddr, by_asid,
+                  asid);
+        tlb_flush(&cpu->mmu.dtlb[TLB_INDEX(vaddr)], 1, 1, vaddr, by_asid,
+                  asid);
+        return;
+    }
+    tlb_flush(cpu->mmu.itlb, TLB_SIZE, 0, 0, by_asid, asid);
+    tlb_flush(cpu->mmu.dtlb, TLB_SIZE, 0, 0, by_asid, asid);
+}
+
+void mmu_flush_all(CPU *cpu)
+{
+    for (int i = 0; i < TLB_SIZE; i++) {
+        cpu->mmu.itlb[i].tag = cpu->mmu.itlb[i].tag_write = TLB_INVALID;
+        cpu->mmu.dtlb[i].tag = cpu->mmu.dtlb[i].tag_write = TLB_INVALID;
+    }
+}
+
+void mmu_flush_writes(CPU *cpu)
+{
+    for (int i = 0; i < TLB_SIZE; i++)
+        cpu->mmu.dtlb[i].tag_write = TLB_INVALID;
+}
+
+void mmu_dump_stats(CPU *cpu)
+{
+    MMU *mmu = &cpu->mmu;
+
+    fprintf(stderr, "ITLB: %lu hits, %lu misses\n", mmu->itlb_hits,
+            mmu->itlb_misses);
+    fprintf(stderr, "DTLB: %lu hits, %lu misses\n", mmu->dtlb_hits,
+            mmu->dtlb_misses);
+}
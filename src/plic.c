@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "plic.h"
+
+void plic_init(PLIC *plic)
+{
+    memset(plic, 0, sizeof(*plic));
+    pthread_mutex_init(&plic->lock, NULL);
+}
+
+void plic_reset(PLIC *plic)
+{
+    pthread_mutex_lock(&plic->lock);
+    memset(plic->priority, 0, sizeof(plic->priority));
+    plic->level = plic->pending = plic->claimed = 0;
+    memset(plic->enable, 0, sizeof(plic->enable));
+    memset(plic->threshold, 0, sizeof(plic->threshold));
+    pthread_mutex_unlock(&plic->lock);
+}
+
+// the highest priority pending and enabled source of a context, or 0
+static int plic_best(PLIC *plic, int context)
+{
+    uint32_t candidates = plic->pending & plic->enable[context] & ~1u;
+    int best = 0;
+    uint32_t best_priority = plic->threshold[context];
+
+    while (candidates) {
+        int irq = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+        if (plic->priority[irq] > best_priority) {
+            best = irq;
+            best_priority = plic->priority[irq];
+        }
+    }
+    return best;
+}
+
+// called with plic->lock held
+static void plic_update(PLIC *plic)
+{
+    for (int context = 0; context < PLIC_CONTEXTS; context++) {
+        if (plic->notify)
+            plic->notify(plic->opaque, context, plic_best(plic, context) != 0);
+    }
+}
+
+void plic_set_irq(PLIC *plic, int irq, int level)
+{
+    uint32_t bit = 1u << irq;
+
+    pthread_mutex_lock(&plic->lock);
+    if (level) {
+        plic->level |= bit;
+        if (!(plic->claimed & bit))
+            plic->pending |= bit;
+    } else {
+        plic->level &= ~bit;
+        plic->pending &= ~bit;
+    }
+    plic_update(plic);
+    pthread_mutex_unlock(&plic->lock);
+}
+
+uint64_t plic_load(PLIC *plic, uint64_t addr, uint64_t size)
+{
+    uint64_t offset = addr - PLIC_BASE;
+    uint64_t value = 0;
+
+    pthread_mutex_lock(&plic->lock);
+    if (offset < PLIC_PENDING) {
+        if (offset / 4 < PLIC_SOURCES)
+            value = plic->priority[offset / 4];
+    } else if (offset == PLIC_PENDING) {
+        value = plic->pending;
+    } else if (offset >= PLIC_ENABLE && offset < PLIC_CONTEXT) {
+        int context = (offset - PLIC_ENABLE) / PLIC_ENABLE_STRIDE;
+        if (context < PLIC_CONTEXTS &&
+            (offset - PLIC_ENABLE) % PLIC_ENABLE_STRIDE == 0)
+            value = plic->enable[context];
+    } else if (offset >= PLIC_CONTEXT) {
+        int context = (offset - PLIC_CONTEXT) / PLIC_CONTEXT_STRIDE;
+        int reg = (offset - PLIC_CONTEXT) % PLIC_CONTEXT_STRIDE;
+        if (context < PLIC_CONTEXTS && reg == 0) {
+            value = plic->threshold[context];
+        } else if (context < PLIC_CONTEXTS && reg == 4) {
+            // claim
+            int irq = plic_best(plic, context);
+            if (irq) {
+                plic->pending &= ~(1u << irq);
+                plic->claimed |= 1u << irq;
+                plic_update(plic);
+            }
+            value = irq;
+        }
+    }
+    pthread_mutex_unlock(&plic->lock);
+    return value;
+}
+
+void plic_store(PLIC *plic, uint64_t addr, uint64_t size, uint64_t value)
+{
+    uint64_t offset = addr - PLIC_BASE;
+
+    pthread_mutex_lock(&plic->lock);
+    if (offset < PLIC_PENDING) {
+        if (offset / 4 < PLIC_SOURCES)
+            plic->priority[offset / 4] = value & 0x7;
+    } else if (offset >= PLIC_ENABLE && offset < PLIC_CONTEXT) {
+        int context = (offset - PLIC_ENABLE) / PLIC_ENABLE_STRIDE;
+        if (context < PLIC_CONTEXTS &&
+            (offset - PLIC_ENABLE) % PLIC_ENABLE_STRIDE == 0)
+            plic->enable[context] = value;
+    } else if (offset >= PLIC_CONTEXT) {
+        int context = (offset - PLIC_CONTEXT) / PLIC_CONTEXT_STRIDE;
+        int reg = (offset - PLIC_CONTEXT) % PLIC_CONTEXT_STRIDE;
+        if (context < PLIC_CONTEXTS && reg == 0) {
+            plic->threshold[context] = value & 0x7;
+        } else if (context < PLIC_CONTEXTS && reg == 4 &&
+                   value < PLIC_SOURCES) {
+            // complete: a line that is still high becomes pending again
+            uint32_t bit = 1u << value;
+            plic->claimed &= ~bit;
+            if (plic->level & bit)
+                plic->pending |= bit;
+        }
+    }
+    plic_update(plic);
+    pthread_mutex_unlock(&plic->lock);
+}
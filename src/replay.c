@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "replay.h"
+
+static const char replay_magic[8] = {'R', 'V', 'R', 'R', 0, 0, 0, 1};
+
+static void replay_fail(REPLAY *r, const char *why)
+    __attribute__((noreturn));
+
+static void replay_fail(REPLAY *r, const char *why)
+{
+    fprintf(stderr, "Replay diverged at instret %lu, event %lu: %s\n",
+            r->cpu ? r->cpu->instret : 0, r->events, why);
+    exit(1);
+}
+
+// LEB128
+static void replay_put(REPLAY *r, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), r->log);
+    } while (value);
+}
+
+static uint64_t replay_get(REPLAY *r)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    int c;
+
+    do {
+        if ((c = fgetc(r->log)) == EOF || shift > 63)
+            replay_fail(r, "the log is truncated");
+        value |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return value;
+}
+
+// read the type of the next event, and the instret of a mip change
+static void replay_peek(REPLAY *r)
+{
+    int c = fgetc(r->log);
+
+    r->next = c == EOF ? REPLAY_END : c;
+    if (r->next == REPLAY_MIP)
+        r->next_instret = r->instret + replay_get(r);
+}
+
+// an event was consumed mid-block; if a mip change is next, poll at the
+// end of the block to schedule it
+static void replay_advance(REPLAY *r)
+{
+    r->events++;
+    replay_peek(r);
+    if (r->next == REPLAY_MIP)
+        r->cpu->poll_budget = 0;
+}
+
+REPLAY *replay_open(const char *spec)
+{
+    int play = !strncmp(spec, "replay:", 7);
+    REPLAY *r;
+    char magic[8];
+
+    if (!play && strncmp(spec, "record:", 7)) {
+        fprintf(stderr, "Bad record/replay option %s\n", spec);
+        return NULL;
+    }
+    if (!(r = calloc(1, sizeof(REPLAY)))) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    r->mode = play ? REPLAY_PLAY : REPLAY_RECORD;
+    r->log = fopen(spec + 7, play ? "rb" : "wb");
+    if (!r->log) {
+        fprintf(stderr, "Unable to open replay log %s\n", spec + 7);
+        free(r);
+        return NULL;
+    }
+    if (!play) {
+        fwrite(replay_magic, 1, sizeof(magic), r->log);
+        return r;
+    }
+    if (fread(magic, 1, sizeof(magic), r->log) != sizeof(magic) ||
+        memcmp(magic, replay_magic, sizeof(magic))) {
+        fprintf(stderr, "%s is not a replay log\n", spec + 7);
+        fclose(r->log);
+        free(r);
+        return NULL;
+    }
+    replay_peek(r);
+    return r;
+}
+
+void replay_attach(REPLAY *r, CPU *cpu)
+{
+    r->cpu = cpu;
+    cpu->replay = r;
+    cpu->bus->clint.replay = r;
+    cpu->bus->virtio_blk.replay = r;
+}
+
+uint64_t replay_input(REPLAY *r, int type, uint64_t live)
+{
+    uint64_t value;
+
+    if (r->mode == REPLAY_RECORD) {
+        fputc(type, r->log);
+        replay_put(r, type == REPLAY_TIME ? live - r->time : live);
+        if (type == REPLAY_TIME)
+            r->time = live;
+        r->events++;
+        return live;
+    }
+    if (r->next != type)
+        replay_fail(r, "the guest took inputs in another order");
+    value = replay_get(r);
+    if (type == REPLAY_TIME)
+        value = r->time += value;
+    replay_advance(r);
+    return value;
+}
+
+void replay_data(REPLAY *r, void *dst, const void *src, uint64_t len)
+{
+    if (r->mode == REPLAY_RECORD) {
+        memcpy(dst, src, len);
+        fputc(REPLAY_DATA, r->log);
+        replay_put(r, len);
+        fwrite(dst, 1, len, r->log);
+        r->events++;
+        return;
+    }
+    if (r->next != REPLAY_DATA || replay_get(r) != len)
+        replay_fail(r, "a device completed another request");
+    if (fread(dst, 1, len, r->log) != len)
+        replay_fail(r, "the log is truncated");
+    replay_advance(r);
+}
+
+void replay_poll(CPU *cpu)
+{
+    REPLAY *r = cpu->replay;
+
+    if (r->mode == REPLAY_RECORD) {
+        uint64_t mip = cpu_mip_live(cpu) & REPLAY_ASYNC_MIP;
+        if (mip != r->mip) {
+            fputc(REPLAY_MIP, r->log);
+            replay_put(r, cpu->instret - r->instret);
+            replay_put(r, mip);
+            r->instret = cpu->instret;
+            r->mip = mip;
+            r->events++;
+        }
+        return;
+    }
+    if (r->next != REPLAY_MIP)
+        return;
+    if (r->next_instret < cpu->instret)
+        replay_fail(r, "an interrupt poll was missed");
+    if (r->next_instret == cpu->instret) {
+        r->mip = replay_get(r);
+        r->instret = r->next_instret;
+        r->events++;
+        replay_peek(r);
+    }
+    // the poll budget is the only per-block check: cut it to land on
+    // the next change
+    if (r->next == REPLAY_MIP &&
+        r->next_instret - cpu->instret < (uint64_t) cpu->poll_budget)
+        cpu->poll_budget = r->next_instret - cpu->instret;
+}
+
+void replay_close(REPLAY *r)
+{
+    if (r->mode == REPLAY_RECORD) {
+        fflush(r->log);
+        fprintf(stderr, "Replay: %lu events recorded, %ld bytes\n", r->events,
+                ftell(r->log));
+    } else if (r->next != REPLAY_END) {
+        fprintf(stderr, "Replay: %lu events replayed, the log has more\n",
+                r->events);
+    } else {
+        fprintf(stderr, "Replay: %lu events replayed\n", r->events);
+    }
+    fclose(r->log);
+}
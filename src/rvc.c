@@ -0,0 +1,221 @@
+#include "isa.h"
+#include "rvc.h"
+
+uint32_t rvc_cache[1 << 16];
+
+// fields of the compressed formats
+#define C_RD(c) (((c) >> 7) & 0x1f)
+#define C_RS2(c) (((c) >> 2) & 0x1f)
+#define C_RDP(c) (8 + (((c) >> 2) & 0x7))   // rd' / rs2' in bits 4..2
+#define C_RS1P(c) (8 + (((c) >> 7) & 0x7))  // rs1' / rd' in bits 9..7
+#define BIT(c, from, to) ((((c) >> (from)) & 1) << (to))
+
+// the fixed bits of an instruction, as isa.def spells them
+#define MATCH(id) isa_info[ISA_##id].match
+
+// 32-bit instruction encoders: the operand fields over the fixed bits
+static uint32_t enc_R(uint32_t match, uint32_t rs2, uint32_t rs1, uint32_t rd)
+{
+    return match | rs2 << 20 | rs1 << 15 | rd << 7;
+}
+
+static uint32_t enc_I(uint32_t match, int32_t imm, uint32_t rs1, uint32_t rd)
+{
+    return match | (uint32_t) imm << 20 | rs1 << 15 | rd << 7;
+}
+
+static uint32_t enc_S(uint32_t match, int32_t imm, uint32_t rs2, uint32_t rs1)
+{
+    return match | ((uint32_t) imm >> 5 & 0x7f) << 25 | rs2 << 20 |
+           rs1 << 15 | ((uint32_t) imm & 0x1f) << 7;
+}
+
+static uint32_t enc_B(uint32_t match, int32_t imm, uint32_t rs2, uint32_t rs1)
+{
+    uint32_t u = imm;
+    return match | (u >> 12 & 1) << 31 | (u >> 5 & 0x3f) << 25 | rs2 << 20 |
+           rs1 << 15 | (u >> 1 & 0xf) << 8 | (u >> 11 & 1) << 7;
+}
+
+static uint32_t enc_J(int32_t imm, uint32_t rd)
+{
+    uint32_t u = imm;
+    return MATCH(JAL) | (u >> 20 & 1) << 31 | (u >> 1 & 0x3ff) << 21 |
+           (u >> 11 & 1) << 20 | (u >> 12 & 0xff) << 12 | rd << 7;
+}
+
+// sign-extend the low `bits` bits of x
+static int32_t sext(uint32_t x, int bits)
+{
+    return (int32_t) (x << (32 - bits)) >> (32 - bits);
+}
+
+// 6-bit immediate of C.ADDI, C.LI, C.ANDI, ...: imm[5] = c[12], imm[4:0]
+static int32_t imm_CI(uint16_t c)
+{
+    return sext(BIT(c, 12, 5) | ((c >> 2) & 0x1f), 6);
+}
+
+// uimm[5:3] = c[12:10], uimm[7:6] = c[6:5] (C.LD, C.SD, C.FLD, C.FSD)
+static uint32_t uimm_CL_D(uint16_t c)
+{
+    return ((c >> 7) & 0x38) | ((c << 1) & 0xc0);
+}
+
+// uimm[5:3] = c[12:10], uimm[2] = c[6], uimm[6] = c[5] (C.LW, C.SW)
+static uint32_t uimm_CL_W(uint16_t c)
+{
+    return ((c >> 7) & 0x38) | BIT(c, 6, 2) | BIT(c, 5, 6);
+}
+
+static uint32_t expand_q0(uint16_t c)
+{
+    uint32_t rd = C_RDP(c), rs1 = C_RS1P(c);
+
+    switch ((c >> 13) & 0x7) {
+    case 0x0: {  // C.ADDI4SPN
+        uint32_t imm = ((c >> 7) & 0x30) | ((c >> 1) & 0x3c0) |
+                       BIT(c, 6, 2) | BIT(c, 5, 3);
+        if (imm == 0)
+            return 0;  // includes the all-zero parcel
+        return enc_I(MATCH(ADDI), imm, 2, rd);
+    }
+    case 0x1:  // C.FLD
+        return enc_I(MATCH(FLD), uimm_CL_D(c), rs1, rd);
+    case 0x2:  // C.LW
+        return enc_I(MATCH(LW), uimm_CL_W(c), rs1, rd);
+    case 0x3:  // C.LD
+        return enc_I(MATCH(LD), uimm_CL_D(c), rs1, rd);
+    case 0x5:  // C.FSD
+        return enc_S(MATCH(FSD), uimm_CL_D(c), rd, rs1);
+    case 0x6:  // C.SW
+        return enc_S(MATCH(SW), uimm_CL_W(c), rd, rs1);
+    case 0x7:  // C.SD
+        return enc_S(MATCH(SD), uimm_CL_D(c), rd, rs1);
+    default:
+        return 0;
+    }
+}
+
+static uint32_t expand_q1(uint16_t c)
+{
+    uint32_t rd = C_RD(c);
+    uint32_t rdp = C_RS1P(c), rs2p = C_RDP(c);
+
+    switch ((c >> 13) & 0x7) {
+    case 0x0:  // C.ADDI, C.NOP
+        return enc_I(MATCH(ADDI), imm_CI(c), rd, rd);
+    case 0x1:  // C.ADDIW
+        if (rd == 0)
+            return 0;
+        return enc_I(MATCH(ADDIW), imm_CI(c), rd, rd);
+    case 0x2:  // C.LI
+        return enc_I(MATCH(ADDI), imm_CI(c), 0, rd);
+    case 0x3:
+        if (rd == 2) {  // C.ADDI16SP
+            int32_t imm = sext(BIT(c, 12, 9) | BIT(c, 6, 4) | BIT(c, 5, 6) |
+                                   ((c << 4) & 0x180) | BIT(c, 2, 5),
+                               10);
+            if (imm == 0)
+                return 0;
+            return enc_I(MATCH(ADDI), imm, 2, 2);
+        } else {  // C.LUI
+            int32_t imm = imm_CI(c);
+            if (imm == 0)
+                return 0;
+            return MATCH(LUI) | (uint32_t) imm << 12 | rd << 7;
+        }
+    case 0x4: {
+        uint32_t shamt = BIT(c, 12, 5) | ((c >> 2) & 0x1f);
+        switch ((c >> 10) & 0x3) {
+        case 0x0:  // C.SRLI
+            return enc_I(MATCH(SRLI), shamt, rdp, rdp);
+        case 0x1:  // C.SRAI
+            return enc_I(MATCH(SRAI), shamt, rdp, rdp);
+        case 0x2:  // C.ANDI
+            return enc_I(MATCH(ANDI), imm_CI(c), rdp, rdp);
+        }
+        static const uint16_t op[2][4] = {
+            {ISA_SUB, ISA_XOR, ISA_OR, ISA_AND},
+            {ISA_SUBW, ISA_ADDW},  // then two reserved encodings
+        };
+        uint32_t word = (c >> 12) & 1, sel = (c >> 5) & 0x3;
+        if (word && sel >= 2)
+            return 0;
+        return enc_R(isa_info[op[word][sel]].match, rs2p, rdp, rdp);
+    }
+    case 0x5: {  // C.J
+        int32_t imm = sext(BIT(c, 12, 11) | BIT(c, 11, 4) | ((c >> 1) & 0x300) |
+                               BIT(c, 8, 10) | BIT(c, 7, 6) | BIT(c, 6, 7) |
+                               ((c >> 2) & 0xe) | BIT(c, 2, 5),
+                           12);
+        return enc_J(imm, 0);
+    }
+    default: {  // C.BEQZ, C.BNEZ
+        int32_t imm = sext(BIT(c, 12, 8) | ((c >> 7) & 0x18) |
+                               ((c << 1) & 0xc0) | ((c >> 2) & 0x6) |
+                               BIT(c, 2, 5),
+                           9);
+        return enc_B((c & 0x2000) ? MATCH(BNE) : MATCH(BEQ), imm, 0, rdp);
+    }
+    }
+}
+
+static uint32_t expand_q2(uint16_t c)
+{
+    uint32_t rd = C_RD(c), rs2 = C_RS2(c);
+    // uimm[5] = c[12], uimm[4:3] = c[6:5], uimm[8:6] = c[4:2]
+    uint32_t uimm_d = BIT(c, 12, 5) | ((c >> 2) & 0x18) | ((c << 4) & 0x1c0);
+    // uimm[5:3] = c[12:10], uimm[8:6] = c[9:7]
+    uint32_t uimm_sd = ((c >> 7) & 0x38) | ((c >> 1) & 0x1c0);
+
+    switch ((c >> 13) & 0x7) {
+    case 0x0:  // C.SLLI
+        return enc_I(MATCH(SLLI), BIT(c, 12, 5) | rs2, rd, rd);
+    case 0x1:  // C.FLDSP
+        return enc_I(MATCH(FLD), uimm_d, 2, rd);
+    case 0x2:  // C.LWSP: uimm[5] = c[12], uimm[4:2] = c[6:4], uimm[7:6]
+        if (rd == 0)
+            return 0;
+        return enc_I(MATCH(LW),
+                     BIT(c, 12, 5) | ((c >> 2) & 0x1c) | ((c << 4) & 0xc0), 2,
+                     rd);
+    case 0x3:  // C.LDSP
+        if (rd == 0)
+            return 0;
+        return enc_I(MATCH(LD), uimm_d, 2, rd);
+    case 0x4:
+        if (!(c & 0x1000)) {
+            if (rs2 == 0)  // C.JR
+                return rd ? enc_I(MATCH(JALR), 0, rd, 0) : 0;
+            return enc_R(MATCH(ADD), rs2, 0, rd);  // C.MV
+        }
+        if (rs2 == 0) {
+            if (rd == 0)  // C.EBREAK
+                return MATCH(EBREAK);
+            return enc_I(MATCH(JALR), 0, rd, 1);  // C.JALR
+        }
+        return enc_R(MATCH(ADD), rs2, rd, rd);  // C.ADD
+    case 0x5:  // C.FSDSP
+        return enc_S(MATCH(FSD), uimm_sd, rs2, 2);
+    case 0x6:  // C.SWSP: uimm[5:2] = c[12:9], uimm[7:6] = c[8:7]
+        return enc_S(MATCH(SW), ((c >> 7) & 0x3c) | ((c >> 1) & 0xc0), rs2,
+                     2);
+    default:  // C.SDSP
+        return enc_S(MATCH(SD), uimm_sd, rs2, 2);
+    }
+}
+
+uint32_t rvc_expand(uint16_t c)
+{
+    switch (c & 0x3) {
+    case 0x0:
+        return expand_q0(c);
+    case 0x1:
+        return expand_q1(c);
+    case 0x2:
+        return expand_q2(c);
+    default:
+        return 0;  // not a compressed instruction
+    }
+}
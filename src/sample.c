@@ -0,0 +1,156 @@
+#include <stdio.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "isa.h"
+#include "isa_decode.h"
+#include "sample.h"
+
+#define ANSI_BLUE "\x1b[31m"
+#define ANSI_RESET "\x1b[0m"
+
+void sample_init(SAMPLE *s, uint64_t fast, uint64_t detail)
+{
+    *s = (SAMPLE){.fast = fast, .detail = detail, .switch_at = UINT64_MAX};
+    if (fast == 0) {
+        s->detailed = 1;
+        s->windows = 1;
+    } else if (detail != 0) {
+        s->switch_at = fast;
+    }
+}
+
+// log the access of a load, store or AMO that has just completed; addr and
+// value were taken from the registers before it ran
+static void sample_log_access(CPU *cpu, SAMPLE *s, BLOCK_INSN *in,
+                              ISA_CLASS cls, uint64_t addr, uint64_t value)
+{
+    uint32_t inst = in->inst;
+    int fp = isa_info[in->id].args[0] == 'D';
+    int size = 1 << ((inst >> 12) & 0x3);  // funct3 width
+
+    switch (cls) {
+    case CLASS_LOAD:
+        value = fp ? cpu->fregs[rd(inst)] : cpu->regs[rd(inst)];
+        printf("   load  %d @ %#lx = %#lx\n", size, addr + imm_I(inst), value);
+        s->loads++;
+        break;
+    case CLASS_STORE:
+        printf("   store %d @ %#lx = %#lx\n", size, addr + imm_S(inst), value);
+        s->stores++;
+        break;
+    case CLASS_AMO:
+        printf("   amo   %d @ %#lx = %#lx, was %#lx\n", size, addr, value,
+               cpu->regs[rd(inst)]);
+        s->loads++;
+        s->stores++;
+        break;
+    default:;
+    }
+}
+
+// the detail loop's block_execute
+static void sample_execute(CPU *cpu, SAMPLE *s, BLOCK *block)
+{
+    uint64_t pc = cpu->pc;
+    char buf[80];
+
+    cpu->poll_budget -= block->n;
+    if (cpu->cov)
+        cov_edge(cpu->cov, block->cov_loc);
+    if (cpu->cache)
+        cache_access(cpu->cache, pc, block->paddr, block->bytes, CACHE_FETCH);
+    cpu->bcache.running = block;
+    for (int i = 0; i < block->n; i++) {
+        BLOCK_INSN *in = &block->insn[i];
+        ISA_CLASS cls = isa_info[in->id].cls;
+        int fp_store = isa_info[in->id].args[0] == 'T';
+
+        cpu->regs[0] = 0;  // x0 hardwired to 0 at each cycle
+        uint64_t addr = cpu->regs[rs1(in->inst)];
+        uint64_t value = fp_store ? cpu->fregs[rs2(in->inst)]
+                                  : cpu->regs[rs2(in->inst)];
+
+        isa_disasm(buf, sizeof(buf), pc, in->inst);
+        printf("%s%#lx: %s%s\n", ANSI_BLUE, pc, buf, ANSI_RESET);
+        cpu->inst_pc = pc;
+        pc += in->len;
+        cpu->pc = pc;
+        in->exec(cpu, in->inst);
+        cpu->instret++;
+        s->insns++;
+        s->classes[cls]++;
+        if (cpu->timing)
+            timing_op(cpu->timing, cpu, in, cpu->inst_pc);
+        sample_log_access(cpu, s, in, cls, addr, value);
+        dump_registers(cpu);
+    }
+    cpu->bcache.running = NULL;
+}
+
+static void sample_switch(CPU *cpu, SAMPLE *s)
+{
+    s->detailed = !s->detailed;
+    if (s->detailed) {
+        s->windows++;
+        s->switch_at = cpu->instret + s->detail;
+        printf("--- detail window %lu at instret %lu ---\n", s->windows,
+               cpu->instret);
+    } else {
+        s->switch_at = cpu->instret + s->fast;
+    }
+}
+
+static void sample_run_fast(CPU *cpu, SAMPLE *s)
+{
+    while (cpu->pc != 0 && cpu->instret < s->switch_at) {
+        if (cpu->poll_budget <= 0 ||
+            __atomic_load_n(&cpu->poll_now, __ATOMIC_RELAXED)) {
+            cpu_poll_interrupts(cpu);
+            continue;
+        }
+        block_execute(cpu, block_lookup(cpu, cpu->pc));
+    }
+}
+
+static void sample_run_detail(CPU *cpu, SAMPLE *s)
+{
+    while (cpu->pc != 0 && cpu->instret < s->switch_at) {
+        if (cpu->poll_budget <= 0 ||
+            __atomic_load_n(&cpu->poll_now, __ATOMIC_RELAXED)) {
+            cpu_poll_interrupts(cpu);
+            continue;
+        }
+        sample_execute(cpu, s, block_lookup(cpu, cpu->pc));
+    }
+}
+
+void sample_run(CPU *cpu, SAMPLE *s)
+{
+    while (cpu->pc != 0) {
+        if (cpu->instret >= s->switch_at)
+            sample_switch(cpu, s);
+        if (s->detailed)
+            sample_run_detail(cpu, s);
+        else
+            sample_run_fast(cpu, s);
+    }
+}
+
+void sample_dump_stats(SAMPLE *s)
+{
+    static const char *names[] = {
+        "alu", "mul", "div",    "load", "store", "amo",    "fp",
+        "fdiv", "vec", "branch", "jal", "jalr",  "system",
+    };
+
+    if (s->fast == 0 || s->windows == 0)
+        return;  // not sampling, or never left fast mode
+    fprintf(stderr,
+            "Sampling: %lu windows, %lu instructions, %lu loads, %lu stores\n",
+            s->windows, s->insns, s->loads, s->stores);
+    fprintf(stderr, "Classes:");
+    for (int i = 0; i <= CLASS_SYSTEM; i++)
+        fprintf(stderr, " %s %lu%s", names[i], s->classes[i],
+                i < CLASS_SYSTEM ? "," : "\n");
+}
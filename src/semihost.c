@@ -0,0 +1,194 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "semihost.h"
+
+#define SEMIHOST_ENTRY 0x01f01013  // slli x0, x0, 0x1f
+#define SEMIHOST_EXIT 0x40705013   // srai x0, x0, 7
+
+SEMIHOST *semihost_create(void)
+{
+    SEMIHOST *s = calloc(1, sizeof(SEMIHOST));
+
+    if (!s) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    for (int i = 0; i < SEMIHOST_FILES; i++)
+        s->fds[i] = -1;
+    return s;
+}
+
+// whether the EBREAK being executed is the middle of the call sequence;
+// the sequence has to be in one page, which the fetch of the EBREAK mapped
+static int semihost_sequence(CPU *cpu)
+{
+    uint64_t pc = cpu->inst_pc;
+
+    return cpu->priv != PRIV_U && cpu->pc == pc + 4 &&
+           PAGE_OFFSET(pc) >= 4 && PAGE_OFFSET(pc) <= PAGE_SIZE - 8 &&
+           cpu_fetch(cpu, pc - 4) == SEMIHOST_ENTRY &&
+           cpu_fetch(cpu, pc + 4) == SEMIHOST_EXIT;
+}
+
+// parameter block word i
+static uint64_t semihost_arg(CPU *cpu, int i)
+{
+    return cpu_load(cpu, cpu->regs[11] + 8 * i, 64);
+}
+
+// the host fd of a handle, -1 if it is not open
+static int semihost_fd(SEMIHOST *s, uint64_t handle)
+{
+    return handle < SEMIHOST_FILES ? s->fds[handle] : -1;
+}
+
+static int64_t semihost_open(CPU *cpu, SEMIHOST *s)
+{
+    // fopen modes "r", "rb", "r+", "r+b", "w", "wb", ... "a+b" by mode / 2
+    static const int flags[] = {
+        O_RDONLY, O_RDWR, O_WRONLY | O_CREAT | O_TRUNC,
+        O_RDWR | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND,
+        O_RDWR | O_CREAT | O_APPEND,
+    };
+    uint64_t name = semihost_arg(cpu, 0);
+    uint64_t mode = semihost_arg(cpu, 1);
+    uint64_t len = semihost_arg(cpu, 2);
+    char path[PATH_MAX];
+    int handle, fd;
+
+    if (mode > 11 || len >= sizeof(path))
+        return -1;
+    for (uint64_t i = 0; i < len; i++)
+        path[i] = cpu_load(cpu, name + i, 8);
+    path[len] = '\0';
+    for (handle = 1; handle < SEMIHOST_FILES && s->fds[handle] >= 0; handle++)
+        ;
+    if (handle == SEMIHOST_FILES)
+        return -1;
+    if (!strcmp(path, ":tt"))
+        fd = mode < 4 ? STDIN_FILENO : mode < 8 ? STDOUT_FILENO : STDERR_FILENO;
+    else if ((fd = open(path, flags[mode / 2], 0644)) < 0)
+        return -1;
+    s->fds[handle] = fd;
+    return handle;
+}
+
+static int64_t semihost_close(CPU *cpu, SEMIHOST *s)
+{
+    uint64_t handle = semihost_arg(cpu, 0);
+    int fd = semihost_fd(s, handle);
+
+    if (fd < 0)
+        return -1;
+    s->fds[handle] = -1;
+    return fd > STDERR_FILENO && close(fd) < 0 ? -1 : 0;
+}
+
+// SYS_READ and SYS_WRITE: the bytes not transferred, or -1 on an error
+static int64_t semihost_transfer(CPU *cpu, SEMIHOST *s, int store)
+{
+    int fd = semihost_fd(s, semihost_arg(cpu, 0));
+    uint64_t buf = semihost_arg(cpu, 1);
+    uint64_t len = semihost_arg(cpu, 2);
+    struct iovec iov[SEMIHOST_IOV];
+    uint64_t want = 0;
+    int n = 0;
+    ssize_t done;
+
+    if (fd < 0)
+        return -1;
+    // map every page first, so that a fault comes before any I/O; stop at
+    // memory that is not RAM
+    while (want < len && n < SEMIHOST_IOV) {
+        uint64_t addr = buf + want;
+        uint64_t chunk = PAGE_SIZE - PAGE_OFFSET(addr);
+        if (chunk > len - want)
+            chunk = len - want;
+        void *host =
+            cpu_ram_ptr(cpu, addr, chunk, store ? ACCESS_STORE : ACCESS_LOAD);
+        if (!host)
+            break;
+        iov[n++] = (struct iovec){host, chunk};
+        want += chunk;
+    }
+    if (!n)
+        return len ? -1 : 0;
+    done = store ? readv(fd, iov, n) : writev(fd, iov, n);
+    if (done < 0)
+        return -1;
+    if (store)
+        s->bytes_read += done;
+    else
+        s->bytes_written += done;
+    return len - done;
+}
+
+static int64_t semihost_flen(CPU *cpu, SEMIHOST *s)
+{
+    int fd = semihost_fd(s, semihost_arg(cpu, 0));
+    struct stat st;
+
+    return fd < 0 || fstat(fd, &st) < 0 ? -1 : st.st_size;
+}
+
+// end the run the way a return to pc 0 does
+static void semihost_exit(CPU *cpu, SEMIHOST *s)
+{
+    uint64_t reason = semihost_arg(cpu, 0);
+
+    s->status = reason == ADP_STOPPED_APPLICATION_EXIT
+                    ? (int) semihost_arg(cpu, 1)
+                    : 1;
+    cpu->pc = 0;
+}
+
+int semihost_call(CPU *cpu)
+{
+    SEMIHOST *s = cpu->semihost;
+    uint64_t *x = cpu->regs;
+    int64_t ret;
+
+    if (!semihost_sequence(cpu))
+        return 0;
+    switch (x[10]) {
+    case SYS_OPEN:
+        ret = semihost_open(cpu, s);
+        break;
+    case SYS_CLOSE:
+        ret = semihost_close(cpu, s);
+        break;
+    case SYS_WRITE:
+        ret = semihost_transfer(cpu, s, 0);
+        break;
+    case SYS_READ:
+        ret = semihost_transfer(cpu, s, 1);
+        break;
+    case SYS_FLEN:
+        ret = semihost_flen(cpu, s);
+        break;
+    case SYS_EXIT:
+        semihost_exit(cpu, s);
+        ret = 0;
+        break;
+    default:
+        ret = -1;
+    }
+    x[10] = ret;
+    s->calls++;
+    return 1;
+}
+
+void semihost_dump_stats(SEMIHOST *s)
+{
+    fprintf(stderr,
+            "Semihosting: %lu calls, %lu bytes read, %lu bytes written\n",
+            s->calls, s->bytes_read, s->bytes_written);
+}
@@ -0,0 +1,286 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "stats.h"
+
+static STATS *stats_signalled;  // the exporter SIGUSR1 wakes
+
+static double stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a counter another thread is updating, read whole
+static uint64_t stats_read(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+STATS *stats_create(const char *spec)
+{
+    STATS *s = calloc(1, sizeof(STATS));
+    char *comma, *end;
+
+    if (!s || !(s->path = strdup(spec))) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    s->fd = -1;
+    s->period = 1;
+    if ((comma = strrchr(s->path, ','))) {
+        long period = strtol(comma + 1, &end, 10);
+        if (comma[1] == '\0' || *end != '\0' || period < 0)
+            goto bad;
+        s->period = period;
+        *comma = '\0';
+    }
+    if (!strncmp(s->path, "unix:", 5)) {
+        s->socket = 1;
+        memmove(s->path, s->path + 5, strlen(s->path + 5) + 1);
+        if (strlen(s->path) >= sizeof(((struct sockaddr_un *) 0)->sun_path))
+            goto bad;
+    }
+    if (!*s->path)
+        goto bad;
+    return s;
+
+bad:
+    fprintf(stderr, "Bad stats target %s\n", spec);
+    free(s->path);
+    free(s);
+    return NULL;
+}
+
+void stats_add_hart(STATS *s, CPU *cpu)
+{
+    if (s->nharts < STATS_MAX_HARTS)
+        s->harts[s->nharts++] = cpu;
+    cpu->stats = s;
+}
+
+static uint64_t stats_instret(STATS *s)
+{
+    uint64_t n = 0;
+
+    for (int i = 0; i < s->nharts; i++)
+        n += stats_read(&s->harts[i]->instret);
+    return n;
+}
+
+static void stats_sample(STATS *s)
+{
+    s->history[s->samples++ % STATS_HISTORY] =
+        (STATS_SAMPLE){stats_clock() - s->start, stats_instret(s)};
+}
+
+// guest MIPS since the newest sample about window seconds old (the samples
+// are a second apart, give or take), or since the oldest one while the run
+// is younger than that
+static double stats_mips(STATS *s, STATS_SAMPLE now, double window)
+{
+    uint64_t kept = s->samples < STATS_HISTORY ? s->samples : STATS_HISTORY;
+    STATS_SAMPLE then = s->history[(s->samples - kept) % STATS_HISTORY];
+
+    for (uint64_t k = 1; k <= kept; k++) {
+        STATS_SAMPLE h = s->history[(s->samples - k) % STATS_HISTORY];
+        if (now.time - h.time >= window - 0.5) {
+            then = h;
+            break;
+        }
+    }
+    if (now.time <= then.time)
+        return 0;
+    return (now.instret - then.instret) / (now.time - then.time) / 1e6;
+}
+
+static double stats_rate(uint64_t hits, uint64_t misses)
+{
+    return hits + misses ? (double) hits / (hits + misses) : 0;
+}
+
+// the snapshot as one line of JSON
+static int stats_format(STATS *s, char *buf, size_t size)
+{
+    STATS_SAMPLE now = {stats_clock() - s->start, 0};
+    uint64_t block_hits = 0, block_misses = 0, invalidations = 0;
+    uint64_t itlb_hits = 0, itlb_misses = 0, dtlb_hits = 0, dtlb_misses = 0;
+    uint64_t exceptions = 0, interrupts = 0, dirty = 0;
+    BUS *bus = s->harts[0]->bus;
+
+    for (int i = 0; i < s->nharts; i++) {
+        CPU *cpu = s->harts[i];
+        now.instret += stats_read(&cpu->instret);
+        block_hits += stats_read(&cpu->bcache.hits);
+        block_misses += stats_read(&cpu->bcache.misses);
+        invalidations += stats_read(&cpu->bcache.invalidations);
+        itlb_hits += stats_read(&cpu->mmu.itlb_hits);
+        itlb_misses += stats_read(&cpu->mmu.itlb_misses);
+        dtlb_hits += stats_read(&cpu->mmu.dtlb_hits);
+        dtlb_misses += stats_read(&cpu->mmu.dtlb_misses);
+        exceptions += stats_read(&cpu->counters.exceptions);
+        interrupts += stats_read(&cpu->counters.interrupts);
+        dirty += stats_read(&cpu->counters.dirty_pages);
+        // start the next dirty page interval at the hart's next poll
+        __atomic_store_n(&cpu->counters.cut, 1, __ATOMIC_RELEASE);
+    }
+    return snprintf(
+        buf, size,
+        "{\"time\": %.3f, \"snapshot\": %lu, \"harts\": %d, "
+        "\"instret\": %lu, "
+        "\"mips\": {\"1s\": %.3f, \"10s\": %.3f, \"60s\": %.3f}, "
+        "\"blocks\": {\"hits\": %lu, \"misses\": %lu, \"hit_rate\": %.6f, "
+        "\"invalidated\": %lu}, "
+        "\"itlb\": {\"hits\": %lu, \"misses\": %lu, \"hit_rate\": %.6f}, "
+        "\"dtlb\": {\"hits\": %lu, \"misses\": %lu, \"hit_rate\": %.6f}, "
+        "\"traps\": {\"exceptions\": %lu, \"interrupts\": %lu}, "
+        "\"io\": {\"blk_read\": %lu, \"blk_written\": %lu, "
+        "\"net_rx\": %lu, \"net_tx\": %lu}, "
+        "\"dirty_pages\": %lu}\n",
+        now.time, s->snapshots, s->nharts, now.instret,
+        stats_mips(s, now, 1), stats_mips(s, now, 10), stats_mips(s, now, 60),
+        block_hits, block_misses, stats_rate(block_hits, block_misses),
+        invalidations, itlb_hits, itlb_misses,
+        stats_rate(itlb_hits, itlb_misses), dtlb_hits, dtlb_misses,
+        stats_rate(dtlb_hits, dtlb_misses), exceptions, interrupts,
+        stats_read(&bus->virtio_blk.virtio.bytes_in),
+        stats_read(&bus->virtio_blk.virtio.bytes_out),
+        stats_read(&bus->virtio_net.virtio.bytes_in),
+        stats_read(&bus->virtio_net.virtio.bytes_out), dirty);
+}
+
+// replace the file, so that a reader never sees half a snapshot
+static int stats_write_file(STATS *s, const char *buf, int len)
+{
+    char tmp[strlen(s->path) + 5];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", s->path);
+    if (!(f = fopen(tmp, "w")))
+        return -1;
+    if (fwrite(buf, 1, len, f) != len) {
+        fclose(f);
+        return -1;
+    }
+    if (fclose(f) < 0)
+        return -1;
+    return rename(tmp, s->path);
+}
+
+static int stats_write_socket(STATS *s, const char *buf, int len)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if (s->fd < 0) {
+        strcpy(addr.sun_path, s->path);
+        if ((s->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+            return -1;
+        if (connect(s->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+            goto drop;
+    }
+    for (int sent = 0, n; sent < len; sent += n)
+        if ((n = send(s->fd, buf + sent, len - sent, MSG_NOSIGNAL)) < 0)
+            goto drop;
+    return 0;
+
+drop:
+    // the reader is gone: try again at the next snapshot
+    close(s->fd);
+    s->fd = -1;
+    return -1;
+}
+
+static void stats_export(STATS *s)
+{
+    char buf[1024];
+    int len = stats_format(s, buf, sizeof(buf));
+
+    if (len >= sizeof(buf))
+        return;
+    if ((s->socket ? stats_write_socket : stats_write_file)(s, buf, len) == 0)
+        s->snapshots++;
+}
+
+static void stats_signal(int sig)
+{
+    sem_post(&stats_signalled->wake);
+}
+
+static void *stats_thread(void *arg)
+{
+    STATS *s = arg;
+    struct timespec tick;  // sem_timedwait wants CLOCK_REALTIME
+    uint64_t seconds = 0;
+
+    clock_gettime(CLOCK_REALTIME, &tick);
+    tick.tv_sec++;
+    for (;;) {
+        int woken = sem_timedwait(&s->wake, &tick) == 0;
+        if (!woken && errno != ETIMEDOUT)
+            continue;
+        pthread_mutex_lock(&s->lock);
+        if (woken) {
+            stats_export(s);  // SIGUSR1
+        } else {
+            stats_sample(s);
+            tick.tv_sec++;
+            if (s->period && ++seconds % s->period == 0)
+                stats_export(s);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+void stats_start(STATS *s)
+{
+    struct sigaction sa = {.sa_handler = stats_signal, .sa_flags = SA_RESTART};
+
+    s->start = stats_clock();
+    stats_sample(s);
+    sem_init(&s->wake, 0, 0);
+    pthread_mutex_init(&s->lock, NULL);
+    stats_signalled = s;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    if (pthread_create(&s->thread, NULL, stats_thread, s) != 0) {
+        fprintf(stderr, "Cannot start the stats exporter\n");
+        exit(1);
+    }
+}
+
+void stats_poll(CPU *cpu)
+{
+    uint64_t *map = cpu->bus->dram.dirty_map;
+    uint64_t pages = 0;
+
+    if (!__atomic_load_n(&cpu->counters.cut, __ATOMIC_ACQUIRE))
+        return;
+    // the next store to each page refills its entry and marks it again
+    mmu_flush_writes(cpu);
+    for (int i = 0; i < DRAM_PAGES / 64; i++) {
+        pages += __builtin_popcountll(map[i]);
+        map[i] = 0;
+    }
+    __atomic_store_n(&cpu->counters.dirty_pages, pages, __ATOMIC_RELAXED);
+    __atomic_store_n(&cpu->counters.cut, 0, __ATOMIC_RELAXED);
+}
+
+void stats_close(STATS *s)
+{
+    pthread_mutex_lock(&s->lock);
+    stats_export(s);
+    fprintf(stderr, "Stats: %lu snapshots to %s%s\n", s->snapshots,
+            s->socket ? "unix:" : "", s->path);
+    pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,118 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "symbols.h"
+
+static int symbol_cmp(const void *a, const void *b)
+{
+    const SYMBOL *x = a, *y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// keep named code and data symbols, not sections, files or local labels
+static int symbol_wanted(const Elf64_Sym *sym, const char *name)
+{
+    int type = ELF64_ST_TYPE(sym->st_info);
+
+    return sym->st_shndx != SHN_UNDEF && name[0] && name[0] != '$' &&
+           strncmp(name, ".L", 2) &&
+           (type == STT_FUNC || type == STT_OBJECT || type == STT_NOTYPE);
+}
+
+int symbols_load(SYMBOLS *symbols, const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    symbols->syms = NULL;
+    symbols->count = 0;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < sizeof(Elf64_Ehdr)) {
+        fprintf(stderr, "Unable to read symbols from %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    uint8_t *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return -1;
+
+    Elf64_Ehdr *eh = (Elf64_Ehdr *) file;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+        eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_shoff + (uint64_t) eh->e_shnum * sizeof(Elf64_Shdr) >
+            st.st_size) {
+        fprintf(stderr, "%s is not an ELF64 file\n", path);
+        munmap(file, st.st_size);
+        return -1;
+    }
+    Elf64_Shdr *sh = (Elf64_Shdr *) (file + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+            continue;
+        Elf64_Shdr *strtab = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset + sh[i].sh_size > st.st_size ||
+            strtab->sh_offset + strtab->sh_size > st.st_size)
+            continue;
+        Elf64_Sym *sym = (Elf64_Sym *) (file + sh[i].sh_offset);
+        int n = sh[i].sh_size / sizeof(Elf64_Sym);
+        const char *names = (const char *) file + strtab->sh_offset;
+
+        symbols->syms = realloc(symbols->syms,
+                                (symbols->count + n) * sizeof(SYMBOL));
+        for (int j = 0; j < n; j++) {
+            if (sym[j].st_name >= strtab->sh_size ||
+                !symbol_wanted(&sym[j], names + sym[j].st_name))
+                continue;
+            symbols->syms[symbols->count++] =
+                (SYMBOL){sym[j].st_value, sym[j].st_size,
+                         strndup(names + sym[j].st_name,
+                                 strtab->sh_size - sym[j].st_name)};
+        }
+    }
+    munmap(file, st.st_size);
+    qsort(symbols->syms, symbols->count, sizeof(SYMBOL), symbol_cmp);
+    return 0;
+}
+
+const SYMBOL *symbols_lookup(const SYMBOLS *symbols, uint64_t addr)
+{
+    int lo = 0, hi = symbols->count;
+
+    // the last symbol at or below addr
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols->syms[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? &symbols->syms[lo - 1] : NULL;
+}
+
+const SYMBOL *symbols_find(const SYMBOLS *symbols, const char *name)
+{
+    for (int i = 0; i < symbols->count; i++)
+        if (!strcmp(symbols->syms[i].name, name))
+            return &symbols->syms[i];
+    return NULL;
+}
+
+void symbols_format(const SYMBOLS *symbols, uint64_t addr, char *buf,
+                    int size)
+{
+    const SYMBOL *sym = symbols_lookup(symbols, addr);
+
+    if (!sym)
+        snprintf(buf, size, "%#lx", addr);
+    else if (addr == sym->addr)
+        snprintf(buf, size, "%s", sym->name);
+    else
+        snprintf(buf, size, "%s+%#lx", sym->name, addr - sym->addr);
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "isa.h"
+#include "isa_decode.h"
+#include "tier.h"
+
+// ---------- Ops ----------
+// Ops other than tier_generic never fault, never read inst_pc and never
+// write x0, so x0 stays zero from the block's entry to its next exec. The
+// one exception is a store into a page the host protects for a watchpoint,
+// which is why stores publish inst_pc before they write.
+
+// the tier 1 way: everything up to date, then the instruction's exec
+static void tier_generic(CPU *cpu, const TIER_OP *op, uint64_t base)
+{
+    cpu->instret = base + op->index;
+    cpu->inst_pc = op->pc;
+    cpu->pc = op->pc + op->in.len;
+    op->in.exec(cpu, op->in.inst);
+    cpu->regs[0] = 0;
+    cpu->instret++;
+}
+
+// an ALU op without its own handler; it only writes rd
+static void tier_exec(CPU *cpu, const TIER_OP *op, uint64_t base)
+{
+    op->in.exec(cpu, op->in.inst);
+}
+
+static void tier_const(CPU *cpu, const TIER_OP *op, uint64_t base)
+{
+    cpu->regs[op->rd] = op->imm;
+}
+
+// ALU ops on rs1 and rs2, or on rs1 and the immediate
+#define TIER_ALU_RR(name, expr)                                            \
+    static void tier_##name(CPU *cpu, const TIER_OP *op, uint64_t base)    \
+    {                                                                      \
+        uint64_t a = cpu->regs[op->rs1], b = cpu->regs[op->rs2];           \
+        cpu->regs[op->rd] = (expr);                                        \
+    }
+
+#define TIER_ALU_RI(name, expr)                                            \
+    static void tier_##name(CPU *cpu, const TIER_OP *op, uint64_t base)    \
+    {                                                                      \
+        uint64_t a = cpu->regs[op->rs1], b = op->imm;                      \
+        cpu->regs[op->rd] = (expr);                                        \
+    }
+
+TIER_ALU_RR(add, a + b)
+TIER_ALU_RR(sub, a - b)
+TIER_ALU_RR(and, a & b)
+TIER_ALU_RR(or, a | b)
+TIER_ALU_RR(xor, a ^ b)
+TIER_ALU_RI(addi, a + b)
+TIER_ALU_RI(andi, a & b)
+TIER_ALU_RI(ori, a | b)
+TIER_ALU_RI(xori, a ^ b)
+TIER_ALU_RI(slli, a << b)
+TIER_ALU_RI(srli, a >> b)
+TIER_ALU_RI(srai, (int64_t) a >> b)
+
+// loads and stores on a DTLB hit in a RAM page, else the generic way
+#define TIER_LOAD(name, type)                                              \
+    static void tier_##name(CPU *cpu, const TIER_OP *op, uint64_t base)    \
+    {                                                                      \
+        uint64_t addr = cpu->regs[op->rs1] + op->imm;                      \
+        TLB_ENTRY *e = &cpu->mmu.dtlb[TLB_INDEX(addr)];                    \
+                                                                           \
+        if (e->tag != TLB_TAG(addr, cpu->mmu.ctx_data) || !e->addend ||    \
+            PAGE_OFFSET(addr) > PAGE_SIZE - sizeof(type)) {                \
+            tier_generic(cpu, op, base);                                   \
+            return;                                                        \
+        }                                                                  \
+        type value = *(type *) (addr + e->addend);                         \
+        cpu->mmu.dtlb_hits++;                                              \
+        cpu->regs[op->rd] = (int64_t) value;                               \
+    }
+
+#define TIER_STORE(name, type)                                             \
+    static void tier_##name(CPU *cpu, const TIER_OP *op, uint64_t base)    \
+    {                                                                      \
+        uint64_t addr = cpu->regs[op->rs1] + op->imm;                      \
+        TLB_ENTRY *e = &cpu->mmu.dtlb[TLB_INDEX(addr)];                    \
+                                                                           \
+        if (e->tag_write != TLB_TAG(addr, cpu->mmu.ctx_data) ||            \
+            !e->addend || PAGE_OFFSET(addr) > PAGE_SIZE - sizeof(type) ||  \
+            dram_write_tracked(&cpu->bus->dram, e->paddr)) {               \
+            tier_generic(cpu, op, base);                                   \
+            return;                                                        \
+        }                                                                  \
+        cpu->mmu.dtlb_hits++;                                              \
+        cpu->inst_pc = op->pc;  /* for a watchpoint fault */               \
+        *(type *) (addr + e->addend) = cpu->regs[op->rs2];                 \
+    }
+
+TIER_LOAD(lb, int8_t)
+TIER_LOAD(lh, int16_t)
+TIER_LOAD(lw, int32_t)
+TIER_LOAD(ld, int64_t)
+TIER_LOAD(lbu, uint8_t)
+TIER_LOAD(lhu, uint16_t)
+TIER_LOAD(lwu, uint32_t)
+TIER_STORE(sb, uint8_t)
+TIER_STORE(sh, uint16_t)
+TIER_STORE(sw, uint32_t)
+TIER_STORE(sd, uint64_t)
+
+#define TIER_BRANCH(name, cond)                                            \
+    static void tier_##name(CPU *cpu, const TIER_OP *op, uint64_t base)    \
+    {                                                                      \
+        uint64_t a = cpu->regs[op->rs1], b = cpu->regs[op->rs2];           \
+        cpu->pc = (cond) ? op->imm : op->pc + op->in.len;                  \
+    }
+
+TIER_BRANCH(beq, a == b)
+TIER_BRANCH(bne, a != b)
+TIER_BRANCH(blt, (int64_t) a < (int64_t) b)
+TIER_BRANCH(bge, (int64_t) a >= (int64_t) b)
+TIER_BRANCH(bltu, a < b)
+TIER_BRANCH(bgeu, a >= b)
+
+static void tier_j(CPU *cpu, const TIER_OP *op, uint64_t base)
+{
+    cpu->pc = op->imm;
+}
+
+static void tier_jal(CPU *cpu, const TIER_OP *op, uint64_t base)
+{
+    cpu->regs[op->rd] = op->pc + op->in.len;
+    cpu->pc = op->imm;
+}
+
+// the target has bit 0 cleared, so with IALIGN 16 it cannot fault
+static void tier_jalr(CPU *cpu, const TIER_OP *op, uint64_t base)
+{
+    uint64_t target = (cpu->regs[op->rs1] + op->imm) & ~1ULL;
+
+    if (op->rd)
+        cpu->regs[op->rd] = op->pc + op->in.len;
+    cpu->pc = target;
+}
+
+// ---------- Translation ----------
+
+// the handler of an ALU op, with its immediate; NULL to run its exec
+static TIER_RUN tier_alu_run(int id, uint32_t inst, int64_t *imm)
+{
+    *imm = (int64_t) imm_I(inst);
+    switch (id) {
+    case ISA_ADD:
+        return tier_add;
+    case ISA_SUB:
+        return tier_sub;
+    case ISA_AND:
+        return tier_and;
+    case ISA_OR:
+        return tier_or;
+    case ISA_XOR:
+        return tier_xor;
+    case ISA_ADDI:
+        return tier_addi;
+    case ISA_ANDI:
+        return tier_andi;
+    case ISA_ORI:
+        return tier_ori;
+    case ISA_XORI:
+        return tier_xori;
+    }
+    *imm = shamt(inst);
+    switch (id) {
+    case ISA_SLLI:
+        return tier_slli;
+    case ISA_SRLI:
+        return tier_srli;
+    case ISA_SRAI:
+        return tier_srai;
+    default:
+        return NULL;
+    }
+}
+
+static TIER_RUN tier_memory_run(int id)
+{
+    switch (id) {
+    case ISA_LB:
+        return tier_lb;
+    case ISA_LH:
+        return tier_lh;
+    case ISA_LW:
+        return tier_lw;
+    case ISA_LD:
+        return tier_ld;
+    case ISA_LBU:
+        return tier_lbu;
+    case ISA_LHU:
+        return tier_lhu;
+    case ISA_LWU:
+        return tier_lwu;
+    case ISA_SB:
+        return tier_sb;
+    case ISA_SH:
+        return tier_sh;
+    case ISA_SW:
+        return tier_sw;
+    case ISA_SD:
+        return tier_sd;
+    default:
+        return NULL;
+    }
+}
+
+static TIER_RUN tier_branch_run(int id)
+{
+    switch (id) {
+    case ISA_BEQ:
+        return tier_beq;
+    case ISA_BNE:
+        return tier_bne;
+    case ISA_BLT:
+        return tier_blt;
+    case ISA_BGE:
+        return tier_bge;
+    case ISA_BLTU:
+        return tier_bltu;
+    case ISA_BGEU:
+        return tier_bgeu;
+    default:
+        return NULL;
+    }
+}
+
+// the op for one instruction; returns 0 if it does nothing at all
+static int tier_translate_op(TIER_OP *op)
+{
+    uint32_t inst = op->in.inst;
+    int id = op->in.id;
+    int cls = isa_info[id].cls;
+    TIER_RUN run;
+
+    op->run = tier_generic;
+    if (cls == CLASS_ALU || cls == CLASS_MUL || cls == CLASS_DIV) {
+        if (!op->rd)
+            return 0;  // a nop, or a hint
+        if (id == ISA_LUI) {
+            op->run = tier_const;
+            op->imm = (int64_t) (int32_t) (inst & 0xfffff000);
+        } else if (id == ISA_AUIPC) {
+            op->run = tier_const;
+            op->imm = op->pc + (int64_t) imm_U(inst);
+        } else if (!(op->run = tier_alu_run(id, inst, &op->imm))) {
+            op->run = tier_exec;
+        }
+    } else if (cls == CLASS_LOAD && (run = tier_memory_run(id)) && op->rd) {
+        op->run = run;
+        op->imm = (int64_t) imm_I(inst);
+    } else if (cls == CLASS_STORE && (run = tier_memory_run(id))) {
+        op->run = run;
+        op->imm = (int64_t) imm_S(inst);
+    } else if (cls == CLASS_BRANCH && (run = tier_branch_run(id))) {
+        op->run = run;
+        op->imm = op->pc + (int64_t) imm_B(inst);
+    } else if (id == ISA_JAL && !ADDR_MISALIGNED(op->pc + imm_J(inst))) {
+        op->run = op->rd ? tier_jal : tier_j;
+        op->imm = op->pc + (int64_t) imm_J(inst);
+    } else if (id == ISA_JALR) {
+        op->run = tier_jalr;
+        op->imm = (int64_t) imm_I(inst);
+    }
+    return 1;
+}
+
+static TIER_OPS *tier_translate(const TIER_REQUEST *req)
+{
+    TIER_OPS *ops = malloc(sizeof(TIER_OPS) + req->n * sizeof(TIER_OP));
+    uint64_t pc = req->pc;
+    int last_cls = CLASS_ALU;
+
+    if (!ops) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    ops->gen = req->gen;
+    ops->n = 0;
+    ops->count = req->n;
+    for (int i = 0; i < req->n; pc += req->insn[i++].len) {
+        TIER_OP *op = &ops->op[ops->n];
+        TIER_OP *prev = ops->n ? op - 1 : NULL;
+        uint32_t inst = req->insn[i].inst;
+
+        *op = (TIER_OP){.in = req->insn[i], .rd = rd(inst), .rs1 = rs1(inst),
+                        .rs2 = rs2(inst), .index = i, .pc = pc};
+        last_cls = isa_info[op->in.id].cls;
+        if (!tier_translate_op(op))
+            continue;
+        // LUI or AUIPC, then ADDI into the same register: one constant
+        if (op->run == tier_addi && prev && prev->run == tier_const &&
+            prev->rd == op->rd && op->rs1 == op->rd &&
+            prev->index == i - 1) {
+            prev->imm += op->imm;
+            prev->index = i;
+            continue;
+        }
+        ops->n++;
+    }
+    ops->end = pc;
+    ops->tail = TIER_SYNC_INSTRET | TIER_SYNC_PC;
+    if (ops->n && ops->op[ops->n - 1].run == tier_generic &&
+        ops->op[ops->n - 1].index == req->n - 1)
+        ops->tail = 0;  // the last instruction brought everything up to date
+    else if (last_cls >= CLASS_BRANCH)
+        ops->tail = TIER_SYNC_INSTRET;  // a jump op set pc
+    return ops;
+}
+
+// ---------- Worker ----------
+
+static void *tier_thread(void *arg)
+{
+    TIER *t = arg;
+
+    for (;;) {
+        if (sem_wait(&t->wake) < 0)
+            continue;  // EINTR
+        uint32_t tail = t->tail;
+        while (tail != __atomic_load_n(&t->head, __ATOMIC_ACQUIRE)) {
+            const TIER_REQUEST *req = &t->ring[tail % TIER_QUEUE];
+            TIER_OPS *ops = tier_translate(req);
+            BLOCK *block = req->block;
+            TIER_OPS *none = NULL;
+
+            // the request has been read: the hart may reuse the slot
+            __atomic_store_n(&t->tail, ++tail, __ATOMIC_RELEASE);
+            if (__atomic_load_n(&block->gen, __ATOMIC_RELAXED) != ops->gen ||
+                !__atomic_compare_exchange_n(&block->ops, &none, ops, 0,
+                                             __ATOMIC_RELEASE,
+                                             __ATOMIC_RELAXED)) {
+                free(ops);
+                t->stale++;
+                continue;
+            }
+            t->translated++;
+        }
+    }
+    return NULL;
+}
+
+TIER *tier_create(void)
+{
+    TIER *t = aligned_alloc(64, sizeof(TIER));
+
+    if (!t) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    memset(t, 0, sizeof(TIER));
+    sem_init(&t->wake, 0, 0);
+    if (pthread_create(&t->thread, NULL, tier_thread, t) != 0) {
+        fprintf(stderr, "Cannot start the translation thread\n");
+        exit(1);
+    }
+    return t;
+}
+
+// ---------- Hart side ----------
+
+void tier_submit(CPU *cpu, BLOCK *block)
+{
+    TIER *t = cpu->tier;
+    uint32_t head = t->head;
+    TIER_REQUEST *req;
+
+    // ops from an older translation of the slot, which the worker published
+    // after the hart had moved on; the worker never touches published ops
+    free(__atomic_exchange_n(&block->ops, NULL, __ATOMIC_ACQUIRE));
+    if (head - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE) == TIER_QUEUE) {
+        t->dropped++;
+        block->heat = 0;  // try again later
+        return;
+    }
+    req = &t->ring[head % TIER_QUEUE];
+    req->block = block;
+    req->gen = block->gen;
+    req->pc = block->pc;
+    req->n = block->n;
+    memcpy(req->insn, block->insn, block->n * sizeof(BLOCK_INSN));
+    __atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+    t->queued++;
+    sem_post(&t->wake);
+}
+
+void tier_run(CPU *cpu, BLOCK *block, const TIER_OPS *ops)
+{
+    uint64_t base = cpu->instret;
+    const TIER_OP *op = ops->op, *end = ops->op + ops->n;
+
+    cpu->bcache.tier_runs++;
+    cpu->regs[0] = 0;
+    for (; op < end; op++) {
+        op->run(cpu, op, base);
+        if (!block->n) {
+            // the op's store stopped the block: resume after it
+            cpu->instret = base + op->index + 1;
+            cpu->pc = op->pc + op->in.len;
+            return;
+        }
+    }
+    if (ops->tail & TIER_SYNC_INSTRET)
+        cpu->instret = base + ops->count;
+    if (ops->tail & TIER_SYNC_PC)
+        cpu->pc = ops->end;
+}
+
+void tier_dump_stats(CPU *cpu)
+{
+    TIER *t = cpu->tier;
+
+    fprintf(stderr,
+            "Tiers: %lu blocks queued, %lu translated, %lu stale, %lu dropped; "
+            "%lu runs translated\n",
+            t->queued, __atomic_load_n(&t->translated, __ATOMIC_RELAXED),
+            __atomic_load_n(&t->stale, __ATOMIC_RELAXED), t->dropped,
+            cpu->bcache.tier_runs);
+}
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "isa_decode.h"
+#include "timing.h"
+
+static const char *stall_name[STALL_CAUSES] = {
+    "load-use", "mul/div", "fp", "dependency", "branch", "btb", "serialize",
+};
+
+// which register fields each op reads and writes, from its operand string
+static void timing_decode_ops(TIMING *t)
+{
+    for (int id = 0; id < ISA_COUNT; id++) {
+        TIMING_OP *op = &t->ops[id];
+        int n = 0;
+
+        op->cls = isa_info[id].cls;
+        for (const char *a = isa_info[id].args; *a && n < 3; a++) {
+            switch (*a) {
+            case 'd':
+                op->dst = 1;
+                break;
+            case 'D':
+                op->dst = 2;
+                break;
+            case 's':
+                op->src[n++] = 1;
+                break;
+            case 't':
+                op->src[n++] = 2;
+                break;
+            case 'S':
+                op->src[n++] = 1 | 4;
+                break;
+            case 'T':
+                op->src[n++] = 2 | 4;
+                break;
+            case 'R':
+                op->src[n++] = 3 | 4;
+                break;
+            default:;
+            }
+        }
+    }
+}
+
+static int timing_set(TIMING *t, const char *key, const char *value)
+{
+    static const struct {
+        const char *key;
+        int cls;
+    } lat[] = {
+        {"load", CLASS_LOAD}, {"mul", CLASS_MUL},   {"div", CLASS_DIV},
+        {"fp", CLASS_FP},     {"fdiv", CLASS_FDIV}, {"vec", CLASS_VEC},
+    };
+    char *end;
+    long n = strtol(value, &end, 0);
+
+    if (!strcmp(key, "bp")) {
+        if (strcmp(value, "gshare") && strcmp(value, "bimodal"))
+            return -1;
+        t->gshare = !strcmp(value, "gshare");
+        return 0;
+    }
+    if (*end || n < 1)
+        return -1;
+    for (int i = 0; i < sizeof(lat) / sizeof(lat[0]); i++) {
+        if (!strcmp(key, lat[i].key)) {
+            t->latency[lat[i].cls] = n;
+            if (lat[i].cls == CLASS_LOAD)
+                t->latency[CLASS_AMO] = n;
+            return 0;
+        }
+    }
+    if (!strcmp(key, "width"))
+        t->width = n;
+    else if (!strcmp(key, "penalty"))
+        t->penalty = n;
+    else if (!strcmp(key, "ras"))
+        t->ras_size = n;
+    else if (!strcmp(key, "bht") && !(n & (n - 1)))
+        t->bht_bits = __builtin_ctzl(n);
+    else if (!strcmp(key, "btb") && !(n & (n - 1)))
+        t->btb_bits = __builtin_ctzl(n);
+    else
+        return -1;
+    return 0;
+}
+
+TIMING *timing_create(const char *spec)
+{
+    TIMING *t = calloc(1, sizeof(TIMING));
+    char *copy = strdup(spec);
+    char *save, *tok;
+
+    if (!t || !copy) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    // a single-issue five-stage core
+    t->width = 1;
+    for (int i = 0; i <= CLASS_SYSTEM; i++)
+        t->latency[i] = 1;
+    t->latency[CLASS_LOAD] = t->latency[CLASS_AMO] = 2;
+    t->latency[CLASS_MUL] = 3;
+    t->latency[CLASS_DIV] = 20;
+    t->latency[CLASS_FP] = t->latency[CLASS_VEC] = 4;
+    t->latency[CLASS_FDIV] = 20;
+    t->penalty = 3;
+    t->gshare = 1;
+    t->bht_bits = 12;
+    t->btb_bits = 9;
+    t->ras_size = 8;
+
+    for (tok = strtok_r(copy, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+
+        if (!strcmp(tok, "default"))
+            continue;
+        if (!eq)
+            goto bad;
+        *eq = '\0';
+        if (timing_set(t, tok, eq + 1) < 0)
+            goto bad;
+    }
+    free(copy);
+
+    timing_decode_ops(t);
+    t->bht = malloc(1 << t->bht_bits);
+    t->btb_tag = malloc(sizeof(uint64_t) << t->btb_bits);
+    t->btb_target = calloc(1 << t->btb_bits, sizeof(uint64_t));
+    t->ras = calloc(t->ras_size, sizeof(uint64_t));
+    if (!t->bht || !t->btb_tag || !t->btb_target || !t->ras) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    memset(t->bht, 1, 1 << t->bht_bits);  // weakly not taken
+    memset(t->btb_tag, 0xff, sizeof(uint64_t) << t->btb_bits);
+    return t;
+
+bad:
+    fprintf(stderr, "Bad timing configuration %s\n", spec);
+    free(copy);
+    free(t);
+    return NULL;
+}
+
+static inline int timing_reg(uint32_t inst, uint8_t field)
+{
+    static const int shift[] = {7, 15, 20, 27};  // rd, rs1, rs2, rs3
+
+    return ((inst >> shift[field & 0x3]) & 0x1f) + (field & 4 ? 32 : 0);
+}
+
+// whether the BTB predicts target for pc, updating it to target either way
+static int timing_btb(TIMING *t, uint64_t pc, uint64_t target)
+{
+    uint32_t i = (pc >> 1) & ((1 << t->btb_bits) - 1);
+    int hit = t->btb_tag[i] == pc && t->btb_target[i] == target;
+
+    t->btb_tag[i] = pc;
+    t->btb_target[i] = target;
+    return hit;
+}
+
+static void timing_ras_push(TIMING *t, uint64_t addr)
+{
+    t->ras[t->ras_top++ % t->ras_size] = addr;  // overflow overwrites
+}
+
+static uint64_t timing_ras_pop(TIMING *t)
+{
+    if (t->ras_top == 0)
+        return 0;
+    return t->ras[--t->ras_top % t->ras_size];
+}
+
+// predict the control transfer that just resolved; returns the stall cause
+// if the front end got it wrong, or -1
+static int timing_control(TIMING *t, const TIMING_OP *op, uint32_t inst,
+                          uint64_t pc, uint64_t next, uint64_t target)
+{
+    int taken = target != next;
+    int link_rd = rd(inst) == 1 || rd(inst) == 5;
+    int link_rs1 = rs1(inst) == 1 || rs1(inst) == 5;
+
+    switch (op->cls) {
+    case CLASS_BRANCH: {
+        uint64_t index = pc >> 1;
+        if (t->gshare)
+            index ^= t->history;
+        uint8_t *ctr = &t->bht[index & ((1 << t->bht_bits) - 1)];
+        int predicted = *ctr >= 2;
+
+        t->branches++;
+        if (taken && *ctr < 3)
+            (*ctr)++;
+        else if (!taken && *ctr > 0)
+            (*ctr)--;
+        t->history = t->history << 1 | taken;
+        if (predicted != taken) {
+            t->mispredicts++;
+            if (taken)
+                timing_btb(t, pc, target);
+            return STALL_BRANCH;
+        }
+        if (taken && !timing_btb(t, pc, target)) {
+            t->btb_misses++;
+            return STALL_BTB;
+        }
+        return -1;
+    }
+    case CLASS_JAL:
+        t->jumps++;
+        if (link_rd)
+            timing_ras_push(t, next);
+        if (!timing_btb(t, pc, target)) {
+            t->btb_misses++;
+            return STALL_BTB;  // the target is known once decoded
+        }
+        return -1;
+    case CLASS_JALR:
+        if (rd(inst) == 0 && link_rs1) {
+            t->returns++;
+            if (timing_ras_pop(t) != target) {
+                t->ras_misses++;
+                return STALL_BRANCH;
+            }
+            return -1;
+        }
+        t->jumps++;
+        if (link_rd)
+            timing_ras_push(t, next);
+        if (!timing_btb(t, pc, target)) {
+            t->btb_misses++;
+            return STALL_BRANCH;  // an indirect target is known only late
+        }
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+void timing_op(TIMING *t, CPU *cpu, const BLOCK_INSN *in, uint64_t pc)
+{
+    const TIMING_OP *op = &t->ops[in->id];
+    uint64_t ready;
+    int cause = -1;
+
+    t->insns++;
+    if (t->slots == t->width) {
+        t->cycle++;
+        t->slots = 0;
+    }
+    ready = t->cycle;
+    for (int i = 0; i < 3 && op->src[i]; i++) {
+        int r = timing_reg(in->inst, op->src[i]);
+        if (r != 0 && t->ready[r] > ready) {
+            static const uint8_t stall_of[CLASS_SYSTEM + 1] = {
+                [CLASS_LOAD] = STALL_LOAD, [CLASS_AMO] = STALL_LOAD,
+                [CLASS_MUL] = STALL_MULDIV, [CLASS_DIV] = STALL_MULDIV,
+                [CLASS_FP] = STALL_FP,     [CLASS_FDIV] = STALL_FP,
+                [CLASS_VEC] = STALL_FP,    [CLASS_ALU] = STALL_DEPEND,
+                [CLASS_STORE] = STALL_DEPEND, [CLASS_BRANCH] = STALL_DEPEND,
+                [CLASS_JAL] = STALL_DEPEND, [CLASS_JALR] = STALL_DEPEND,
+                [CLASS_SYSTEM] = STALL_DEPEND,
+            };
+            ready = t->ready[r];
+            cause = stall_of[t->producer[r]];
+        }
+    }
+    if (op->cls == CLASS_SYSTEM) {
+        // wait for everything in flight
+        for (int r = 1; r < 64; r++) {
+            if (t->ready[r] > ready) {
+                ready = t->ready[r];
+                cause = STALL_SERIALIZE;
+            }
+        }
+    }
+    if (ready > t->cycle) {
+        t->stalls[cause] += ready - t->cycle;
+        t->cycle = ready;
+        t->slots = 0;
+    }
+    t->slots++;
+
+    if (op->dst) {
+        int r = rd(in->inst) + (op->dst == 2 ? 32 : 0);
+        if (r != 0) {
+            t->ready[r] = t->cycle + t->latency[op->cls];
+            t->producer[r] = op->cls;
+        }
+    }
+    if (op->cls < CLASS_BRANCH)
+        return;
+    // a block ends here, and so does the issue group
+    int miss = timing_control(t, op, in->inst, pc, pc + in->len, cpu->pc);
+    int lost = miss == STALL_BRANCH ? t->penalty : miss == STALL_BTB;
+
+    if (miss >= 0)
+        t->stalls[miss] += lost;
+    t->cycle += 1 + lost;
+    t->slots = 0;
+}
+
+uint64_t timing_cycles(TIMING *t)
+{
+    return t->cycle + t->cycle_offset;
+}
+
+void timing_set_cycles(TIMING *t, uint64_t value)
+{
+    t->cycle_offset = value - t->cycle;
+}
+
+void timing_dump_stats(TIMING *t)
+{
+    uint64_t cycles = t->cycle + (t->slots != 0);
+    uint64_t stalled = 0;
+    double n = t->insns ? t->insns : 1;
+
+    for (int i = 0; i < STALL_CAUSES; i++)
+        stalled += t->stalls[i];
+    fprintf(stderr,
+            "Timing: %lu cycles, %lu instructions, %.3f CPI "
+            "(%d-wide, %s, penalty %d)\n",
+            cycles, t->insns, cycles / n, t->width,
+            t->gshare ? "gshare" : "bimodal", t->penalty);
+    fprintf(stderr, "CPI stack: base %.3f", (cycles - stalled) / n);
+    for (int i = 0; i < STALL_CAUSES; i++)
+        fprintf(stderr, ", %s %.3f", stall_name[i], t->stalls[i] / n);
+    fprintf(stderr, "\n");
+    fprintf(stderr,
+            "Branches: %lu, %lu mispredicted (%.2f%%); jumps: %lu, %lu BTB "
+            "misses; returns: %lu, %lu RAS misses\n",
+            t->branches, t->mispredicts,
+            t->branches ? 100.0 * t->mispredicts / t->branches : 0.0,
+            t->jumps, t->btb_misses, t->returns, t->ras_misses);
+}
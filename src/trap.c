@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cpu.h"
+#include "csr.h"
+#include "trap.h"
+
+// Enter the trap handler: exceptions and interrupts taken in S or U mode are
+// handled in S mode if delegated through medeleg/mideleg, else in M mode.
+static void cpu_trap(CPU *cpu, uint64_t cause, int interrupt, uint64_t tval,
+                     uint64_t epc)
+{
+    uint64_t deleg = interrupt ? cpu->csr.mideleg : cpu->csr.medeleg;
+    uint64_t mstatus = cpu->csr.mstatus;
+    uint64_t tvec;
+
+    if (interrupt)
+        cpu->counters.interrupts++;
+    else
+        cpu->counters.exceptions++;
+    if (cpu->priv <= PRIV_S && (deleg >> cause) & 1) {
+        tvec = cpu->csr.stvec;
+        cpu->csr.sepc = epc;
+        cpu->csr.scause = cause | ((uint64_t) interrupt << 63);
+        cpu->csr.stval = tval;
+        mstatus &= ~(MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SIE);
+        if (cpu->csr.mstatus & MSTATUS_SIE)
+            mstatus |= MSTATUS_SPIE;
+        if (cpu->priv == PRIV_S)
+            mstatus |= MSTATUS_SPP;
+        cpu->priv = PRIV_S;
+    } else {
+        tvec = cpu->csr.mtvec;
+        cpu->csr.mepc = epc;
+        cpu->csr.mcause = cause | ((uint64_t) interrupt << 63);
+        cpu->csr.mtval = tval;
+        mstatus &= ~(MSTATUS_MPIE | MSTATUS_MPP | MSTATUS_MIE);
+        if (cpu->csr.mstatus & MSTATUS_MIE)
+            mstatus |= MSTATUS_MPIE;
+        mstatus |= (uint64_t) cpu->priv << MSTATUS_MPP_SHIFT;
+        cpu->priv = PRIV_M;
+    }
+    cpu->csr.mstatus = mstatus;
+
+    // vectored mode only applies to interrupts
+    cpu->pc = (tvec & ~3ULL) + (interrupt && (tvec & 1) ? 4 * cause : 0);
+    if (!cpu->pc) {
+        fprintf(stderr, "Unhandled %s %ld at pc %#lx, tval %#lx\n",
+                interrupt ? "interrupt" : "exception", cause, epc, tval);
+        if (cpu->cov)
+            abort();  // a crash, for the fuzzer
+    }
+    mmu_update_ctx(cpu);
+}
+
+void cpu_exception(CPU *cpu, uint64_t cause, uint64_t tval)
+{
+    cpu_trap(cpu, cause, 0, tval, cpu->inst_pc);
+    // resume the dispatcher at the handler, abandoning the instruction
+    cpu->bcache.running = NULL;
+    longjmp(cpu->trap_env, 1);
+}
+
+void cpu_poll_interrupts(CPU *cpu)
+{
+    uint64_t pending, mstatus;
+    uint64_t enabled = 0;
+    // highest priority first: MEI, MSI, MTI, SEI, SSI, STI
+    static const int order[] = {11, 3, 7, 9, 1, 5};
+
+    cpu->poll_budget = CPU_POLL_INTERVAL;
+    // an atomic exchange, so a request made while this poll reads mip is
+    // kept for the next one rather than lost
+    if (__atomic_load_n(&cpu->poll_now, __ATOMIC_RELAXED))
+        __atomic_exchange_n(&cpu->poll_now, 0, __ATOMIC_ACQUIRE);
+    if (cpu->gdb && (cpu->gdb->io || cpu->gdb->watch_hit))
+        gdb_poll(cpu);  // the debugger may stop the guest here
+    if (cpu->watch &&
+        __atomic_load_n(&cpu->watch->pending, __ATOMIC_ACQUIRE))
+        watch_poll(cpu);
+    if (cpu->replay)
+        replay_poll(cpu);
+    if (cpu->stats)
+        stats_poll(cpu);
+    pending = cpu_mip(cpu) & cpu->csr.mie;
+    mstatus = cpu->csr.mstatus;
+    if (!pending)
+        return;
+
+    // M-level interrupts are masked only in M mode with MIE clear,
+    // delegated ones only in S mode with SIE clear (and never in U mode)
+    if (cpu->priv < PRIV_M || (mstatus & MSTATUS_MIE))
+        enabled |= pending & ~cpu->csr.mideleg;
+    if (cpu->priv < PRIV_S || (cpu->priv == PRIV_S && (mstatus & MSTATUS_SIE)))
+        enabled |= pending & cpu->csr.mideleg;
+    if (!enabled)
+        return;
+
+    for (int i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (enabled & (1ULL << order[i])) {
+            cpu_trap(cpu, order[i], 1, 0, cpu->pc);
+            return;
+        }
+    }
+}
+
+void cpu_mret(CPU *cpu)
+{
+    uint64_t mstatus = cpu->csr.mstatus;
+    int priv = (mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+
+    mstatus &= ~(MSTATUS_MIE | MSTATUS_MPP);
+    if (mstatus & MSTATUS_MPIE)
+        mstatus |= MSTATUS_MIE;
+    mstatus |= MSTATUS_MPIE;
+    if (priv != PRIV_M)
+        mstatus &= ~MSTATUS_MPRV;
+    cpu->csr.mstatus = mstatus;
+    cpu->priv = priv;
+    cpu->pc = cpu->csr.mepc;
+    cpu->poll_budget = 1;  // interrupts may have been re-enabled
+    mmu_update_ctx(cpu);
+}
+
+void cpu_sret(CPU *cpu)
+{
+    uint64_t mstatus = cpu->csr.mstatus;
+    int priv = mstatus & MSTATUS_SPP ? PRIV_S : PRIV_U;
+
+    mstatus &= ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV);
+    if (mstatus & MSTATUS_SPIE)
+        mstatus |= MSTATUS_SIE;
+    mstatus |= MSTATUS_SPIE;
+    cpu->csr.mstatus = mstatus;
+    cpu->priv = priv;
+    cpu->pc = cpu->csr.sepc;
+    cpu->poll_budget = 1;
+    mmu_update_ctx(cpu);
+}
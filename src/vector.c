@@ -0,0 +1,796 @@
+#include <string.h>
+
+#include "cpu.h"
+#include "csr.h"
+#include "vector.h"
+
+// OP-V funct3: operand categories
+#define OPIVV 0
+#define OPFVV 1
+#define OPMVV 2
+#define OPIVI 3
+#define OPIVX 4
+#define OPFVF 5
+#define OPMVX 6
+#define OPCFG 7
+
+// Operations are numbered by funct6, plus 0x40 for the OPM* categories
+enum {
+    V_ADD = 0x00,
+    V_SUB = 0x02,
+    V_RSUB = 0x03,
+    V_MINU = 0x04,
+    V_MIN = 0x05,
+    V_MAXU = 0x06,
+    V_MAX = 0x07,
+    V_AND = 0x09,
+    V_OR = 0x0a,
+    V_XOR = 0x0b,
+    V_SLIDEUP = 0x0e,
+    V_SLIDEDOWN = 0x0f,
+    V_MERGE = 0x17,  // vmerge, or vmv.v.* when unmasked
+    V_MSEQ = 0x18,
+    V_MSNE = 0x19,
+    V_MSLTU = 0x1a,
+    V_MSLT = 0x1b,
+    V_MSLEU = 0x1c,
+    V_MSLE = 0x1d,
+    V_MSGTU = 0x1e,
+    V_MSGT = 0x1f,
+    V_SADDU = 0x20,
+    V_SADD = 0x21,
+    V_SSUBU = 0x22,
+    V_SSUB = 0x23,
+    V_SLL = 0x25,
+    V_SRL = 0x28,
+    V_SRA = 0x29,
+
+    V_REDSUM = 0x40,
+    V_REDAND = 0x41,
+    V_REDOR = 0x42,
+    V_REDXOR = 0x43,
+    V_REDMINU = 0x44,
+    V_REDMIN = 0x45,
+    V_REDMAXU = 0x46,
+    V_REDMAX = 0x47,
+    V_SLIDE1UP = 0x4e,
+    V_SLIDE1DOWN = 0x4f,
+    V_WXUNARY0 = 0x50,  // vmv.x.s, vcpop.m, vfirst.m; vmv.s.x under OPMVX
+    V_MUNARY0 = 0x54,   // vid.v
+    V_MANDN = 0x58,
+    V_MAND = 0x59,
+    V_MOR = 0x5a,
+    V_MXOR = 0x5b,
+    V_MORN = 0x5c,
+    V_MNAND = 0x5d,
+    V_MNOR = 0x5e,
+    V_MXNOR = 0x5f,
+    V_DIVU = 0x60,
+    V_DIV = 0x61,
+    V_REMU = 0x62,
+    V_REM = 0x63,
+    V_MULHU = 0x64,
+    V_MUL = 0x65,
+    V_MULHSU = 0x66,
+    V_MULH = 0x67,
+    V_MADD = 0x69,
+    V_NMSUB = 0x6b,
+    V_MACC = 0x6d,
+    V_NMSAC = 0x6f,
+};
+
+// operand categories each implemented operation accepts
+#define VV (1 << OPIVV)
+#define VI (1 << OPIVI)
+#define VX (1 << OPIVX)
+#define MVV (1 << OPMVV)
+#define MVX (1 << OPMVX)
+static const uint8_t allowed[128] = {
+    [V_ADD] = VV | VX | VI,       [V_SUB] = VV | VX,
+    [V_RSUB] = VX | VI,           [V_MINU] = VV | VX,
+    [V_MIN] = VV | VX,            [V_MAXU] = VV | VX,
+    [V_MAX] = VV | VX,            [V_AND] = VV | VX | VI,
+    [V_OR] = VV | VX | VI,        [V_XOR] = VV | VX | VI,
+    [V_SLIDEUP] = VX | VI,        [V_SLIDEDOWN] = VX | VI,
+    [V_MERGE] = VV | VX | VI,     [V_MSEQ] = VV | VX | VI,
+    [V_MSNE] = VV | VX | VI,      [V_MSLTU] = VV | VX,
+    [V_MSLT] = VV | VX,           [V_MSLEU] = VV | VX | VI,
+    [V_MSLE] = VV | VX | VI,      [V_MSGTU] = VX | VI,
+    [V_MSGT] = VX | VI,           [V_SADDU] = VV | VX | VI,
+    [V_SADD] = VV | VX | VI,      [V_SSUBU] = VV | VX,
+    [V_SSUB] = VV | VX,           [V_SLL] = VV | VX | VI,
+    [V_SRL] = VV | VX | VI,       [V_SRA] = VV | VX | VI,
+    [V_REDSUM] = MVV,             [V_REDAND] = MVV,
+    [V_REDOR] = MVV,              [V_REDXOR] = MVV,
+    [V_REDMINU] = MVV,            [V_REDMIN] = MVV,
+    [V_REDMAXU] = MVV,            [V_REDMAX] = MVV,
+    [V_SLIDE1UP] = MVX,           [V_SLIDE1DOWN] = MVX,
+    [V_WXUNARY0] = MVV | MVX,     [V_MUNARY0] = MVV,
+    [V_MANDN] = MVV,              [V_MAND] = MVV,
+    [V_MOR] = MVV,                [V_MXOR] = MVV,
+    [V_MORN] = MVV,               [V_MNAND] = MVV,
+    [V_MNOR] = MVV,               [V_MXNOR] = MVV,
+    [V_DIVU] = MVV | MVX,         [V_DIV] = MVV | MVX,
+    [V_REMU] = MVV | MVX,         [V_REM] = MVV | MVX,
+    [V_MULHU] = MVV | MVX,        [V_MUL] = MVV | MVX,
+    [V_MULHSU] = MVV | MVX,       [V_MULH] = MVV | MVX,
+    [V_MADD] = MVV | MVX,         [V_NMSUB] = MVV | MVX,
+    [V_MACC] = MVV | MVX,         [V_NMSAC] = MVV | MVX,
+};
+
+void vector_init(CPU *cpu)
+{
+    memset(&cpu->vec, 0, sizeof(cpu->vec));
+    cpu->vec.vtype = VTYPE_VILL;
+    cpu->vec.vill = 1;
+}
+
+static int mask_bit(const uint8_t *m, uint64_t i)
+{
+    return (m[i >> 3] >> (i & 7)) & 1;
+}
+
+static void set_mask_bit(uint8_t *m, uint64_t i, int bit)
+{
+    m[i >> 3] = (m[i >> 3] & ~(1 << (i & 7))) | (bit << (i & 7));
+}
+
+static uint64_t elem_get(VECTOR *v, int reg, uint64_t i, int sew)
+{
+    uint64_t x = 0;
+    memcpy(&x, v->reg[reg] + i * sew, sew);  // the host is little-endian
+    return x;
+}
+
+static void elem_set(VECTOR *v, int reg, uint64_t i, int sew, uint64_t x)
+{
+    memcpy(v->reg[reg] + i * sew, &x, sew);
+}
+
+static int64_t sext(uint64_t x, int bits)
+{
+    return bits == 64 ? (int64_t) x : (int64_t) (x << (64 - bits)) >> (64 - bits);
+}
+
+// ---------- vsetvl ----------
+void vector_setvl(CPU *cpu, uint32_t inst)
+{
+    VECTOR *v = &cpu->vec;
+    uint64_t rd = (inst >> 7) & 0x1f, rs1 = (inst >> 15) & 0x1f;
+    uint64_t vtype, avl;
+
+    if (!(inst >> 31))  // vsetvli
+        vtype = (inst >> 20) & 0x7ff;
+    else if ((inst >> 30) == 0x3)  // vsetivli
+        vtype = (inst >> 20) & 0x3ff;
+    else  // vsetvl
+        vtype = cpu->regs[(inst >> 20) & 0x1f];
+
+    if ((inst >> 30) == 0x3)
+        avl = rs1;  // a 5-bit immediate
+    else if (rs1 != 0)
+        avl = cpu->regs[rs1];
+    else if (rd != 0)
+        avl = UINT64_MAX;  // vl = VLMAX
+    else
+        avl = v->vl;  // keep vl, only change vtype
+
+    int vlmul = vtype & VTYPE_VLMUL;
+    int vsew = (vtype >> VTYPE_VSEW_SHIFT) & 0x7;
+    // fractional LMUL = 1 / 2^(8 - vlmul) must still hold one ELEN element
+    if ((vtype >> 8) || vlmul == 4 || vsew > 3 ||
+        (vlmul > 4 && (8 << vsew) > (ELEN >> (8 - vlmul)))) {
+        v->vtype = VTYPE_VILL;
+        v->vill = 1;
+        v->vl = 0;
+        v->vlmax = 0;
+        cpu->regs[rd] = 0;
+        return;
+    }
+    v->vtype = vtype;
+    v->vill = 0;
+    v->sew = 1 << vsew;
+    v->lmul = vlmul < 4 ? 1 << vlmul : 1;
+    v->vlmax = vlmul < 4 ? (uint64_t) (VLENB / v->sew) << vlmul
+                         : (uint64_t) (VLENB / v->sew) >> (8 - vlmul);
+    v->vl = avl < v->vlmax ? avl : v->vlmax;
+    cpu->regs[rd] = v->vl;
+}
+
+// ---------- Element-wise integer operations ----------
+// One element, zero-extended to 64 bits; the caller truncates the result
+static uint64_t scalar_op(VECTOR *v, int op, uint64_t a, uint64_t b,
+                          uint64_t c, int bits, int mask)
+{
+    uint64_t umax = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+    int64_t smax = (int64_t) (umax >> 1), smin = -smax - 1;
+    int64_t sa = sext(a, bits), sb = sext(b, bits);
+    int64_t sr;
+
+    switch (op) {
+    case V_ADD:
+        return a + b;
+    case V_SUB:
+        return a - b;
+    case V_RSUB:
+        return b - a;
+    case V_MINU:
+        return a < b ? a : b;
+    case V_MIN:
+        return sa < sb ? a : b;
+    case V_MAXU:
+        return a > b ? a : b;
+    case V_MAX:
+        return sa > sb ? a : b;
+    case V_AND:
+        return a & b;
+    case V_OR:
+        return a | b;
+    case V_XOR:
+        return a ^ b;
+    case V_MERGE:
+        return mask ? b : a;
+    case V_SADDU:
+        if (((a + b) & umax) < a) {
+            v->vxsat = 1;
+            return umax;
+        }
+        return a + b;
+    case V_SSUBU:
+        if (a < b) {
+            v->vxsat = 1;
+            return 0;
+        }
+        return a - b;
+    case V_SADD:
+    case V_SSUB:
+        if (op == V_SADD ? __builtin_add_overflow(sa, sb, &sr)
+                         : __builtin_sub_overflow(sa, sb, &sr))
+            sr = sa < 0 ? smin : smax;  // only possible with bits == 64
+        if (sr > smax || sr < smin) {
+            v->vxsat = 1;
+            sr = sr > smax ? smax : smin;
+        }
+        return sr;
+    case V_SLL:
+        return a << (b & (bits - 1));
+    case V_SRL:
+        return a >> (b & (bits - 1));
+    case V_SRA:
+        return sa >> (b & (bits - 1));
+    case V_MUL:
+        return a * b;
+    case V_MULH:
+        return (uint64_t) (((__int128) sa * sb) >> bits);
+    case V_MULHU:
+        return (uint64_t) (((unsigned __int128) a * b) >> bits);
+    case V_MULHSU:
+        return (uint64_t) (((__int128) sa * (__int128) b) >> bits);
+    case V_DIVU:
+        return b ? a / b : umax;
+    case V_REMU:
+        return b ? a % b : a;
+    case V_DIV:
+        if (!sb)
+            return UINT64_MAX;
+        return sa == smin && sb == -1 ? (uint64_t) smin : (uint64_t) (sa / sb);
+    case V_REM:
+        if (!sb)
+            return a;
+        return sa == smin && sb == -1 ? 0 : (uint64_t) (sa % sb);
+    case V_MACC:
+        return c + b * a;
+    case V_NMSAC:
+        return c - b * a;
+    case V_MADD:
+        return b * c + a;
+    default:  // V_NMSUB
+        return a - b * c;
+    }
+}
+
+// operations with a direct host vector equivalent
+static int simd_op(int op)
+{
+    switch (op) {
+    case V_ADD:
+    case V_SUB:
+    case V_RSUB:
+    case V_MINU:
+    case V_MIN:
+    case V_MAXU:
+    case V_MAX:
+    case V_AND:
+    case V_OR:
+    case V_XOR:
+    case V_MERGE:
+    case V_SLL:
+    case V_SRL:
+    case V_SRA:
+    case V_MUL:
+    case V_MACC:
+    case V_NMSAC:
+    case V_MADD:
+    case V_NMSUB:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// vd[i] = op(vs2[i], vs1[i] or x, vd[i]) for i < vl. Unmasked whole
+// registers' worth of elements go through 256-bit host vectors; the rest,
+// and operations without a host equivalent, run one element at a time.
+#define DEFINE_ELEMENTWISE(BITS)                                               \
+    static void elementwise##BITS(VECTOR *v, int op, int vd, int vs2,         \
+                                  int vs1, uint64_t x, int vv, int vm)        \
+    {                                                                          \
+        typedef uint##BITS##_t T;                                              \
+        typedef int##BITS##_t S;                                               \
+        typedef T VT __attribute__((vector_size(VLENB)));                      \
+        typedef S VS __attribute__((vector_size(VLENB)));                      \
+        T *d = (T *) v->reg[vd], *a = (T *) v->reg[vs2];                       \
+        T *b = (T *) v->reg[vs1];                                              \
+        uint64_t lanes = VLENB / sizeof(T), i = 0;                             \
+                                                                               \
+        if (vm && simd_op(op)) {                                               \
+            VT vx = (VT){} + (T) x;                                            \
+            for (; i + lanes <= v->vl; i += lanes) {                           \
+                VT va, vb, vc, vr, m;                                          \
+                memcpy(&va, a + i, VLENB);                                     \
+                memcpy(&vc, d + i, VLENB);                                     \
+                if (vv)                                                        \
+                    memcpy(&vb, b + i, VLENB);                                 \
+                else                                                           \
+                    vb = vx;                                                   \
+                switch (op) {                                                  \
+                case V_ADD:                                                    \
+                    vr = va + vb;                                              \
+                    break;                                                     \
+                case V_SUB:                                                    \
+                    vr = va - vb;                                              \
+                    break;                                                     \
+                case V_RSUB:                                                   \
+                    vr = vb - va;                                              \
+                    break;                                                     \
+                case V_MINU:                                                   \
+                case V_MAXU:                                                   \
+                    m = (VT) (va < vb);                                        \
+                    if (op == V_MAXU)                                          \
+                        m = ~m;                                                \
+                    vr = (va & m) | (vb & ~m);                                 \
+                    break;                                                     \
+                case V_MIN:                                                    \
+                case V_MAX:                                                    \
+                    m = (VT) ((VS) va < (VS) vb);                              \
+                    if (op == V_MAX)                                           \
+                        m = ~m;                                                \
+                    vr = (va & m) | (vb & ~m);                                 \
+                    break;                                                     \
+                case V_AND:                                                    \
+                    vr = va & vb;                                              \
+                    break;                                                     \
+                case V_OR:                                                     \
+                    vr = va | vb;                                              \
+                    break;                                                     \
+                case V_XOR:                                                    \
+                    vr = va ^ vb;                                              \
+                    break;                                                     \
+                case V_MERGE:                                                  \
+                    vr = vb;                                                   \
+                    break;                                                     \
+                case V_SLL:                                                    \
+                    vr = va << (vb & (BITS - 1));                              \
+                    break;                                                     \
+                case V_SRL:                                                    \
+                    vr = va >> (vb & (BITS - 1));                              \
+                    break;                                                     \
+                case V_SRA:                                                    \
+                    vr = (VT) ((VS) va >> (VS) (vb & (BITS - 1)));             \
+                    break;                                                     \
+                case V_MUL:                                                    \
+                    vr = va * vb;                                              \
+                    break;                                                     \
+                case V_MACC:                                                   \
+                    vr = vc + vb * va;                                         \
+                    break;                                                     \
+                case V_NMSAC:                                                  \
+                    vr = vc - vb * va;                                         \
+                    break;                                                     \
+                case V_MADD:                                                   \
+                    vr = vb * vc + va;                                         \
+                    break;                                                     \
+                default: /* V_NMSUB */                                         \
+                    vr = va - vb * vc;                                         \
+                }                                                              \
+                memcpy(d + i, &vr, VLENB);                                     \
+            }                                                                  \
+        }                                                                      \
+        for (; i < v->vl; i++) {                                               \
+            int active = vm || mask_bit(v->reg[0], i);                         \
+            if (!active && op != V_MERGE)                                      \
+                continue;                                                      \
+            d[i] = scalar_op(v, op, a[i], vv ? b[i] : (T) x, d[i], BITS,       \
+                             active);                                          \
+        }                                                                      \
+    }
+
+DEFINE_ELEMENTWISE(8)
+DEFINE_ELEMENTWISE(16)
+DEFINE_ELEMENTWISE(32)
+DEFINE_ELEMENTWISE(64)
+
+static void elementwise(VECTOR *v, int op, int vd, int vs2, int vs1,
+                        uint64_t x, int vv, int vm)
+{
+    switch (v->sew) {
+    case 1:
+        elementwise8(v, op, vd, vs2, vs1, x, vv, vm);
+        break;
+    case 2:
+        elementwise16(v, op, vd, vs2, vs1, x, vv, vm);
+        break;
+    case 4:
+        elementwise32(v, op, vd, vs2, vs1, x, vv, vm);
+        break;
+    default:
+        elementwise64(v, op, vd, vs2, vs1, x, vv, vm);
+    }
+}
+
+// ---------- Reductions ----------
+// vd[0] = vs1[0] op vs2[active elements]. Unmasked and/or/xor/sum fold
+// whole host vectors first and combine the lanes at the end.
+static const int reduce_op[8] = {V_ADD,  V_AND, V_OR,   V_XOR,
+                                 V_MINU, V_MIN, V_MAXU, V_MAX};
+
+#define DEFINE_REDUCTION(BITS)                                                 \
+    static void reduction##BITS(VECTOR *v, int op, int vd, int vs2, int vs1,  \
+                                int vm)                                        \
+    {                                                                          \
+        typedef uint##BITS##_t T;                                              \
+        typedef T VT __attribute__((vector_size(VLENB)));                      \
+        T *a = (T *) v->reg[vs2];                                              \
+        T acc = ((T *) v->reg[vs1])[0];                                        \
+        uint64_t lanes = VLENB / sizeof(T), i = 0;                             \
+        int sop = reduce_op[op - V_REDSUM];                                    \
+                                                                               \
+        if (vm && op <= V_REDXOR && v->vl >= lanes) {                          \
+            VT vacc = (VT){} + (T) (op == V_REDAND ? ~0ULL : 0);               \
+            for (; i + lanes <= v->vl; i += lanes) {                           \
+                VT va;                                                         \
+                memcpy(&va, a + i, VLENB);                                     \
+                if (op == V_REDSUM)                                            \
+                    vacc += va;                                                \
+                else if (op == V_REDAND)                                       \
+                    vacc &= va;                                                \
+                else if (op == V_REDOR)                                        \
+                    vacc |= va;                                                \
+                else                                                           \
+                    vacc ^= va;                                                \
+            }                                                                  \
+            for (uint64_t l = 0; l < lanes; l++)                               \
+                acc = scalar_op(v, sop, acc, vacc[l], 0, BITS, 1);             \
+        }                                                                      \
+        for (; i < v->vl; i++)                                                 \
+            if (vm || mask_bit(v->reg[0], i))                                  \
+                acc = scalar_op(v, sop, acc, a[i], 0, BITS, 1);                \
+        if (v->vl)                                                             \
+            ((T *) v->reg[vd])[0] = acc;                                       \
+    }
+
+DEFINE_REDUCTION(8)
+DEFINE_REDUCTION(16)
+DEFINE_REDUCTION(32)
+DEFINE_REDUCTION(64)
+
+static void reduction(VECTOR *v, int op, int vd, int vs2, int vs1, int vm)
+{
+    switch (v->sew) {
+    case 1:
+        reduction8(v, op, vd, vs2, vs1, vm);
+        break;
+    case 2:
+        reduction16(v, op, vd, vs2, vs1, vm);
+        break;
+    case 4:
+        reduction32(v, op, vd, vs2, vs1, vm);
+        break;
+    default:
+        reduction64(v, op, vd, vs2, vs1, vm);
+    }
+}
+
+// ---------- Compares, masks and permutations ----------
+static int compare(int op, uint64_t a, uint64_t b, int bits)
+{
+    int64_t sa = sext(a, bits), sb = sext(b, bits);
+    switch (op) {
+    case V_MSEQ:
+        return a == b;
+    case V_MSNE:
+        return a != b;
+    case V_MSLTU:
+        return a < b;
+    case V_MSLT:
+        return sa < sb;
+    case V_MSLEU:
+        return a <= b;
+    case V_MSLE:
+        return sa <= sb;
+    case V_MSGTU:
+        return a > b;
+    default:  // V_MSGT
+        return sa > sb;
+    }
+}
+
+static void mask_compare(VECTOR *v, int op, int vd, int vs2, int vs1,
+                         uint64_t x, int vv, int vm)
+{
+    uint8_t result[VLENB];  // vd may overlap the sources
+    int bits = 8 * v->sew;
+    uint64_t b = x & (bits == 64 ? UINT64_MAX : (1ULL << bits) - 1);
+
+    memcpy(result, v->reg[vd], VLENB);
+    for (uint64_t i = 0; i < v->vl; i++) {
+        if (!vm && !mask_bit(v->reg[0], i))
+            continue;
+        uint64_t a = elem_get(v, vs2, i, v->sew);
+        set_mask_bit(result, i,
+                     compare(op, a, vv ? elem_get(v, vs1, i, v->sew) : b, bits));
+    }
+    memcpy(v->reg[vd], result, VLENB);
+}
+
+static void mask_logical(VECTOR *v, int op, int vd, int vs2, int vs1)
+{
+    uint8_t *d = v->reg[vd], *a = v->reg[vs2], *b = v->reg[vs1];
+    uint64_t full = v->vl / 8;  // whole bytes, then the bits of the last one
+
+    for (uint64_t i = 0; i <= full && i < VLENB; i++) {
+        uint8_t r;
+        switch (op) {
+        case V_MANDN:
+            r = a[i] & ~b[i];
+            break;
+        case V_MAND:
+            r = a[i] & b[i];
+            break;
+        case V_MOR:
+            r = a[i] | b[i];
+            break;
+        case V_MXOR:
+            r = a[i] ^ b[i];
+            break;
+        case V_MORN:
+            r = a[i] | ~b[i];
+            break;
+        case V_MNAND:
+            r = ~(a[i] & b[i]);
+            break;
+        case V_MNOR:
+            r = ~(a[i] | b[i]);
+            break;
+        default:  // V_MXNOR
+            r = ~(a[i] ^ b[i]);
+        }
+        uint8_t keep = i < full ? 0 : 0xff << (v->vl & 7);  // tail bits
+        d[i] = (d[i] & keep) | (r & ~keep);
+    }
+}
+
+static void slide(VECTOR *v, int op, int vd, int vs2, uint64_t x, int vm)
+{
+    int sew = v->sew;
+
+    switch (op) {
+    case V_SLIDEUP:
+        // vd and vs2 may not overlap, but go downwards regardless
+        for (uint64_t i = v->vl; i-- > x;)
+            if (vm || mask_bit(v->reg[0], i))
+                elem_set(v, vd, i, sew, elem_get(v, vs2, i - x, sew));
+        break;
+    case V_SLIDEDOWN:
+        for (uint64_t i = 0; i < v->vl; i++)
+            if (vm || mask_bit(v->reg[0], i))
+                elem_set(v, vd, i, sew,
+                         x < v->vlmax - i ? elem_get(v, vs2, i + x, sew) : 0);
+        break;
+    case V_SLIDE1UP:
+        for (uint64_t i = v->vl; i-- > 0;)
+            if (vm || mask_bit(v->reg[0], i))
+                elem_set(v, vd, i, sew, i ? elem_get(v, vs2, i - 1, sew) : x);
+        break;
+    default:  // V_SLIDE1DOWN
+        for (uint64_t i = 0; i < v->vl; i++)
+            if (vm || mask_bit(v->reg[0], i))
+                elem_set(v, vd, i, sew,
+                         i + 1 < v->vl ? elem_get(v, vs2, i + 1, sew) : x);
+    }
+}
+
+// a register group must start at a multiple of LMUL
+static int group_ok(VECTOR *v, int reg)
+{
+    return (reg & (v->lmul - 1)) == 0;
+}
+
+void vector_op(CPU *cpu, uint32_t inst)
+{
+    VECTOR *v = &cpu->vec;
+    int funct3 = (inst >> 12) & 0x7;
+    int vm = (inst >> 25) & 0x1;
+    int vd = (inst >> 7) & 0x1f;
+    int vs1 = (inst >> 15) & 0x1f;
+    int vs2 = (inst >> 20) & 0x1f;
+    int op = (inst >> 26) | (funct3 == OPMVV || funct3 == OPMVX ? 0x40 : 0);
+    int vv = funct3 == OPIVV || funct3 == OPMVV;
+    uint64_t x = 0;
+
+    if (v->vill || !(allowed[op] & (1 << funct3)))
+        cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+    if (funct3 == OPIVX || funct3 == OPMVX)
+        x = cpu->regs[vs1];
+    else if (funct3 == OPIVI)
+        x = (op == V_SLIDEUP || op == V_SLIDEDOWN) ? vs1 : sext(vs1, 5);
+
+    switch (op) {
+    case V_REDSUM ... V_REDMAX:
+        if (!group_ok(v, vs2))
+            break;
+        reduction(v, op, vd, vs2, vs1, vm);
+        return;
+
+    case V_MSEQ ... V_MSGT:
+        if (!group_ok(v, vs2) || (vv && !group_ok(v, vs1)))
+            break;
+        mask_compare(v, op, vd, vs2, vs1, x, vv, vm);
+        return;
+
+    case V_MANDN ... V_MXNOR:
+        if (!vm)
+            break;
+        mask_logical(v, op, vd, vs2, vs1);
+        return;
+
+    case V_SLIDEUP:
+    case V_SLIDEDOWN:
+    case V_SLIDE1UP:
+    case V_SLIDE1DOWN:
+        if (!group_ok(v, vd) || !group_ok(v, vs2) || (!vm && vd == 0) ||
+            (op != V_SLIDEDOWN && op != V_SLIDE1DOWN && vd == vs2))
+            break;
+        slide(v, op, vd, vs2, x, vm);
+        return;
+
+    case V_WXUNARY0:
+        if (funct3 == OPMVX) {  // vmv.s.x
+            if (vs2 != 0 || !vm)
+                break;
+            if (v->vl)
+                elem_set(v, vd, 0, v->sew, x);
+            return;
+        }
+        if (vs1 == 0x00 && vm) {  // vmv.x.s
+            cpu->regs[vd] = sext(elem_get(v, vs2, 0, v->sew), 8 * v->sew);
+            return;
+        }
+        if (vs1 == 0x10 || vs1 == 0x11) {  // vcpop.m, vfirst.m
+            uint64_t count = 0, first = UINT64_MAX;
+            for (uint64_t i = 0; i < v->vl; i++) {
+                if (!mask_bit(v->reg[vs2], i) ||
+                    (!vm && !mask_bit(v->reg[0], i)))
+                    continue;
+                if (first == UINT64_MAX)
+                    first = i;
+                count++;
+            }
+            cpu->regs[vd] = vs1 == 0x10 ? count : first;
+            return;
+        }
+        break;
+
+    case V_MUNARY0:  // vid.v
+        if (vs1 != 0x11 || vs2 != 0 || !group_ok(v, vd) || (!vm && vd == 0))
+            break;
+        for (uint64_t i = 0; i < v->vl; i++)
+            if (vm || mask_bit(v->reg[0], i))
+                elem_set(v, vd, i, v->sew, i);
+        return;
+
+    default:  // element-wise
+        if (!group_ok(v, vd) || !group_ok(v, vs2) ||
+            (vv && !group_ok(v, vs1)) || (!vm && vd == 0) ||
+            (op == V_MERGE && vm && vs2 != 0))
+            break;
+        elementwise(v, op, vd, vs2, vs1, x, vv, vm);
+        return;
+    }
+    cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+}
+
+// ---------- Loads and stores ----------
+// Move len bytes between guest memory and a register buffer, as one host
+// copy when the range is RAM within a page, otherwise element by element
+static void transfer(CPU *cpu, uint64_t addr, uint8_t *buf, uint64_t len,
+                     int esize, int store)
+{
+    void *host = cpu_ram_ptr(cpu, addr, len, store ? ACCESS_STORE : ACCESS_LOAD);
+
+    if (host) {
+        if (store)
+            memcpy(host, buf, len);
+        else
+            memcpy(buf, host, len);
+        return;
+    }
+    for (uint64_t off = 0; off < len; off += esize) {
+        uint64_t x;
+        if (store) {
+            memcpy(&x, buf + off, esize);
+            cpu_store(cpu, addr + off, 8 * esize, x);
+        } else {
+            x = cpu_load(cpu, addr + off, 8 * esize);
+            memcpy(buf + off, &x, esize);
+        }
+    }
+}
+
+void vector_load_store(CPU *cpu, uint32_t inst, int store)
+{
+    VECTOR *v = &cpu->vec;
+    static const int eew_of_width[8] = {1, 0, 0, 0, 0, 2, 4, 8};
+    int eew = eew_of_width[(inst >> 12) & 0x7];
+    int vd = (inst >> 7) & 0x1f;  // vs3 for stores
+    int rs2 = (inst >> 20) & 0x1f;  // lumop/sumop, stride or index register
+    int vm = (inst >> 25) & 0x1;
+    int mop = (inst >> 26) & 0x3;
+    int nf = (inst >> 29) & 0x7;
+    uint64_t base = cpu->regs[(inst >> 15) & 0x1f];
+
+    if ((inst >> 28) & 0x1)  // mew: reserved
+        cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+
+    if (mop == 0 && rs2 == 0x08) {
+        // whole registers, independent of vtype and vl
+        int nreg = nf + 1;
+        if (!vm || (nreg & (nreg - 1)) || (vd & (nreg - 1)))
+            cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+        for (int r = 0; r < nreg; r++)
+            transfer(cpu, base + r * VLENB, v->reg[vd + r], VLENB, eew, store);
+        return;
+    }
+    if (v->vill || nf != 0 || (!vm && vd == 0))  // no segment accesses
+        cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+
+    if (mop == 0 && rs2 == 0x0b) {  // vlm.v / vsm.v
+        if (eew != 1 || !vm)
+            cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+        transfer(cpu, base, v->reg[vd], (v->vl + 7) / 8, 1, store);
+        return;
+    }
+    if (mop == 0 && rs2 != 0)
+        cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+
+    // indexed accesses use eew for the offsets and SEW for the data
+    int indexed = mop & 0x1;
+    int dsize = indexed ? v->sew : eew;
+    if (vd * VLENB + v->vl * dsize > sizeof(v->reg) ||
+        (indexed && rs2 * VLENB + v->vl * eew > sizeof(v->reg)))
+        cpu_exception(cpu, EXC_ILLEGAL_INST, inst);
+
+    if (mop == 0 && vm) {
+        transfer(cpu, base, v->reg[vd], v->vl * eew, eew, store);
+        return;
+    }
+    uint64_t stride = mop == 2 ? cpu->regs[rs2] : (uint64_t) eew;
+    for (uint64_t i = 0; i < v->vl; i++) {
+        if (!vm && !mask_bit(v->reg[0], i))
+            continue;
+        uint64_t addr =
+            base + (indexed ? elem_get(v, rs2, i, eew) : i * stride);
+        uint8_t *elem = v->reg[vd] + i * dsize;
+        transfer(cpu, addr, elem, dsize, dsize, store);
+    }
+}
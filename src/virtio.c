@@ -0,0 +1,190 @@
+#include <string.h>
+
+#include "virtio.h"
+
+void virtio_init(VIRTIO *vio, uint32_t device_id, uint64_t features,
+                 DRAM *dram, PLIC *plic, int irq)
+{
+    memset(vio, 0, sizeof(*vio));
+    vio->device_id = device_id;
+    vio->device_features = features | VIRTIO_F_VERSION_1;
+    vio->dram = dram;
+    vio->plic = plic;
+    vio->irq = irq;
+    pthread_mutex_init(&vio->queue_lock, NULL);
+}
+
+// the I/O threads walk the queues under queue_lock, so none is part way
+// through a chain when the queues go
+static void virtio_reset(VIRTIO *vio)
+{
+    pthread_mutex_lock(&vio->queue_lock);
+    vio->driver_features = 0;
+    vio->queue_sel = 0;
+    vio->status = 0;
+    __atomic_store_n(&vio->interrupt_status, 0, __ATOMIC_RELAXED);
+    memset(vio->queues, 0, sizeof(vio->queues));
+    vio->resets++;
+    plic_set_irq(vio->plic, vio->irq, 0);
+    pthread_mutex_unlock(&vio->queue_lock);
+}
+
+uint64_t virtio_mmio_load(VIRTIO *vio, uint64_t offset)
+{
+    VIRTQ *vq = &vio->queues[vio->queue_sel % VIRTIO_MAX_QUEUES];
+
+    switch (offset) {
+    case VIRTIO_MMIO_MAGIC_VALUE:
+        return VIRTIO_MAGIC;
+    case VIRTIO_MMIO_VERSION:
+        return 2;
+    case VIRTIO_MMIO_DEVICE_ID:
+        return vio->device_id;
+    case VIRTIO_MMIO_VENDOR_ID:
+        return VIRTIO_VENDOR;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+        return (uint32_t) (vio->device_features >>
+                           (vio->device_features_sel ? 32 : 0));
+    case VIRTIO_MMIO_QUEUE_NUM_MAX:
+        return vio->queue_sel < VIRTIO_MAX_QUEUES ? VIRTIO_QUEUE_SIZE : 0;
+    case VIRTIO_MMIO_QUEUE_READY:
+        return vq->ready;
+    case VIRTIO_MMIO_INTERRUPT_STATUS:
+        return __atomic_load_n(&vio->interrupt_status, __ATOMIC_ACQUIRE);
+    case VIRTIO_MMIO_STATUS:
+        return vio->status;
+    case VIRTIO_MMIO_CONFIG_GENERATION:
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+void virtio_mmio_store(VIRTIO *vio, uint64_t offset, uint64_t value)
+{
+    VIRTQ *vq = &vio->queues[vio->queue_sel % VIRTIO_MAX_QUEUES];
+
+    switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
+        vio->device_features_sel = value;
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+        if (vio->driver_features_sel)
+            vio->driver_features = (vio->driver_features & 0xffffffff) |
+                                   (value << 32);
+        else
+            vio->driver_features =
+                (vio->driver_features & ~0xffffffffULL) | (uint32_t) value;
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
+        vio->driver_features_sel = value;
+        break;
+    case VIRTIO_MMIO_QUEUE_SEL:
+        vio->queue_sel = value;
+        break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+        if (value && value <= VIRTIO_QUEUE_SIZE && !(value & (value - 1)))
+            vq->num = value;
+        break;
+    case VIRTIO_MMIO_QUEUE_READY:
+        vq->ready = value & 0x1;
+        break;
+    case VIRTIO_MMIO_INTERRUPT_ACK:
+        if (!__atomic_and_fetch(&vio->interrupt_status, ~(uint32_t) value,
+                                __ATOMIC_ACQ_REL))
+            plic_set_irq(vio->plic, vio->irq, 0);
+        break;
+    case VIRTIO_MMIO_STATUS:
+        if (value == 0)
+            virtio_reset(vio);
+        else
+            vio->status = value;
+        break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:
+        vq->desc = (vq->desc & ~0xffffffffULL) | (uint32_t) value;
+        break;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH:
+        vq->desc = (vq->desc & 0xffffffff) | (value << 32);
+        break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW:
+        vq->avail = (vq->avail & ~0xffffffffULL) | (uint32_t) value;
+        break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_HIGH:
+        vq->avail = (vq->avail & 0xffffffff) | (value << 32);
+        break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW:
+        vq->used = (vq->used & ~0xffffffffULL) | (uint32_t) value;
+        break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_HIGH:
+        vq->used = (vq->used & 0xffffffff) | (value << 32);
+        break;
+    default:;
+    }
+}
+
+uint8_t *virtio_guest_ptr(VIRTIO *vio, uint64_t addr, uint64_t len)
+{
+    if (addr < DRAM_BASE || len > DRAM_SIZE ||
+        addr - DRAM_BASE > DRAM_SIZE - len)
+        return NULL;
+    // the device may write anywhere in the range; a FENCE.I drops any
+    // blocks translated from it
+    for (uint64_t page = DRAM_PAGE(addr);
+         len && page <= DRAM_PAGE(addr + len - 1); page++)
+        __atomic_fetch_or(&vio->dram->dma_map[page / 64], 1ULL << (page % 64),
+                          __ATOMIC_RELAXED);
+    return &vio->dram->mem[addr - DRAM_BASE];
+}
+
+// avail ring: flags, idx, ring[num]; used ring: flags, idx, {id, len}[num]
+int virtq_pop(VIRTIO *vio, VIRTQ *vq)
+{
+    uint16_t *avail = (uint16_t *) virtio_guest_ptr(
+        vio, vq->avail, 4 + 2 * (uint64_t) vq->num);
+
+    if (!vq->ready || !vq->num || !avail)
+        return -1;
+    if (vq->last_avail == __atomic_load_n(&avail[1], __ATOMIC_ACQUIRE))
+        return -1;
+    return avail[2 + vq->last_avail++ % vq->num];
+}
+
+int virtq_desc(VIRTIO *vio, VIRTQ *vq, uint16_t idx, struct virtq_desc *desc)
+{
+    // the driver may rewrite the table at any time: read each field once
+    const volatile struct virtq_desc *table =
+        (const volatile struct virtq_desc *) virtio_guest_ptr(
+            vio, vq->desc, sizeof(struct virtq_desc) * (uint64_t) vq->num);
+
+    if (!table || idx >= vq->num)
+        return -1;
+    desc->addr = table[idx].addr;
+    desc->len = table[idx].len;
+    desc->flags = table[idx].flags;
+    desc->next = table[idx].next;
+    return 0;
+}
+
+void virtq_push(VIRTIO *vio, VIRTQ *vq, uint16_t head, uint32_t len)
+{
+    uint32_t *used =
+        (uint32_t *) virtio_guest_ptr(vio, vq->used, 4 + 8 * (uint64_t) vq->num);
+
+    if (!used)
+        return;
+    used[1 + 2 * (vq->used_idx % vq->num)] = head;
+    used[2 + 2 * (vq->used_idx % vq->num)] = len;
+    vq->used_idx++;
+}
+
+void virtq_flush(VIRTIO *vio, VIRTQ *vq)
+{
+    uint16_t *used = (uint16_t *) virtio_guest_ptr(vio, vq->used, 4);
+
+    if (!used)
+        return;
+    __atomic_store_n(&used[1], vq->used_idx, __ATOMIC_RELEASE);
+    __atomic_fetch_or(&vio->interrupt_status, VIRTIO_INT_USED_RING,
+                      __ATOMIC_RELEASE);
+    plic_set_irq(vio->plic, vio->irq, 1);
+}
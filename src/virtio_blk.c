@@ -0,0 +1,201 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "replay.h"
+#include "virtio_blk.h"
+
+struct virtio_blk_req {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+// Serve one descriptor chain: the request header, the data buffers and the
+// trailing status byte. The header and each descriptor are copied out of
+// guest RAM once and checked there, so the driver cannot change them under
+// the checks. Returns the number of bytes written to guest RAM.
+static uint32_t virtio_blk_request(VIRTIO_BLK *blk, VIRTQ *vq, uint16_t head)
+{
+    VIRTIO *vio = &blk->virtio;
+    struct virtq_desc desc;
+    struct virtio_blk_req req;
+    uint8_t *hdr;
+    uint8_t *status = NULL;
+    uint8_t result = VIRTIO_BLK_S_OK;
+    uint64_t offset;
+    uint32_t written = 0;
+
+    if (virtq_desc(vio, vq, head, &desc) < 0 ||
+        !(hdr = virtio_guest_ptr(vio, desc.addr, sizeof(req))))
+        return 0;
+    memcpy(&req, hdr, sizeof(req));
+    offset = req.sector * VIRTIO_BLK_SECTOR_SIZE;
+
+    for (int n = 0; desc.flags & VIRTQ_DESC_F_NEXT; n++) {
+        if (n >= vq->num || virtq_desc(vio, vq, desc.next, &desc) < 0)
+            return written;
+        uint8_t *buf = virtio_guest_ptr(vio, desc.addr, desc.len);
+        if (!buf)
+            return written;
+        if (!(desc.flags & VIRTQ_DESC_F_NEXT)) {
+            status = buf;  // the last descriptor holds the status byte
+            break;
+        }
+        if (result != VIRTIO_BLK_S_OK)
+            continue;
+
+        switch (req.type) {
+        case VIRTIO_BLK_T_IN:
+        case VIRTIO_BLK_T_OUT:
+            if (offset > blk->disk_size || desc.len > blk->disk_size - offset) {
+                result = VIRTIO_BLK_S_IOERR;
+                break;
+            }
+            if (req.type == VIRTIO_BLK_T_IN && blk->replay) {
+                replay_data(blk->replay, buf, blk->disk + offset, desc.len);
+                written += desc.len;
+                vio->bytes_in += desc.len;
+            } else if (req.type == VIRTIO_BLK_T_IN) {
+                memcpy(buf, blk->disk + offset, desc.len);
+                written += desc.len;
+                vio->bytes_in += desc.len;
+            } else {
+                memcpy(blk->disk + offset, buf, desc.len);
+                vio->bytes_out += desc.len;
+            }
+            offset += desc.len;
+            break;
+        case VIRTIO_BLK_T_GET_ID: {
+            char id[20] = "rvemu-virtio-blk";
+            uint32_t len = desc.len < sizeof(id) ? desc.len : sizeof(id);
+            memcpy(buf, id, len);
+            written += len;
+            break;
+        }
+        default:;
+        }
+    }
+
+    if (req.type == VIRTIO_BLK_T_FLUSH)
+        result = msync(blk->disk, blk->disk_size, MS_SYNC) ? VIRTIO_BLK_S_IOERR
+                                                           : VIRTIO_BLK_S_OK;
+    else if (req.type != VIRTIO_BLK_T_IN && req.type != VIRTIO_BLK_T_OUT &&
+             req.type != VIRTIO_BLK_T_GET_ID)
+        result = VIRTIO_BLK_S_UNSUPP;
+
+    if (blk->replay)
+        result = replay_input(blk->replay, REPLAY_STATUS, result);
+    if (status) {
+        *status = result;
+        written++;
+    }
+    return written;
+}
+
+// drain everything the driver has made available, then interrupt once
+static void virtio_blk_drain(VIRTIO_BLK *blk)
+{
+    VIRTQ *vq = &blk->virtio.queues[0];
+    int done = 0;
+    int head;
+
+    pthread_mutex_lock(&blk->virtio.queue_lock);
+    while ((head = virtq_pop(&blk->virtio, vq)) >= 0) {
+        virtq_push(&blk->virtio, vq, head, virtio_blk_request(blk, vq, head));
+        done++;
+    }
+    if (done)
+        virtq_flush(&blk->virtio, vq);
+    pthread_mutex_unlock(&blk->virtio.queue_lock);
+}
+
+static void *virtio_blk_thread(void *arg)
+{
+    VIRTIO_BLK *blk = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&blk->lock);
+        while (!blk->notified)
+            pthread_cond_wait(&blk->kick, &blk->lock);
+        blk->notified = 0;
+        pthread_mutex_unlock(&blk->lock);
+        virtio_blk_drain(blk);
+    }
+    return NULL;
+}
+
+int virtio_blk_init(VIRTIO_BLK *blk, const char *path, DRAM *dram,
+                    PLIC *plic)
+{
+    struct stat st;
+    int fd;
+
+    memset(blk, 0, sizeof(*blk));
+    if (!path)
+        return 0;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Unable to open disk image %s\n", path);
+        return -1;
+    }
+    blk->disk_size = st.st_size & ~(uint64_t) (VIRTIO_BLK_SECTOR_SIZE - 1);
+    blk->disk = mmap(NULL, blk->disk_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    if (blk->disk == MAP_FAILED) {
+        fprintf(stderr, "Unable to map disk image %s\n", path);
+        blk->disk = NULL;
+        return -1;
+    }
+
+    virtio_init(&blk->virtio, VIRTIO_BLK_ID, VIRTIO_BLK_F_FLUSH, dram, plic,
+                VIRTIO_BLK_IRQ);
+    pthread_mutex_init(&blk->lock, NULL);
+    pthread_cond_init(&blk->kick, NULL);
+    pthread_create(&blk->thread, NULL, virtio_blk_thread, blk);
+    return 0;
+}
+
+uint64_t virtio_blk_load(VIRTIO_BLK *blk, uint64_t addr, uint64_t size)
+{
+    uint64_t offset = addr - VIRTIO_BLK_BASE;
+
+    if (!blk->disk)
+        return 0;
+    if (offset >= VIRTIO_MMIO_CONFIG) {
+        // config space: capacity in 512-byte sectors
+        uint64_t capacity = blk->disk_size / VIRTIO_BLK_SECTOR_SIZE;
+        offset -= VIRTIO_MMIO_CONFIG;
+        if (offset >= 8)
+            return 0;
+        capacity >>= offset * 8;
+        return size < 64 ? capacity & ((1ULL << size) - 1) : capacity;
+    }
+    return virtio_mmio_load(&blk->virtio, offset);
+}
+
+void virtio_blk_store(VIRTIO_BLK *blk, uint64_t addr, uint64_t size,
+                      uint64_t value)
+{
+    uint64_t offset = addr - VIRTIO_BLK_BASE;
+
+    if (!blk->disk)
+        return;
+    if (offset == VIRTIO_MMIO_QUEUE_NOTIFY && blk->replay) {
+        virtio_blk_drain(blk);
+        return;
+    }
+    if (offset == VIRTIO_MMIO_QUEUE_NOTIFY) {
+        pthread_mutex_lock(&blk->lock);
+        blk->notified = 1;
+        pthread_cond_signal(&blk->kick);
+        pthread_mutex_unlock(&blk->lock);
+        return;
+    }
+    virtio_mmio_store(&blk->virtio, offset, value);
+}
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "virtio_net.h"
+
+// One frame worth of guest buffers, with the virtio_net_hdr split off
+typedef struct NET_CHAIN {
+    uint16_t head;
+    uint8_t *hdr;  // NULL if the chain is too short to hold a header
+    int iovcnt;
+    struct iovec iov[VIRTIO_NET_MAX_SEGS];
+} NET_CHAIN;
+
+// Collect the buffers of a descriptor chain into iovecs over guest RAM,
+// skipping the leading virtio_net_hdr bytes.
+static void virtio_net_chain(VIRTIO_NET *net, VIRTQ *vq, uint16_t head,
+                             NET_CHAIN *chain)
+{
+    VIRTIO *vio = &net->virtio;
+    struct virtq_desc desc;
+    int ok = virtq_desc(vio, vq, head, &desc) == 0;
+    uint32_t skip = VIRTIO_NET_HDR_SIZE;
+
+    chain->head = head;
+    chain->hdr = NULL;
+    chain->iovcnt = 0;
+    for (int n = 0; ok && n < vq->num; n++) {
+        uint8_t *buf = virtio_guest_ptr(vio, desc.addr, desc.len);
+        uint32_t len = desc.len;
+        if (!buf)
+            break;
+        if (skip == VIRTIO_NET_HDR_SIZE && len >= skip)
+            chain->hdr = buf;
+        if (skip) {
+            uint32_t s = len < skip ? len : skip;
+            buf += s;
+            len -= s;
+            skip -= s;
+        }
+        if (len && chain->iovcnt < VIRTIO_NET_MAX_SEGS) {
+            chain->iov[chain->iovcnt].iov_base = buf;
+            chain->iov[chain->iovcnt].iov_len = len;
+            chain->iovcnt++;
+        }
+        if (!(desc.flags & VIRTQ_DESC_F_NEXT))
+            break;
+        ok = virtq_desc(vio, vq, desc.next, &desc) == 0;
+    }
+}
+
+// wait for a QueueNotify of the given queue
+static void virtio_net_wait(VIRTIO_NET *net, int *notified)
+{
+    pthread_mutex_lock(&net->lock);
+    while (!*notified)
+        pthread_cond_wait(&net->kick, &net->lock);
+    *notified = 0;
+    pthread_mutex_unlock(&net->lock);
+}
+
+static void *virtio_net_tx_thread(void *arg)
+{
+    VIRTIO_NET *net = arg;
+    VIRTIO *vio = &net->virtio;
+    VIRTQ *vq = &vio->queues[VIRTIO_NET_TXQ];
+    NET_CHAIN chains[VIRTIO_NET_BATCH];
+    struct mmsghdr msgs[VIRTIO_NET_BATCH];
+
+    for (;;) {
+        virtio_net_wait(net, &net->tx_notified);
+
+        int n;
+        do {
+            int head;
+            uint32_t resets;
+            pthread_mutex_lock(&vio->queue_lock);
+            resets = vio->resets;
+            for (n = 0; n < VIRTIO_NET_BATCH && (head = virtq_pop(vio, vq)) >= 0;
+                 n++) {
+                virtio_net_chain(net, vq, head, &chains[n]);
+                memset(&msgs[n], 0, sizeof(msgs[n]));
+                msgs[n].msg_hdr.msg_iov = chains[n].iov;
+                msgs[n].msg_hdr.msg_iovlen = chains[n].iovcnt;
+                if (net->has_peer) {
+                    msgs[n].msg_hdr.msg_name = &net->peer;
+                    msgs[n].msg_hdr.msg_namelen = sizeof(net->peer);
+                }
+            }
+            pthread_mutex_unlock(&vio->queue_lock);
+
+            // unlocked, as the send may wait for our own receive thread
+            for (int sent = 0; sent < n;) {
+                int r = sendmmsg(net->tx_fd, msgs + sent, n - sent, 0);
+                if (r <= 0)
+                    break;  // the peer is gone: drop the frames like a wire
+                for (int i = sent; i < sent + r; i++)
+                    vio->bytes_out += msgs[i].msg_len;
+                sent += r;
+            }
+
+            pthread_mutex_lock(&vio->queue_lock);
+            if (vio->resets == resets) {
+                for (int i = 0; i < n; i++)
+                    virtq_push(vio, vq, chains[i].head, 0);
+                if (n)
+                    virtq_flush(vio, vq);
+            }
+            pthread_mutex_unlock(&vio->queue_lock);
+        } while (n == VIRTIO_NET_BATCH);
+    }
+    return NULL;
+}
+
+static void *virtio_net_rx_thread(void *arg)
+{
+    VIRTIO_NET *net = arg;
+    VIRTIO *vio = &net->virtio;
+    VIRTQ *vq = &vio->queues[VIRTIO_NET_RXQ];
+    NET_CHAIN chains[VIRTIO_NET_BATCH];
+    struct mmsghdr msgs[VIRTIO_NET_BATCH];
+    int n = 0;  // receive buffers held, carried over between batches
+    uint32_t resets = 0;  // of the device when they were popped
+
+    for (;;) {
+        int head;
+        pthread_mutex_lock(&vio->queue_lock);
+        if (vio->resets != resets) {
+            n = 0;  // the driver took the buffers back
+            resets = vio->resets;
+        }
+        while (n < VIRTIO_NET_BATCH && (head = virtq_pop(vio, vq)) >= 0)
+            virtio_net_chain(net, vq, head, &chains[n++]);
+        pthread_mutex_unlock(&vio->queue_lock);
+        if (!n) {
+            // no buffers posted: leave frames queued in the socket
+            virtio_net_wait(net, &net->rx_notified);
+            continue;
+        }
+
+        struct pollfd pfd = {.fd = net->rx_fd, .events = POLLIN};
+        if (poll(&pfd, 1, -1) <= 0)
+            continue;
+
+        // the buffers are written only while a reset cannot take them back
+        pthread_mutex_lock(&vio->queue_lock);
+        if (vio->resets != resets) {
+            pthread_mutex_unlock(&vio->queue_lock);
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = chains[i].iov;
+            msgs[i].msg_hdr.msg_iovlen = chains[i].iovcnt;
+        }
+        int r = recvmmsg(net->rx_fd, msgs, n, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < r; i++) {
+            if (chains[i].hdr) {
+                memset(chains[i].hdr, 0, VIRTIO_NET_HDR_SIZE);
+                chains[i].hdr[10] = 1;  // num_buffers
+            }
+            virtq_push(vio, vq, chains[i].head,
+                       VIRTIO_NET_HDR_SIZE + msgs[i].msg_len);
+            vio->bytes_in += msgs[i].msg_len;
+        }
+        if (r > 0) {
+            virtq_flush(vio, vq);
+            n -= r;
+            memmove(chains, chains + r, n * sizeof(chains[0]));
+        }
+        pthread_mutex_unlock(&vio->queue_lock);
+    }
+    return NULL;
+}
+
+static int virtio_net_open(VIRTIO_NET *net, const char *backend)
+{
+    int sv[2];
+
+    if (!strcmp(backend, "loop")) {
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+            return -1;
+        net->tx_fd = sv[0];
+        net->rx_fd = sv[1];
+        return 0;
+    }
+
+    if (!strncmp(backend, "unix:", 5)) {
+        char *local = strdup(backend + 5);
+        char *peer = strchr(local, ':');
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        int err = -1;
+
+        if (peer && fd >= 0) {
+            *peer++ = '\0';
+            unlink(local);
+            strncpy(addr.sun_path, local, sizeof(addr.sun_path) - 1);
+            err = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+            // frames are addressed per message, so the peer may start later
+            net->peer.sun_family = AF_UNIX;
+            strncpy(net->peer.sun_path, peer, sizeof(net->peer.sun_path) - 1);
+            net->has_peer = 1;
+        }
+        free(local);
+        if (err < 0) {
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        net->tx_fd = net->rx_fd = fd;
+        return 0;
+    }
+    return -1;
+}
+
+int virtio_net_init(VIRTIO_NET *net, const char *backend, DRAM *dram,
+                    PLIC *plic)
+{
+    memset(net, 0, sizeof(*net));
+    if (!backend)
+        return 0;
+
+    if (virtio_net_open(net, backend) < 0) {
+        fprintf(stderr, "Unable to open network backend %s\n", backend);
+        return -1;
+    }
+    // a locally administered address, unique per emulator process
+    uint32_t id = getpid();
+    uint8_t mac[6] = {0x52, 0x54, id >> 24, id >> 16, id >> 8, id};
+    memcpy(net->mac, mac, sizeof(mac));
+    net->present = 1;
+
+    virtio_init(&net->virtio, VIRTIO_NET_ID,
+                VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS, dram, plic,
+                VIRTIO_NET_IRQ);
+    pthread_mutex_init(&net->lock, NULL);
+    pthread_cond_init(&net->kick, NULL);
+    pthread_create(&net->tx_thread, NULL, virtio_net_tx_thread, net);
+    pthread_create(&net->rx_thread, NULL, virtio_net_rx_thread, net);
+    return 0;
+}
+
+uint64_t virtio_net_load(VIRTIO_NET *net, uint64_t addr, uint64_t size)
+{
+    uint64_t offset = addr - VIRTIO_NET_BASE;
+
+    if (!net->present)
+        return 0;
+    if (offset >= VIRTIO_MMIO_CONFIG) {
+        // config space: mac[6], then a 16-bit status with LINK_UP set
+        uint8_t config[8] = {0};
+        uint64_t value = 0;
+        memcpy(config, net->mac, sizeof(net->mac));
+        config[6] = 1;
+        offset -= VIRTIO_MMIO_CONFIG;
+        for (int i = 0; i < size / 8 && offset + i < sizeof(config); i++)
+            value |= (uint64_t) config[offset + i] << (8 * i);
+        return value;
+    }
+    return virtio_mmio_load(&net->virtio, offset);
+}
+
+void virtio_net_store(VIRTIO_NET *net, uint64_t addr, uint64_t size,
+                      uint64_t value)
+{
+    uint64_t offset = addr - VIRTIO_NET_BASE;
+
+    if (!net->present)
+        return;
+    if (offset == VIRTIO_MMIO_QUEUE_NOTIFY) {
+        pthread_mutex_lock(&net->lock);
+        if (value == VIRTIO_NET_TXQ)
+            net->tx_notified = 1;
+        else
+            net->rx_notified = 1;
+        pthread_cond_broadcast(&net->kick);
+        pthread_mutex_unlock(&net->lock);
+        return;
+    }
+    virtio_mmio_store(&net->virtio, offset, value);
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "watch.h"
+
+static uint64_t watch_value(WATCH *w, WATCH_RANGE *r)
+{
+    uint64_t value = 0;
+
+    memcpy(&value, &w->cpu->bus->dram.mem[r->addr - DRAM_BASE], r->len);
+    return value;
+}
+
+// host page index of a DRAM offset
+static uint64_t watch_page(WATCH *w, uint64_t off)
+{
+    return off / w->page_size;
+}
+
+static void watch_protect(WATCH *w, uint64_t page, int prot)
+{
+    mprotect(w->cpu->bus->dram.mem + page * w->page_size, w->page_size, prot);
+}
+
+int watch_fault(WATCH *w, void *addr)
+{
+    uint8_t *host = addr;
+    uint8_t *mem = w->cpu->bus->dram.mem;
+    uint64_t page;
+
+    if (host < mem || host >= mem + DRAM_SIZE ||
+        w->open[page = watch_page(w, host - mem)])
+        return 0;
+    uint64_t paddr = DRAM_BASE + (host - mem);
+    // inst_pc is the store's only while the hart runs a block: every store
+    // path in one publishes it first
+    int hart = pthread_equal(pthread_self(), w->thread) &&
+               w->cpu->bcache.running;
+
+    for (int i = 0; i < w->n; i++) {
+        WATCH_RANGE *r = &w->ranges[i];
+        uint64_t off = r->addr - DRAM_BASE;
+        if (watch_page(w, off) != page &&
+            watch_page(w, off + r->len - 1) != page)
+            continue;
+        if (!r->armed) {
+            r->old = watch_value(w, r);
+            r->armed = 1;
+            r->pc = hart ? w->cpu->inst_pc : ~0ULL;
+        }
+        if (paddr >= r->addr && paddr < r->addr + r->len) {
+            r->hit = 1;
+            r->pc = hart ? w->cpu->inst_pc : ~0ULL;
+        }
+    }
+    watch_protect(w, page, PROT_READ | PROT_WRITE);
+    w->open[page] = 1;
+    w->faults++;
+    if (hart)
+        block_stop(w->cpu);  // stop after it
+    __atomic_store_n(&w->pending, 1, __ATOMIC_RELEASE);
+    cpu_request_poll(w->cpu);
+    return 1;
+}
+
+WATCH *watch_create(CPU *cpu)
+{
+    WATCH *w = calloc(1, sizeof(WATCH));
+
+    if (!w) {
+        fprintf(stderr, "Memory error!");
+        exit(1);
+    }
+    w->cpu = cpu;
+    w->thread = pthread_self();
+    w->page_size = sysconf(_SC_PAGESIZE);
+    return w;
+}
+
+int watch_add(WATCH *w, uint64_t addr, int len)
+{
+    if (w->n == WATCH_MAX || (len & (len - 1)) || len < 1 || len > 8 ||
+        addr < DRAM_BASE || addr - DRAM_BASE > DRAM_SIZE - len)
+        return -1;
+    w->ranges[w->n++] = (WATCH_RANGE){.addr = addr, .len = len};
+    for (uint64_t off = addr - DRAM_BASE; off < addr - DRAM_BASE + len;
+         off = (off / w->page_size + 1) * w->page_size)
+        watch_protect(w, watch_page(w, off), PROT_READ);
+    return 0;
+}
+
+void watch_poll(CPU *cpu)
+{
+    WATCH *w = cpu->watch;
+
+    __atomic_store_n(&w->pending, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < w->n; i++) {
+        WATCH_RANGE *r = &w->ranges[i];
+        uint64_t value;
+
+        if (!r->armed)
+            continue;
+        value = watch_value(w, r);
+        if (r->hit || value != r->old) {
+            if (r->pc == ~0ULL)
+                fprintf(stderr, "Watch: device wrote %#lx: %#lx -> %#lx\n",
+                        r->addr, r->old, value);
+            else
+                fprintf(stderr, "Watch: pc %#lx wrote %#lx: %#lx -> %#lx\n",
+                        r->pc, r->addr, r->old, value);
+            w->hits++;
+        }
+        r->armed = r->hit = 0;
+    }
+    for (uint64_t page = 0; page < DRAM_SIZE / w->page_size; page++) {
+        if (w->open[page]) {
+            w->open[page] = 0;
+            watch_protect(w, page, PROT_READ);
+        }
+    }
+}
+
+void watch_dump_stats(WATCH *w)
+{
+    fprintf(stderr, "Watchpoints: %lu hits, %lu protection faults\n", w->hits,
+            w->faults);
+}
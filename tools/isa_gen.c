@@ -0,0 +1,182 @@
+// Build-time generator for the decode lookup tables.
+//
+// Usage: isa_gen <output.c>
+//
+// Expands includes/isa.def into isa_decode_key[] and isa_decode_list[] (see
+// includes/isa.h), then checks the generated decoder against the table
+// itself before writing anything: every line must decode to itself, and
+// every one of the 2^32 encodings must decode to the same instruction as a
+// first-match scan of isa.def. A mismatch fails the build.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+
+typedef struct INSN_DESC {
+    const char *id;
+    uint32_t mask;
+    uint32_t match;
+} INSN_DESC;
+
+static const INSN_DESC insn[ISA_COUNT] = {
+#define INSN(id, name, mask, match, args, exec, cls) {#id, mask, match},
+#include "isa.def"
+#undef INSN
+};
+
+static uint16_t key_table[1 << ISA_KEY_BITS];
+static ISA_CANDIDATE list[1 << ISA_KEY_BITS];
+static int list_len;
+
+// the instruction bits a key stands for
+static uint32_t key_bits(uint32_t key)
+{
+    return ((key & 0x1f) << 2) | 0x3 | (((key >> 5) & 0x7) << 12) |
+           ((key >> 8) << 25);
+}
+
+static int compatible(const INSN_DESC *d, uint32_t bits)
+{
+    return (bits & d->mask & ISA_KEY_MASK) == (d->match & ISA_KEY_MASK);
+}
+
+static int decided_by_key(const INSN_DESC *d)
+{
+    return (d->mask & ~ISA_KEY_MASK) == 0;
+}
+
+static void build(void)
+{
+    ISA_CANDIDATE cand[ISA_COUNT];
+
+    for (uint32_t key = 0; key < (1 << ISA_KEY_BITS); key++) {
+        uint32_t bits = key_bits(key);
+        int n = 0;
+
+        // candidates in priority order, up to the first one that the key
+        // alone decides, which shadows everything after it
+        for (int i = 0; i < ISA_COUNT; i++) {
+            if (!compatible(&insn[i], bits))
+                continue;
+            cand[n++] = (ISA_CANDIDATE){insn[i].mask, insn[i].match, i};
+            if (decided_by_key(&insn[i]))
+                break;
+        }
+        if (n == 1) {
+            key_table[key] = cand[0].id;
+            continue;
+        }
+
+        // keys with the same candidates share one list
+        int at;
+        for (at = 0; at + n <= list_len; at++)
+            if (!memcmp(&list[at], cand, n * sizeof(cand[0])))
+                break;
+        if (at + n > list_len) {
+            at = list_len;
+            memcpy(&list[at], cand, n * sizeof(cand[0]));
+            list_len += n;
+        }
+        key_table[key] = ISA_LIST + at;
+    }
+}
+
+static int decode(uint32_t inst)
+{
+    uint16_t e = key_table[ISA_KEY(inst)];
+
+    if ((inst & 0x3) != 0x3)
+        return ISA_ILLEGAL;
+    if (e < ISA_LIST)
+        return e;
+    const ISA_CANDIDATE *c = &list[e - ISA_LIST];
+    while ((inst & c->mask) != c->match)
+        c++;
+    return c->id;
+}
+
+static int check(void)
+{
+    // reference decoder: first match in isa.def, bucketed by major opcode
+    static uint16_t bucket[128][ISA_COUNT];
+    static int bucket_len[128];
+    int errors = 0;
+
+    for (int i = 0; i < ISA_COUNT; i++) {
+        const INSN_DESC *d = &insn[i];
+        int bad = (d->match & ~d->mask) || (d->mask & 0x7f) != 0x7f ||
+                  (d->match & 0x3) != 0x3;
+        if (i == ISA_ILLEGAL ? d->mask != 0 : bad) {
+            fprintf(stderr, "isa_gen: %s: bad mask/match\n", d->id);
+            errors++;
+        } else if (i != ISA_ILLEGAL && decode(d->match) != i) {
+            fprintf(stderr, "isa_gen: %s is shadowed by %s\n", d->id,
+                    insn[decode(d->match)].id);
+            errors++;
+        }
+        for (int op = 0; op < 128; op++)
+            if ((op & d->mask) == (d->match & 0x7f & d->mask))
+                bucket[op][bucket_len[op]++] = i;
+    }
+    if (errors)
+        return errors;
+
+    uint32_t inst = 0;
+    do {
+        const uint16_t *b = bucket[inst & 0x7f];
+        int ref = (inst & 0x3) != 0x3 ? ISA_ILLEGAL : -1;
+        for (int j = 0; ref < 0; j++)
+            if ((inst & insn[b[j]].mask) == insn[b[j]].match)
+                ref = b[j];
+        int got = decode(inst);
+        if (got != ref) {
+            if (errors++ < 16)
+                fprintf(stderr, "isa_gen: %08x decodes to %s, table says %s\n",
+                        inst, insn[got].id, insn[ref].id);
+        }
+    } while (++inst != 0);
+    return errors;
+}
+
+static int emit(const char *path)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "// Generated by tools/isa_gen.c from includes/isa.def. "
+               "Do not edit.\n");
+    fprintf(f, "#include \"isa.h\"\n\n");
+    fprintf(f, "const uint16_t isa_decode_key[1 << ISA_KEY_BITS] = {");
+    for (int key = 0; key < (1 << ISA_KEY_BITS); key++)
+        fprintf(f, "%s%#x,", key % 12 ? " " : "\n    ", key_table[key]);
+    fprintf(f, "\n};\n\n");
+    fprintf(f, "const ISA_CANDIDATE isa_decode_list[] = {\n");
+    for (int i = 0; i < list_len; i++)
+        fprintf(f, "    {0x%08x, 0x%08x, ISA_%s},\n", list[i].mask,
+                list[i].match, insn[list[i].id].id);
+    fprintf(f, "};\n");
+    return fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: isa_gen <output.c>\n");
+        return 1;
+    }
+    build();
+    int errors = check();
+    if (errors) {
+        fprintf(stderr, "isa_gen: %d mismatches, not writing %s\n", errors,
+                argv[1]);
+        return 1;
+    }
+    printf("isa_gen: %d instructions, %d list entries, 2^32 encodings "
+           "checked\n",
+           ISA_COUNT, list_len);
+    return emit(argv[1]) ? 1 : 0;
+}